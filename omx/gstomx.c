@@ -29,6 +29,7 @@
 #include <string.h>
 
 #include "gstomx.h"
+#include "gstomxvideo.h"
 #include "gstomxmjpegdec.h"
 #include "gstomxmpeg2videodec.h"
 #include "gstomxmpeg4videodec.h"
@@ -38,6 +39,8 @@
 #include "gstomxvp8dec.h"
 #include "gstomxtheoradec.h"
 #include "gstomxwmvdec.h"
+#include "gstomxparalleldec.h"
+#include "gstomxmultidec.h"
 #include "gstomxmpeg4videoenc.h"
 #include "gstomxh264enc.h"
 #include "gstomxh263enc.h"
@@ -239,6 +242,20 @@ gst_omx_component_handle_messages (GstOMXComponent * comp)
         GstOMXPort *port = NULL;
         OMX_U32 index = msg->content.flush.port;
 
+        /* Completion of a flush of all ports, for components that don't
+         * report the ports one by one */
+        if (index == OMX_ALL) {
+          gint i;
+
+          GST_DEBUG_OBJECT (comp->parent, "%s all ports flushed", comp->name);
+          for (i = 0; i < comp->ports->len; i++) {
+            port = g_ptr_array_index (comp->ports, i);
+            if (port->flushing)
+              port->flushed = TRUE;
+          }
+          break;
+        }
+
         port = gst_omx_component_get_port (comp, index);
         if (!port)
           break;
@@ -1439,6 +1456,33 @@ done:
   return err;
 }
 
+/* Puts @buf back into the queue of free buffers of @port without passing
+ * it to the component, e.g. if it was acquired but never filled.
+ *
+ * NOTE: Uses comp->lock and comp->messages_lock */
+void
+gst_omx_port_return_buffer (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  GstOMXComponent *comp;
+
+  g_return_if_fail (port != NULL);
+  g_return_if_fail (buf != NULL);
+  g_return_if_fail (buf->port == port);
+
+  comp = port->comp;
+
+  g_mutex_lock (&comp->lock);
+
+  GST_DEBUG_OBJECT (comp->parent, "Returning buffer %p (%p) to %s port %u",
+      buf, buf->omx_buf->pBuffer, comp->name, port->index);
+
+  g_assert (!buf->used);
+  g_queue_push_head (&port->pending_buffers, buf);
+  gst_omx_component_send_message (comp, NULL);
+
+  g_mutex_unlock (&comp->lock);
+}
+
 /* NOTE: Uses comp->lock and comp->messages_lock */
 OMX_ERRORTYPE
 gst_omx_port_set_flushing (GstOMXPort * port, GstClockTime timeout,
@@ -1558,6 +1602,133 @@ done:
   return err;
 }
 
+/* NOTE: Must be called while holding comp->lock */
+static gboolean
+gst_omx_component_is_flushed (GstOMXComponent * comp)
+{
+  gint i;
+
+  for (i = 0; i < comp->ports->len; i++) {
+    GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+    if (!port->flushed && port->buffers
+        && port->buffers->len > g_queue_get_length (&port->pending_buffers))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Like gst_omx_port_set_flushing() on all ports, but flushing them with a
+ * single OMX_CommandFlush for OMX_ALL. Buffers stay allocated and the ports
+ * stay enabled. If the component rejects the command the ports are left as
+ * they were, so that callers can fall back to flushing port by port if
+ * gst_omx_error_is_unsupported() is TRUE for the returned error. Flushing
+ * again after any other error, e.g. a timeout, won't succeed either.
+ *
+ * NOTE: Uses comp->lock and comp->messages_lock */
+OMX_ERRORTYPE
+gst_omx_component_set_flushing (GstOMXComponent * comp, GstClockTime timeout,
+    gboolean flush)
+{
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+  gboolean signalled;
+  OMX_ERRORTYPE last_error;
+  gint i;
+
+  g_return_val_if_fail (comp != NULL, OMX_ErrorUndefined);
+
+  g_mutex_lock (&comp->lock);
+
+  GST_DEBUG_OBJECT (comp->parent, "Setting all %s ports to %sflushing",
+      comp->name, (flush ? "" : "not "));
+
+  gst_omx_component_handle_messages (comp);
+
+  if ((err = comp->last_error) != OMX_ErrorNone) {
+    GST_ERROR_OBJECT (comp->parent, "Component %s is in error state: %s "
+        "(0x%08x)", comp->name, gst_omx_error_to_string (err), err);
+    goto done;
+  }
+
+  if (!flush) {
+    for (i = 0; i < comp->ports->len; i++) {
+      GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+      port->flushing = FALSE;
+      port->eos = FALSE;
+    }
+    goto done;
+  }
+
+  for (i = 0; i < comp->ports->len; i++) {
+    GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+    port->flushing = TRUE;
+    port->flushed = FALSE;
+  }
+
+  gst_omx_component_send_message (comp, NULL);
+
+  err = OMX_SendCommand (comp->handle, OMX_CommandFlush, OMX_ALL, NULL);
+  if (err != OMX_ErrorNone) {
+    GST_WARNING_OBJECT (comp->parent,
+        "Error sending flush command to all %s ports: %s (0x%08x)",
+        comp->name, gst_omx_error_to_string (err), err);
+    for (i = 0; i < comp->ports->len; i++) {
+      GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+      port->flushing = FALSE;
+    }
+    goto done;
+  }
+
+  /* Retry until timeout or until an error happend or
+   * until every port either completed the flush command
+   * or got all its buffers back */
+  signalled = TRUE;
+  last_error = OMX_ErrorNone;
+  gst_omx_component_handle_messages (comp);
+  while (signalled && last_error == OMX_ErrorNone
+      && !gst_omx_component_is_flushed (comp)) {
+    signalled = gst_omx_component_wait_message (comp, timeout);
+    if (signalled)
+      gst_omx_component_handle_messages (comp);
+
+    last_error = comp->last_error;
+  }
+
+  for (i = 0; i < comp->ports->len; i++) {
+    GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+    port->flushed = FALSE;
+    port->eos = FALSE;
+  }
+
+  if (last_error != OMX_ErrorNone) {
+    GST_ERROR_OBJECT (comp->parent,
+        "Got error while flushing %s: %s (0x%08x)", comp->name,
+        gst_omx_error_to_string (last_error), last_error);
+    err = last_error;
+  } else if (!signalled) {
+    GST_ERROR_OBJECT (comp->parent, "Timeout while flushing %s", comp->name);
+    err = OMX_ErrorTimeout;
+  }
+
+done:
+  for (i = 0; i < comp->ports->len; i++)
+    gst_omx_port_update_port_definition (g_ptr_array_index (comp->ports, i),
+        NULL);
+
+  GST_DEBUG_OBJECT (comp->parent, "Set all %s ports to %sflushing: %s "
+      "(0x%08x)", comp->name, (flush ? "" : "not "),
+      gst_omx_error_to_string (err), err);
+  gst_omx_component_handle_messages (comp);
+  g_mutex_unlock (&comp->lock);
+
+  return err;
+}
+
 /* NOTE: Uses comp->lock and comp->messages_lock */
 gboolean
 gst_omx_port_is_flushing (GstOMXPort * port)
@@ -1583,6 +1754,60 @@ gst_omx_port_is_flushing (GstOMXPort * port)
 static OMX_ERRORTYPE gst_omx_port_deallocate_buffers_unlocked (GstOMXPort *
     port);
 
+/* Plugin-wide accounting of the port buffers of all components. The budget
+ * is set in MiB by the GST_OMX_MEMORY_BUDGET environment variable, 0 means
+ * unlimited. Elements check the available memory to ask for less before
+ * an allocation fails, allocations beyond the budget are refused */
+static GMutex memory_lock;
+static guint64 memory_budget = 0;
+static guint64 memory_used = 0;
+
+static gboolean
+gst_omx_memory_reserve (guint64 size)
+{
+  gboolean ret = TRUE;
+
+  g_mutex_lock (&memory_lock);
+  if (memory_budget > 0 && memory_used + size > memory_budget)
+    ret = FALSE;
+  else
+    memory_used += size;
+  GST_DEBUG ("Reserving %" G_GUINT64_FORMAT " bytes, %" G_GUINT64_FORMAT
+      " of %" G_GUINT64_FORMAT " bytes used: %d", size, memory_used,
+      memory_budget, ret);
+  g_mutex_unlock (&memory_lock);
+
+  return ret;
+}
+
+static void
+gst_omx_memory_release (guint64 size)
+{
+  g_mutex_lock (&memory_lock);
+  g_assert (memory_used >= size);
+  memory_used -= size;
+  g_mutex_unlock (&memory_lock);
+}
+
+/* Returns the bytes left in the memory budget, G_MAXUINT64 if there is
+ * no budget */
+guint64
+gst_omx_memory_get_available (void)
+{
+  guint64 ret;
+
+  g_mutex_lock (&memory_lock);
+  if (memory_budget == 0)
+    ret = G_MAXUINT64;
+  else if (memory_used < memory_budget)
+    ret = memory_budget - memory_used;
+  else
+    ret = 0;
+  g_mutex_unlock (&memory_lock);
+
+  return ret;
+}
+
 /* NOTE: Must be called while holding comp->lock, uses comp->messages_lock */
 static OMX_ERRORTYPE
 gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port,
@@ -1621,6 +1846,17 @@ gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port,
   g_return_val_if_fail (n == port->port_def.nBufferCountActual,
       OMX_ErrorBadParameter);
 
+  if (!gst_omx_memory_reserve ((guint64) port->port_def.nBufferSize * n)) {
+    GST_ERROR_OBJECT (comp->parent, "Allocating %d buffers of size %"
+        G_GSIZE_FORMAT " for %s port %u exceeds the memory budget", n,
+        (size_t) port->port_def.nBufferSize, comp->name,
+        (guint) port->index);
+    err = OMX_ErrorInsufficientResources;
+    goto done;
+  }
+  port->allocated_size = (guint64) port->port_def.nBufferSize * n;
+  port->allocated_def = port->port_def;
+
   GST_INFO_OBJECT (comp->parent,
       "Allocating %d buffers of size %" G_GSIZE_FORMAT " for %s port %u", n,
       (size_t) port->port_def.nBufferSize, comp->name, (guint) port->index);
@@ -1804,6 +2040,8 @@ gst_omx_port_deallocate_buffers_unlocked (GstOMXPort * port)
   g_queue_clear (&port->pending_buffers);
   g_ptr_array_unref (port->buffers);
   port->buffers = NULL;
+  gst_omx_memory_release (port->allocated_size);
+  port->allocated_size = 0;
 
   gst_omx_component_handle_messages (comp);
 
@@ -2285,6 +2523,14 @@ gst_omx_get_configuration (void)
   return config;
 }
 
+/* Returns TRUE if @err tells that the component rejected a command or
+ * parameter it doesn't implement, as opposed to failing to execute it */
+gboolean
+gst_omx_error_is_unsupported (OMX_ERRORTYPE err)
+{
+  return err == OMX_ErrorNotImplemented || err == OMX_ErrorUnsupportedIndex;
+}
+
 const gchar *
 gst_omx_error_to_string (OMX_ERRORTYPE err)
 {
@@ -2507,7 +2753,7 @@ _class_init (gpointer g_class, gpointer data)
   gchar *template_caps;
   GstPadTemplate *templ;
   GstCaps *caps;
-  gchar **hacks;
+  gchar **hacks, **color_formats;
   int i;
 
   if (!element_name)
@@ -2638,6 +2884,15 @@ _class_init (gpointer g_class, gpointer data)
 
     class_data->hacks = gst_omx_parse_hacks (hacks);
   }
+
+  /* Vendor color formats of the component, e.g. for 10 bit output */
+  if ((color_formats =
+          g_key_file_get_string_list (config, element_name, "color-formats",
+              NULL, NULL))) {
+    class_data->vendor_formats =
+        gst_omx_video_parse_vendor_formats (color_formats);
+    g_strfreev (color_formats);
+  }
 }
 
 static gboolean
@@ -2650,6 +2905,7 @@ plugin_init (GstPlugin * plugin)
   gchar *env_config_dir;
   const gchar *user_config_dir;
   const gchar *const *system_config_dirs;
+  const gchar *env_budget;
   gint i, j;
   gsize n_elements;
   static const gchar *config_name[] = { "gstomx.conf", NULL };
@@ -2662,6 +2918,11 @@ plugin_init (GstPlugin * plugin)
   /* Set the default path of gstomx.conf */
   g_setenv (*env_config_name, "/etc", FALSE);
 
+  if ((env_budget = g_getenv ("GST_OMX_MEMORY_BUDGET"))) {
+    memory_budget = g_ascii_strtoull (env_budget, NULL, 10) << 20;
+    GST_INFO ("Memory budget of %" G_GUINT64_FORMAT " bytes", memory_budget);
+  }
+
   /* Read configuration file gstomx.conf from the preferred
    * configuration directories */
   env_config_dir = g_strdup (g_getenv (*env_config_name));
@@ -2702,6 +2963,13 @@ plugin_init (GstPlugin * plugin)
   for (i = 0; i < G_N_ELEMENTS (types); i++)
     types[i] ();
 
+  /* Not backed by a component themselves, they run the configured
+   * decoders */
+  ret |= gst_element_register (plugin, "omxparalleldec", GST_RANK_NONE,
+      GST_TYPE_OMX_PARALLEL_DEC);
+  ret |= gst_element_register (plugin, "omxmultidec", GST_RANK_NONE,
+      GST_TYPE_OMX_MULTI_DEC);
+
   elements = g_key_file_get_groups (config, &n_elements);
   for (i = 0; i < n_elements; i++) {
     GTypeQuery type_query;
@@ -247,6 +247,11 @@ struct _GstOMXPort {
   gboolean disabled_pending; /* was done until it took effect */
   gboolean eos; /* TRUE after a buffer with EOS flag was received */
 
+  /* Size of the allocated buffers, accounted in the memory budget */
+  guint64 allocated_size;
+  /* Port definition the allocated buffers were laid out for */
+  OMX_PARAM_PORTDEFINITIONTYPE allocated_def;
+
   /* Increased whenever the settings of these port change.
    * If settings_cookie != configured_settings_cookie
    * the port has to be reconfigured.
@@ -316,17 +321,24 @@ struct _GstOMXClassData {
 
   guint64 hacks;
 
+  /* Vendor OMX_COLOR_FORMATTYPE to GstVideoFormat, from the
+   * color-formats configuration, or NULL */
+  GHashTable *vendor_formats;
+
   GstOmxComponentType type;
 };
 
 GKeyFile *        gst_omx_get_configuration (void);
 
 const gchar *     gst_omx_error_to_string (OMX_ERRORTYPE err);
+gboolean          gst_omx_error_is_unsupported (OMX_ERRORTYPE err);
 const gchar *     gst_omx_state_to_string (OMX_STATETYPE state);
 const gchar *     gst_omx_command_to_string (OMX_COMMANDTYPE cmd);
 
 guint64           gst_omx_parse_hacks (gchar ** hacks);
 
+guint64           gst_omx_memory_get_available (void);
+
 GstOMXCore *      gst_omx_core_acquire (const gchar * filename);
 void              gst_omx_core_release (GstOMXCore * core);
 
@@ -342,6 +354,7 @@ const gchar *     gst_omx_component_get_last_error_string (GstOMXComponent * com
 
 GstOMXPort *      gst_omx_component_add_port (GstOMXComponent * comp, guint32 index);
 GstOMXPort *      gst_omx_component_get_port (GstOMXComponent * comp, guint32 index);
+OMX_ERRORTYPE     gst_omx_component_set_flushing (GstOMXComponent * comp, GstClockTime timeout, gboolean flush);
 
 OMX_ERRORTYPE     gst_omx_component_get_parameter (GstOMXComponent * comp, OMX_INDEXTYPE index, gpointer param);
 OMX_ERRORTYPE     gst_omx_component_set_parameter (GstOMXComponent * comp, OMX_INDEXTYPE index, gpointer param);
@@ -358,6 +371,7 @@ OMX_ERRORTYPE     gst_omx_port_update_port_definition (GstOMXPort *port, OMX_PAR
 
 GstOMXAcquireBufferReturn gst_omx_port_acquire_buffer (GstOMXPort *port, GstOMXBuffer **buf);
 OMX_ERRORTYPE     gst_omx_port_release_buffer (GstOMXPort *port, GstOMXBuffer *buf);
+void              gst_omx_port_return_buffer (GstOMXPort *port, GstOMXBuffer *buf);
 
 OMX_ERRORTYPE     gst_omx_port_set_flushing (GstOMXPort *port, GstClockTime timeout, gboolean flush);
 gboolean          gst_omx_port_is_flushing (GstOMXPort *port);
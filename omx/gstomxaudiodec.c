@@ -947,22 +947,30 @@ gst_omx_audio_dec_flush (GstAudioDecoder * decoder, gboolean hard)
 {
   GstOMXAudioDec *self = GST_OMX_AUDIO_DEC (decoder);
   OMX_ERRORTYPE err = OMX_ErrorNone;
+  gboolean paused = FALSE;
 
   GST_DEBUG_OBJECT (self, "Flushing decoder");
 
   if (gst_omx_component_get_state (self->dec, 0) == OMX_StateLoaded)
     return;
 
-  /* 0) Pause the components */
-  if (gst_omx_component_get_state (self->dec, 0) == OMX_StateExecuting) {
-    gst_omx_component_set_state (self->dec, OMX_StatePause);
-    gst_omx_component_get_state (self->dec, GST_CLOCK_TIME_NONE);
-  }
-
-  /* 1) Flush the ports */
+  /* 0) Flush all ports with a single command, without pausing */
   GST_DEBUG_OBJECT (self, "flushing ports");
-  gst_omx_port_set_flushing (self->dec_in_port, 5 * GST_SECOND, TRUE);
-  gst_omx_port_set_flushing (self->dec_out_port, 5 * GST_SECOND, TRUE);
+  err = gst_omx_component_set_flushing (self->dec, 5 * GST_SECOND, TRUE);
+
+  if (gst_omx_error_is_unsupported (err)) {
+    GST_DEBUG_OBJECT (self, "Flushing port by port");
+
+    /* 1) Pause the components and flush the ports one by one */
+    if (gst_omx_component_get_state (self->dec, 0) == OMX_StateExecuting) {
+      gst_omx_component_set_state (self->dec, OMX_StatePause);
+      gst_omx_component_get_state (self->dec, GST_CLOCK_TIME_NONE);
+    }
+    paused = TRUE;
+
+    gst_omx_port_set_flushing (self->dec_in_port, 5 * GST_SECOND, TRUE);
+    gst_omx_port_set_flushing (self->dec_out_port, 5 * GST_SECOND, TRUE);
+  }
 
   /* 2) Wait until the srcpad loop is stopped,
    * unlock GST_AUDIO_DECODER_STREAM_LOCK to prevent deadlocks
@@ -973,8 +981,10 @@ gst_omx_audio_dec_flush (GstAudioDecoder * decoder, gboolean hard)
   GST_AUDIO_DECODER_STREAM_LOCK (self);
 
   /* 3) Resume components */
-  gst_omx_component_set_state (self->dec, OMX_StateExecuting);
-  gst_omx_component_get_state (self->dec, GST_CLOCK_TIME_NONE);
+  if (paused) {
+    gst_omx_component_set_state (self->dec, OMX_StateExecuting);
+    gst_omx_component_get_state (self->dec, GST_CLOCK_TIME_NONE);
+  }
 
   /* 4) Unset flushing to allow ports to accept data again */
   gst_omx_port_set_flushing (self->dec_in_port, 5 * GST_SECOND, FALSE);
@@ -871,8 +871,12 @@ gst_omx_audio_enc_flush (GstAudioEncoder * encoder)
 
   GST_DEBUG_OBJECT (self, "Resetting encoder");
 
-  gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, TRUE);
-  gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, TRUE);
+  /* Flush all ports with a single command if possible */
+  if (gst_omx_error_is_unsupported (gst_omx_component_set_flushing (self->enc,
+              5 * GST_SECOND, TRUE))) {
+    gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, TRUE);
+    gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, TRUE);
+  }
 
   /* Wait until the srcpad loop is finished */
   GST_AUDIO_ENCODER_STREAM_UNLOCK (self);
@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2016, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "gstomx.h"
+#include "gstomxbitstream.h"
+
+#define GST_CAT_DEFAULT gst_omx_video_debug_category
+
+static const guint8 nal_start_code[] = { 0x00, 0x00, 0x00, 0x01 };
+
+static const guint8 vc1_frame_start_code[] = { 0x00, 0x00, 0x01, 0x0d };
+
+void
+gst_omx_bitstream_init (GstOMXBitstream * bs)
+{
+  memset (bs, 0, sizeof (GstOMXBitstream));
+  bs->format = GST_OMX_BITSTREAM_PLAIN;
+}
+
+void
+gst_omx_bitstream_clear (GstOMXBitstream * bs)
+{
+  gst_buffer_replace (&bs->header, NULL);
+  g_free (bs->parameter_sets);
+  gst_omx_bitstream_init (bs);
+}
+
+/* Frames are passed as they are, @header is passed before the first one */
+void
+gst_omx_bitstream_set_plain (GstOMXBitstream * bs, GstBuffer * header)
+{
+  gst_omx_bitstream_clear (bs);
+  gst_buffer_replace (&bs->header, header);
+}
+
+/* Appends @count NAL units from @data, each of them with a 16 bit length
+ * in front as in avcC and hvcC, to @sets with start codes instead */
+static gboolean
+gst_omx_bitstream_append_nal_units (GByteArray * sets, const guint8 ** data,
+    const guint8 * end, guint count)
+{
+  const guint8 *p = *data;
+
+  while (count--) {
+    gsize len;
+
+    if (end - p < 2)
+      return FALSE;
+    len = GST_READ_UINT16_BE (p);
+    p += 2;
+    if ((gsize) (end - p) < len)
+      return FALSE;
+
+    g_byte_array_append (sets, nal_start_code, sizeof (nal_start_code));
+    g_byte_array_append (sets, p, len);
+    p += len;
+  }
+
+  *data = p;
+
+  return TRUE;
+}
+
+static gboolean
+gst_omx_bitstream_set_nal_length (GstOMXBitstream * bs, GByteArray * sets,
+    guint nal_length_size)
+{
+  if (nal_length_size == 3) {
+    g_byte_array_free (sets, TRUE);
+    return FALSE;
+  }
+
+  bs->format = GST_OMX_BITSTREAM_NAL_LENGTH;
+  bs->nal_length_size = nal_length_size;
+  bs->parameter_sets_size = sets->len;
+  bs->parameter_sets = g_byte_array_free (sets, FALSE);
+
+  GST_DEBUG ("Converting NAL units with %u byte lengths, %" G_GSIZE_FORMAT
+      " bytes of parameter sets", bs->nal_length_size,
+      bs->parameter_sets_size);
+
+  return TRUE;
+}
+
+/* H.264 with avcC @codec_data, stream-format=avc */
+gboolean
+gst_omx_bitstream_set_avc (GstOMXBitstream * bs, GstBuffer * codec_data)
+{
+  GByteArray *sets;
+  GstMapInfo map;
+  const guint8 *p, *end;
+  guint nal_length_size = 0;
+  guint count;
+  gboolean ret = FALSE;
+
+  gst_omx_bitstream_clear (bs);
+
+  if (!codec_data || !gst_buffer_map (codec_data, &map, GST_MAP_READ)) {
+    GST_WARNING ("avc stream without codec data");
+    return FALSE;
+  }
+
+  sets = g_byte_array_new ();
+  if (map.size < 7 || map.data[0] != 1)
+    goto done;
+
+  nal_length_size = (map.data[4] & 0x03) + 1;
+  p = map.data + 6;
+  end = map.data + map.size;
+
+  /* Sequence parameter sets, then picture parameter sets */
+  if (!gst_omx_bitstream_append_nal_units (sets, &p, end,
+          map.data[5] & 0x1f) || p == end)
+    goto done;
+  count = *p++;
+  ret = gst_omx_bitstream_append_nal_units (sets, &p, end, count);
+
+done:
+  gst_buffer_unmap (codec_data, &map);
+
+  if (ret)
+    ret = gst_omx_bitstream_set_nal_length (bs, sets, nal_length_size);
+  else
+    g_byte_array_free (sets, TRUE);
+  if (!ret)
+    GST_WARNING ("Invalid avcC codec data");
+
+  return ret;
+}
+
+/* H.265 with hvcC @codec_data, stream-format=hvc1 or hev1 */
+gboolean
+gst_omx_bitstream_set_hevc (GstOMXBitstream * bs, GstBuffer * codec_data)
+{
+  GByteArray *sets;
+  GstMapInfo map;
+  const guint8 *p, *end;
+  guint nal_length_size = 0;
+  guint n_arrays, count;
+  gboolean ret = FALSE;
+
+  gst_omx_bitstream_clear (bs);
+
+  if (!codec_data || !gst_buffer_map (codec_data, &map, GST_MAP_READ)) {
+    GST_WARNING ("hvc1 stream without codec data");
+    return FALSE;
+  }
+
+  sets = g_byte_array_new ();
+  if (map.size < 23)
+    goto done;
+
+  nal_length_size = (map.data[21] & 0x03) + 1;
+  n_arrays = map.data[22];
+  p = map.data + 23;
+  end = map.data + map.size;
+
+  /* One array of NAL units per type, VPS, SPS, PPS and SEI */
+  while (n_arrays--) {
+    if (end - p < 3)
+      goto done;
+    count = GST_READ_UINT16_BE (p + 1);
+    p += 3;
+    if (!gst_omx_bitstream_append_nal_units (sets, &p, end, count))
+      goto done;
+  }
+  ret = TRUE;
+
+done:
+  gst_buffer_unmap (codec_data, &map);
+
+  if (ret)
+    ret = gst_omx_bitstream_set_nal_length (bs, sets, nal_length_size);
+  else
+    g_byte_array_free (sets, TRUE);
+  if (!ret)
+    GST_WARNING ("Invalid hvcC codec data");
+
+  return ret;
+}
+
+/* VC-1 advanced profile, @header is the sequence header and entry point
+ * from the caps */
+void
+gst_omx_bitstream_set_vc1 (GstOMXBitstream * bs, GstBuffer * header)
+{
+  gst_omx_bitstream_set_plain (bs, header);
+  bs->format = GST_OMX_BITSTREAM_VC1_FRAME;
+}
+
+/* Prepares the conversion of the frame @data */
+void
+gst_omx_bitstream_start_frame (GstOMXBitstream * bs, const guint8 * data,
+    gsize size, gboolean keyframe)
+{
+  bs->prefix = NULL;
+  bs->prefix_size = 0;
+  bs->nal_remaining = 0;
+
+  switch (bs->format) {
+    case GST_OMX_BITSTREAM_NAL_LENGTH:
+      /* The parameter sets are only in the codec data, repeat them for
+       * every keyframe so that decoding can start there after a flush */
+      if (keyframe) {
+        bs->prefix = bs->parameter_sets;
+        bs->prefix_size = bs->parameter_sets_size;
+      }
+      break;
+    case GST_OMX_BITSTREAM_VC1_FRAME:
+      /* Demuxers usually pass frames without start code */
+      if (size < 4 || data[0] != 0x00 || data[1] != 0x00
+          || data[2] != 0x01) {
+        bs->prefix = vc1_frame_start_code;
+        bs->prefix_size = sizeof (vc1_frame_start_code);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+/* Converts the frame data @src into @dest, which has room for @dest_size
+ * bytes. Returns the number of bytes written and sets @consumed to the
+ * number of bytes of @src that were used. Called again with the
+ * remaining frame data as long as there is some */
+gsize
+gst_omx_bitstream_fill (GstOMXBitstream * bs, const guint8 * src,
+    gsize src_size, gsize * consumed, guint8 * dest, gsize dest_size)
+{
+  const guint8 *p = src, *end = src + src_size;
+  gsize written, n;
+
+  /* Whatever goes in front of the frame first */
+  written = MIN (bs->prefix_size, dest_size);
+  if (written > 0) {
+    memcpy (dest, bs->prefix, written);
+    bs->prefix += written;
+    bs->prefix_size -= written;
+  }
+
+  if (bs->prefix_size > 0) {
+    *consumed = 0;
+    return written;
+  }
+
+  if (bs->format != GST_OMX_BITSTREAM_NAL_LENGTH) {
+    n = MIN (src_size, dest_size - written);
+    memcpy (dest + written, src, n);
+    *consumed = n;
+    return written + n;
+  }
+
+  while (p < end && written < dest_size) {
+    if (bs->nal_remaining == 0) {
+      gsize len = 0;
+      guint i;
+
+      /* Keep the start code together with some of the NAL unit */
+      if (dest_size - written <= sizeof (nal_start_code))
+        break;
+
+      if ((gsize) (end - p) < bs->nal_length_size) {
+        GST_WARNING ("Truncated NAL unit length, passing the rest as is");
+        bs->nal_remaining = end - p;
+      } else {
+        for (i = 0; i < bs->nal_length_size; i++)
+          len = (len << 8) | p[i];
+        p += bs->nal_length_size;
+
+        if (len > (gsize) (end - p)) {
+          GST_WARNING ("NAL unit of %" G_GSIZE_FORMAT " bytes exceeds the "
+              "frame", len);
+          len = end - p;
+        }
+
+        memcpy (dest + written, nal_start_code, sizeof (nal_start_code));
+        written += sizeof (nal_start_code);
+        bs->nal_remaining = len;
+        if (len == 0)
+          continue;
+      }
+    }
+
+    n = MIN (bs->nal_remaining, dest_size - written);
+    memcpy (dest + written, p, n);
+    written += n;
+    p += n;
+    bs->nal_remaining -= n;
+  }
+
+  *consumed = p - src;
+
+  return written;
+}
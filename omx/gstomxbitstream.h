@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2016, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_BITSTREAM_H__
+#define __GST_OMX_BITSTREAM_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  /* Passed to the component as is */
+  GST_OMX_BITSTREAM_PLAIN,
+  /* NAL units with a length field in front (avc, hvc1, hev1), passed
+   * with start codes (byte-stream) */
+  GST_OMX_BITSTREAM_NAL_LENGTH,
+  /* VC-1 advanced profile frames, which get a frame start code if they
+   * don't start with one */
+  GST_OMX_BITSTREAM_VC1_FRAME
+} GstOMXBitstreamFormat;
+
+typedef struct _GstOMXBitstream GstOMXBitstream;
+
+/* Converts the input of a decoder to the bitstream format of the component
+ * while it is copied into the OMX buffers. Everything that only depends on
+ * the caps is set up once by the gst_omx_bitstream_set_*() functions */
+struct _GstOMXBitstream
+{
+  GstOMXBitstreamFormat format;
+  /* Size of the length field in front of each NAL unit */
+  guint nal_length_size;
+  /* Codec configuration to pass before the first frame, NULL if none */
+  GstBuffer *header;
+  /* Parameter sets with start codes, inserted in front of keyframes */
+  guint8 *parameter_sets;
+  gsize parameter_sets_size;
+
+  /* State of the current frame: data still to insert in front of it,
+   * and bytes of the current NAL unit not copied yet */
+  const guint8 *prefix;
+  gsize prefix_size;
+  gsize nal_remaining;
+};
+
+void     gst_omx_bitstream_init (GstOMXBitstream * bs);
+void     gst_omx_bitstream_clear (GstOMXBitstream * bs);
+
+void     gst_omx_bitstream_set_plain (GstOMXBitstream * bs, GstBuffer * header);
+gboolean gst_omx_bitstream_set_avc (GstOMXBitstream * bs, GstBuffer * codec_data);
+gboolean gst_omx_bitstream_set_hevc (GstOMXBitstream * bs, GstBuffer * codec_data);
+void     gst_omx_bitstream_set_vc1 (GstOMXBitstream * bs, GstBuffer * header);
+
+void     gst_omx_bitstream_start_frame (GstOMXBitstream * bs, const guint8 * data, gsize size, gboolean keyframe);
+gsize    gst_omx_bitstream_fill (GstOMXBitstream * bs, const guint8 * src, gsize src_size, gsize * consumed, guint8 * dest, gsize dest_size);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_BITSTREAM_H__ */
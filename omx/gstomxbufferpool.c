@@ -32,10 +32,14 @@
 #ifdef HAVE_MMNGRBUF
 #include "mmngr_buf_user_public.h"
 #endif
+#ifdef HAVE_MMNGR
+#include "mmngr_user_public.h"
+#endif
 #ifdef HAVE_VIDEODEC_EXT
 #include "OMXR_Extension_vdcmn.h"
 #endif
 #include <unistd.h>             /* getpagesize() */
+#include <string.h>
 
 GST_DEBUG_CATEGORY_STATIC (gst_omx_buffer_pool_debug_category);
 #define GST_CAT_DEFAULT gst_omx_buffer_pool_debug_category
@@ -49,6 +53,15 @@ struct _GstOMXMemory
   GstMemory mem;
 
   GstOMXBuffer *buf;
+
+  /* Only used on the parent memory */
+  /* Pool buffer the memory belongs to, not reffed */
+  GstBuffer *buffer;
+  /* Protected by the omx_memory lock */
+  /* Number of shared memories that are still alive */
+  guint n_shares;
+  /* Pool whose release of the buffer waits for the last share */
+  GstBufferPool *release_pool;
 };
 
 struct _GstOMXMemoryAllocator
@@ -63,6 +76,12 @@ struct _GstOMXMemoryAllocatorClass
 
 #define GST_OMX_MEMORY_TYPE "openmax"
 
+/* Protects the share bookkeeping of all GstOMXMemory */
+G_LOCK_DEFINE_STATIC (omx_memory);
+
+static void gst_omx_buffer_pool_release_to_port (GstOMXBufferPool * pool,
+    GstOMXBuffer * omx_buf);
+
 static GstMemory *
 gst_omx_memory_allocator_alloc_dummy (GstAllocator * allocator, gsize size,
     GstAllocationParams * params)
@@ -76,10 +95,29 @@ gst_omx_memory_allocator_free (GstAllocator * allocator, GstMemory * mem)
 {
   GstOMXMemory *omem = (GstOMXMemory *) mem;
 
-  /* TODO: We need to remember which memories are still used
-   * so we can wait until everything is released before allocating
-   * new memory
-   */
+  if (mem->parent) {
+    GstOMXMemory *parent = (GstOMXMemory *) mem->parent;
+    GstBufferPool *pool = NULL;
+
+    /* If this was the last share of a buffer that was already released
+     * by its user, the OMX buffer can be passed back to the port now */
+    G_LOCK (omx_memory);
+    g_assert (parent->n_shares > 0);
+    parent->n_shares--;
+    if (parent->n_shares == 0) {
+      pool = parent->release_pool;
+      parent->release_pool = NULL;
+    }
+    G_UNLOCK (omx_memory);
+
+    if (pool) {
+      GST_DEBUG_OBJECT (pool, "Last share of buffer %p freed, releasing it",
+          parent->buffer);
+      gst_omx_buffer_pool_release_to_port (GST_OMX_BUFFER_POOL (pool),
+          parent->buf);
+      gst_object_unref (pool);
+    }
+  }
 
   g_slice_free (GstOMXMemory, omem);
 }
@@ -100,8 +138,118 @@ gst_omx_memory_unmap (GstMemory * mem)
 static GstMemory *
 gst_omx_memory_share (GstMemory * mem, gssize offset, gssize size)
 {
-  g_assert_not_reached ();
-  return NULL;
+  GstOMXMemory *omem = (GstOMXMemory *) mem;
+  GstOMXMemory *sub;
+  GstMemory *parent;
+
+  /* We can only share the complete memory, or a region of it. The
+   * shares all point to the parent memory, which counts them so that
+   * the OMX buffer only goes back to the port once none of them is used
+   * anymore. They don't reference the pool buffer, as they might end up
+   * in that buffer itself */
+  if ((parent = mem->parent) == NULL)
+    parent = mem;
+
+  if (size == -1)
+    size = mem->size - offset;
+
+  sub = g_slice_new0 (GstOMXMemory);
+  /* the shared memory is always readonly */
+  gst_memory_init (GST_MEMORY_CAST (sub),
+      GST_MINI_OBJECT_FLAGS (parent) | GST_MINI_OBJECT_FLAG_LOCK_READONLY,
+      mem->allocator, parent, mem->maxsize, mem->align,
+      mem->offset + offset, size);
+
+  sub->buf = omem->buf;
+
+  G_LOCK (omx_memory);
+  ((GstOMXMemory *) parent)->n_shares++;
+  G_UNLOCK (omx_memory);
+
+  return GST_MEMORY_CAST (sub);
+}
+
+static gboolean
+gst_omx_memory_is_span (GstMemory * mem1, GstMemory * mem2, gsize * offset)
+{
+  /* Both memories have the same parent here */
+  if (offset)
+    *offset = mem1->offset - mem1->parent->offset;
+
+  return mem1->offset + mem1->size == mem2->offset;
+}
+
+static gboolean
+gst_omx_memory_is_omx (GstMemory * mem)
+{
+  return g_strcmp0 (mem->allocator->mem_type, GST_OMX_MEMORY_TYPE) == 0;
+}
+
+/* Puts the memory back into @buffer if it was replaced by shares of it,
+ * e.g. by gst_buffer_resize(). The release of the buffer would otherwise
+ * wait for shares that only go away with the buffer itself */
+static void
+gst_omx_memory_restore (GstBuffer * buffer)
+{
+  guint i, n = gst_buffer_n_memory (buffer);
+
+  for (i = 0; i < n; i++) {
+    GstMemory *mem = gst_buffer_peek_memory (buffer, i);
+
+    if (mem->parent && gst_omx_memory_is_omx (mem)
+        && ((GstOMXMemory *) mem->parent)->buffer == buffer) {
+      gst_buffer_replace_all_memory (buffer, gst_memory_ref (mem->parent));
+      return;
+    }
+  }
+}
+
+/* Returns TRUE if the memory of @buffer is still shared. The release of
+ * the buffer to the port is then done when the last share is freed */
+static gboolean
+gst_omx_memory_defer_release (GstBufferPool * pool, GstBuffer * buffer)
+{
+  GstOMXMemory *omem;
+  gboolean deferred = FALSE;
+
+  if (gst_buffer_n_memory (buffer) == 0)
+    return FALSE;
+
+  omem = (GstOMXMemory *) gst_buffer_peek_memory (buffer, 0);
+  if (!gst_omx_memory_is_omx (GST_MEMORY_CAST (omem)) || omem->mem.parent)
+    return FALSE;
+
+  G_LOCK (omx_memory);
+  if (omem->n_shares > 0) {
+    omem->release_pool = gst_object_ref (pool);
+    deferred = TRUE;
+  }
+  G_UNLOCK (omx_memory);
+
+  return deferred;
+}
+
+/* Forget about a deferred release, @buffer is going to be freed */
+static void
+gst_omx_memory_cancel_release (GstBuffer * buffer)
+{
+  GstOMXMemory *omem;
+  GstBufferPool *pool;
+
+  if (gst_buffer_n_memory (buffer) == 0)
+    return;
+
+  omem = (GstOMXMemory *) gst_buffer_peek_memory (buffer, 0);
+  if (!gst_omx_memory_is_omx (GST_MEMORY_CAST (omem)) || omem->mem.parent)
+    return;
+
+  G_LOCK (omx_memory);
+  pool = omem->release_pool;
+  omem->release_pool = NULL;
+  G_UNLOCK (omx_memory);
+
+  if (pool)
+    gst_object_unref (pool);
 }
 
 GType gst_omx_memory_allocator_get_type (void);
@@ -131,8 +279,9 @@ gst_omx_memory_allocator_init (GstOMXMemoryAllocator * allocator)
   alloc->mem_map = gst_omx_memory_map;
   alloc->mem_unmap = gst_omx_memory_unmap;
   alloc->mem_share = gst_omx_memory_share;
+  alloc->mem_is_span = gst_omx_memory_is_span;
 
-  /* default copy & is_span */
+  /* default copy */
 
   GST_OBJECT_FLAG_SET (allocator, GST_ALLOCATOR_FLAG_CUSTOM_ALLOC);
 }
@@ -144,13 +293,6 @@ gst_omx_memory_allocator_alloc (GstAllocator * allocator, GstMemoryFlags flags,
   GstOMXMemory *mem;
   gint align;
 
-  /* FIXME: We don't allow sharing because we need to know
-   * when the memory becomes unused and can only then put
-   * it back to the pool. Which is done in the pool's release
-   * function
-   */
-  flags |= GST_MEMORY_FLAG_NO_SHARE;
-
   /* GStreamer uses a bitmask for the alignment while
    * OMX uses the alignment itself. So we have to convert
    * here */
@@ -163,7 +305,7 @@ gst_omx_memory_allocator_alloc (GstAllocator * allocator, GstMemoryFlags flags,
     align = 0;
   }
 
-  mem = g_slice_new (GstOMXMemory);
+  mem = g_slice_new0 (GstOMXMemory);
   /* the shared memory is always readonly */
   gst_memory_init (GST_MEMORY_CAST (mem), flags, allocator, NULL,
       buf->omx_buf->nAllocLen, align, 0, buf->omx_buf->nAllocLen);
@@ -209,9 +351,13 @@ gst_omx_memory_allocator_alloc (GstAllocator * allocator, GstMemoryFlags flags,
  *
  * For buffers provided to downstream, the buffer will be returned
  * back to the component (OMX_FillThisBuffer()) when it is released.
+ * If shares of its memory, e.g. from gst_buffer_copy_region(), are
+ * still alive at that point, this is delayed until the last of them is
+ * freed. The buffer itself is back in the pool already then.
  */
 
 static GQuark gst_omx_buffer_data_quark = 0;
+static GQuark gst_omx_buffer_pool_frame_size_quark = 0;
 
 #define DEBUG_INIT \
   GST_DEBUG_CATEGORY_INIT (gst_omx_buffer_pool_debug_category, "omxbufferpool", 0, \
@@ -223,6 +369,65 @@ G_DEFINE_TYPE_WITH_CODE (GstOMXBufferPool, gst_omx_buffer_pool,
 static void gst_omx_buffer_pool_free_buffer (GstBufferPool * bpool,
     GstBuffer * buffer);
 
+/* TRUE if the buffers of this pool are not the OMX buffers themselves but
+ * dmabuf memory exported to upstream of the encoder. In this mode the OMX
+ * input buffers only carry the extended address of the frame, so buffers
+ * are acquired and released through the default GstBufferPool queue.
+ */
+static gboolean
+gst_omx_buffer_pool_is_enc_dmabuf_export (GstOMXBufferPool * pool)
+{
+  return GST_IS_OMX_VIDEO_ENC (pool->element)
+      && GST_OMX_VIDEO_ENC (pool->element)->use_dmabuf
+      && pool->port->port_def.eDir == OMX_DirInput;
+}
+
+/* TRUE if the buffers of this pool are proposed to upstream of a decoder
+ * to write the compressed data into. Each buffer owns its OMX buffer from
+ * being acquired until the decoder claims it to pass it to the component,
+ * or until it is released unused.
+ */
+static gboolean
+gst_omx_buffer_pool_is_dec_input (GstOMXBufferPool * pool)
+{
+  return GST_IS_OMX_VIDEO_DEC (pool->element)
+      && pool->port->port_def.eDir == OMX_DirInput;
+}
+
+/* Creates a buffer wrapping the memory of the decoder input buffer
+ * @omx_buf */
+static GstBuffer *
+gst_omx_buffer_pool_wrap_input_buffer (GstOMXBuffer * omx_buf)
+{
+  GstBuffer *buf;
+
+  buf = gst_buffer_new ();
+  gst_buffer_append_memory (buf,
+      gst_memory_new_wrapped (0, omx_buf->omx_buf->pBuffer,
+          omx_buf->omx_buf->nAllocLen, 0, omx_buf->omx_buf->nAllocLen, NULL,
+          NULL));
+  gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (buf),
+      gst_omx_buffer_data_quark, omx_buf, NULL);
+
+  return buf;
+}
+
+/* Index of the buffer wrapping @omx_buf in pool->buffers, or -1 if it was
+ * allocated after the pool was created */
+static gint
+gst_omx_buffer_pool_find_buffer_index (GstOMXBufferPool * pool,
+    GstOMXBuffer * omx_buf)
+{
+  gint i;
+
+  for (i = 0; i < pool->buffers->len && i < pool->port->buffers->len; i++) {
+    if (g_ptr_array_index (pool->port->buffers, i) == omx_buf)
+      return i;
+  }
+
+  return -1;
+}
+
 static gboolean
 gst_omx_buffer_pool_start (GstBufferPool * bpool)
 {
@@ -250,9 +455,10 @@ gst_omx_buffer_pool_stop (GstBufferPool * bpool)
   /* When not using the default GstBufferPool::GstAtomicQueue then
    * GstBufferPool::free_buffer is not called while stopping the pool
    * (because the queue is empty) */
-  for (i = 0; i < pool->buffers->len; i++)
-    GST_BUFFER_POOL_CLASS (gst_omx_buffer_pool_parent_class)->release_buffer
-        (bpool, g_ptr_array_index (pool->buffers, i));
+  if (!gst_omx_buffer_pool_is_enc_dmabuf_export (pool))
+    for (i = 0; i < pool->buffers->len; i++)
+      GST_BUFFER_POOL_CLASS (gst_omx_buffer_pool_parent_class)->release_buffer
+          (bpool, g_ptr_array_index (pool->buffers, i));
 
   /* Remove any buffers that are there */
   g_ptr_array_set_size (pool->buffers, 0);
@@ -290,7 +496,9 @@ static gboolean
 gst_omx_buffer_pool_set_config (GstBufferPool * bpool, GstStructure * config)
 {
   GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (bpool);
+  GstBufferPoolClass *parent_class;
   GstCaps *caps;
+  gboolean raw;
 
   GST_OBJECT_LOCK (pool);
 
@@ -300,9 +508,10 @@ gst_omx_buffer_pool_set_config (GstBufferPool * bpool, GstStructure * config)
   if (caps == NULL)
     goto no_caps;
 
-  if (pool->port && pool->port->port_def.eDomain == OMX_PortDomainVideo
+  raw = pool->port && pool->port->port_def.eDomain == OMX_PortDomainVideo
       && pool->port->port_def.format.video.eCompressionFormat ==
-      OMX_VIDEO_CodingUnused) {
+      OMX_VIDEO_CodingUnused;
+  if (raw) {
     GstVideoInfo info;
 
     /* now parse the caps from the config */
@@ -323,8 +532,13 @@ gst_omx_buffer_pool_set_config (GstBufferPool * bpool, GstStructure * config)
 
   GST_OBJECT_UNLOCK (pool);
 
-  return GST_BUFFER_POOL_CLASS (gst_omx_buffer_pool_parent_class)->set_config
-      (bpool, config);
+  /* GstVideoBufferPool only accepts raw video caps, skip it for
+   * compressed data */
+  parent_class = GST_BUFFER_POOL_CLASS (gst_omx_buffer_pool_parent_class);
+  if (!raw)
+    parent_class = g_type_class_peek_parent (parent_class);
+
+  return parent_class->set_config (bpool, config);
 
   /* ERRORS */
 wrong_config:
@@ -348,7 +562,7 @@ wrong_video_caps:
   }
 }
 
-#if defined (HAVE_MMNGRBUF) && defined (HAVE_VIDEODEC_EXT)
+#ifdef HAVE_MMNGRBUF
 static gboolean
 gst_omx_buffer_pool_export_dmabuf (GstOMXBufferPool * pool,
     guint phys_addr, gint size, gint * id_export, gint * dmabuf_fd)
@@ -369,7 +583,118 @@ gst_omx_buffer_pool_export_dmabuf (GstOMXBufferPool * pool,
 
   return TRUE;
 }
+#endif
+
+/* Returns the plane offsets of the visible area of a frame laid out with
+ * @offset and @stride in @visible_offset */
+static void
+gst_omx_buffer_pool_get_visible_offsets (GstOMXBufferPool * pool,
+    const gsize * offset, const gint * stride, gsize * visible_offset)
+{
+  gint i;
+
+  for (i = 0; i < GST_VIDEO_MAX_PLANES; i++)
+    visible_offset[i] = offset[i];
+  if (pool->crop.nLeft > 0 || pool->crop.nTop > 0)
+    gst_omx_video_offset_planes (pool->video_info.finfo, pool->crop.nLeft,
+        pool->crop.nTop, stride, visible_offset);
+}
+
+/* Describes the layout @offset and @stride of the frame in @buf. The
+ * visible area is either described by a crop meta or by pointing the
+ * video meta to it */
+static void
+gst_omx_buffer_pool_add_video_meta (GstOMXBufferPool * pool, GstBuffer * buf,
+    gsize * offset, gint * stride)
+{
+  OMX_VIDEO_PORTDEFINITIONTYPE *video = &pool->port->port_def.format.video;
+  gsize visible_offset[GST_VIDEO_MAX_PLANES];
+
+  if (pool->add_cropmeta && pool->crop.nWidth > 0
+      && (pool->crop.nWidth != video->nFrameWidth
+          || pool->crop.nHeight != video->nFrameHeight)) {
+    GstVideoCropMeta *crop;
+
+    gst_buffer_add_video_meta_full (buf, GST_VIDEO_FRAME_FLAG_NONE,
+        GST_VIDEO_INFO_FORMAT (&pool->video_info), video->nFrameWidth,
+        video->nFrameHeight, GST_VIDEO_INFO_N_PLANES (&pool->video_info),
+        offset, stride);
+    crop = gst_buffer_add_video_crop_meta (buf);
+    crop->x = pool->crop.nLeft;
+    crop->y = pool->crop.nTop;
+    crop->width = pool->crop.nWidth;
+    crop->height = pool->crop.nHeight;
+    return;
+  }
+
+  gst_omx_buffer_pool_get_visible_offsets (pool, offset, stride,
+      visible_offset);
+  gst_buffer_add_video_meta_full (buf, GST_VIDEO_FRAME_FLAG_NONE,
+      GST_VIDEO_INFO_FORMAT (&pool->video_info),
+      GST_VIDEO_INFO_WIDTH (&pool->video_info),
+      GST_VIDEO_INFO_HEIGHT (&pool->video_info),
+      GST_VIDEO_INFO_N_PLANES (&pool->video_info), visible_offset, stride);
+}
+
+/* Returns TRUE if frames laid out with @offset and @stride differ from
+ * the default layout of the visible area downstream expects without
+ * video meta */
+static gboolean
+gst_omx_buffer_pool_needs_copy (GstOMXBufferPool * pool, gsize * offset,
+    gint * stride)
+{
+  GstVideoInfo info;
+  gsize visible_offset[GST_VIDEO_MAX_PLANES];
+  gint i;
+
+  gst_video_info_init (&info);
+  gst_video_info_set_format (&info,
+      GST_VIDEO_INFO_FORMAT (&pool->video_info),
+      GST_VIDEO_INFO_WIDTH (&pool->video_info),
+      GST_VIDEO_INFO_HEIGHT (&pool->video_info));
+
+  /* Padding only matches the default layout at the end */
+  gst_omx_buffer_pool_get_visible_offsets (pool, offset, stride,
+      visible_offset);
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (&pool->video_info); i++) {
+    if (info.stride[i] != stride[i] || info.offset[i] != visible_offset[i])
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Describes the frame in @buf with the current frame size if it changed
+ * since its video meta was added */
+static void
+gst_omx_buffer_pool_refresh_video_meta (GstOMXBufferPool * pool,
+    GstBuffer * buf)
+{
+  GstVideoMeta *meta;
+  GstVideoCropMeta *crop;
+  guint cookie;
+
+  cookie = GPOINTER_TO_UINT (gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST
+          (buf), gst_omx_buffer_pool_frame_size_quark));
+  if (cookie == pool->frame_size_cookie)
+    return;
+  gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (buf),
+      gst_omx_buffer_pool_frame_size_quark,
+      GUINT_TO_POINTER (pool->frame_size_cookie), NULL);
+
+  meta = gst_buffer_get_video_meta (buf);
+  if (!meta)
+    return;
+
+  gst_buffer_remove_meta (buf, (GstMeta *) meta);
+  crop = gst_buffer_get_video_crop_meta (buf);
+  if (crop)
+    gst_buffer_remove_meta (buf, (GstMeta *) crop);
+  gst_omx_buffer_pool_add_video_meta (pool, buf, pool->plane_offset,
+      pool->plane_stride);
+}
 
+#if defined (HAVE_MMNGRBUF) && defined (HAVE_VIDEODEC_EXT)
 /* This function will create a GstBuffer contain dmabuf_fd of decoded
  * video got from Media Component
  */
@@ -430,6 +755,73 @@ gst_omx_buffer_pool_create_buffer_contain_dmabuf (GstOMXBufferPool * self,
 
   }
 
+  g_ptr_array_add (self->buffers, new_buf);
+  gst_omx_buffer_pool_add_video_meta (self, new_buf, offset, stride);
+
+  return new_buf;
+}
+#endif
+
+#if defined (HAVE_MMNGRBUF) && defined (HAVE_MMNGR)
+/* This function will create a GstBuffer contain one dmabuf_fd per plane
+ * of memory allocated by mmngr. Upstream fills it directly and the encoder
+ * passes its physical address to Media Component as extended address
+ */
+static GstBuffer *
+gst_omx_buffer_pool_create_buffer_export_dmabuf (GstOMXBufferPool * self,
+    gint * stride, gint * slice, gsize * offset)
+{
+  GstBuffer *new_buf;
+  gint i;
+  gint page_size;
+
+  new_buf = gst_buffer_new ();
+  page_size = getpagesize ();
+
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (&self->video_info); i++) {
+    MMNGR_ID alloc_id;
+    guint phys_addr, hard_addr;
+    unsigned long virt_addr;
+    gint plane_size, alloc_size;
+    gint dmabuf_id, dmabuf_fd;
+    GstMemory *mem;
+    gint res;
+
+    plane_size = stride[i] * slice[i];
+    /* Each plane starts at a page boundary so that its physical address
+     * can be passed to Media Component and mapped by upstream as is */
+    alloc_size = GST_ROUND_UP_N (plane_size, page_size);
+
+    res = mmngr_alloc_in_user_ext (&alloc_id, alloc_size, &phys_addr,
+        &hard_addr, &virt_addr, MMNGR_VA_SUPPORT, NULL);
+    if (res != R_MM_OK) {
+      GST_ERROR_OBJECT (self, "mmngr_alloc_in_user failed (size:%d)",
+          alloc_size);
+      gst_buffer_unref (new_buf);
+      return NULL;
+    }
+    g_array_append_val (self->alloc_id_array, alloc_id);
+    GST_DEBUG_OBJECT (self,
+        "Plane %d: size %d, allocated %d (phys_addr:0x%08x)", i, plane_size,
+        alloc_size, hard_addr);
+
+    if (!gst_omx_buffer_pool_export_dmabuf (self, hard_addr, alloc_size,
+            &dmabuf_id, &dmabuf_fd)) {
+      GST_ERROR_OBJECT (self, "dmabuf exporting failed");
+      gst_buffer_unref (new_buf);
+      return NULL;
+    }
+    g_array_append_val (self->id_array, dmabuf_id);
+
+    mem = gst_dmabuf_allocator_alloc (self->allocator, dmabuf_fd, alloc_size);
+    /* Only allow to access plane size */
+    mem->size = plane_size;
+    gst_buffer_append_memory (new_buf, mem);
+
+    /* Planes are laid out one memory after the other */
+    offset[i] = (i == 0) ? 0 : offset[i - 1] + stride[i - 1] * slice[i - 1];
+  }
+
   g_ptr_array_add (self->buffers, new_buf);
   gst_buffer_add_video_meta_full (new_buf, GST_VIDEO_FRAME_FLAG_NONE,
       GST_VIDEO_INFO_FORMAT (&self->video_info),
@@ -486,6 +878,24 @@ gst_omx_buffer_pool_alloc_buffer (GstBufferPool * bpool,
     }
 
     pool->need_copy = FALSE;
+  } else if (pool->port->port_def.eDomain != OMX_PortDomainVideo
+      || pool->port->port_def.format.video.eCompressionFormat !=
+      OMX_VIDEO_CodingUnused) {
+    GstMemory *mem;
+
+    /* Compressed data, e.g. on the output port of an encoder. There
+     * is no layout to describe, offset and size of the memory are
+     * set from the OMX buffer when it is acquired. On the input port
+     * of a decoder upstream writes into the OMX buffer directly */
+    if (gst_omx_buffer_pool_is_dec_input (pool)) {
+      buf = gst_omx_buffer_pool_wrap_input_buffer (omx_buf);
+    } else {
+      mem = gst_omx_memory_allocator_alloc (pool->allocator, 0, omx_buf);
+      buf = gst_buffer_new ();
+      gst_buffer_append_memory (buf, mem);
+      ((GstOMXMemory *) mem)->buffer = buf;
+    }
+    g_ptr_array_add (pool->buffers, buf);
   } else {
     GstMemory *mem;
     const guint nstride = pool->port->port_def.format.video.nStride;
@@ -517,16 +927,52 @@ gst_omx_buffer_pool_alloc_buffer (GstBufferPool * bpool,
         break;
       case GST_VIDEO_FORMAT_NV12:
       case GST_VIDEO_FORMAT_NV16:
+#if GST_CHECK_VERSION (1, 10, 0)
+      case GST_VIDEO_FORMAT_P010_10LE:
+#endif
+#if GST_CHECK_VERSION (1, 14, 0)
+      case GST_VIDEO_FORMAT_NV12_10LE32:
+#endif
         stride[1] = nstride;
         slice[1] = nslice / 2;
         offset[1] = offset[0] + stride[0] * nslice;
         break;
+#if GST_CHECK_VERSION (1, 14, 0)
+      case GST_VIDEO_FORMAT_NV16_10LE32:
+        stride[1] = nstride;
+        slice[1] = nslice;
+        offset[1] = offset[0] + stride[0] * nslice;
+        break;
+#endif
       default:
         g_assert_not_reached ();
         break;
     }
 
-    if (GST_IS_OMX_VIDEO_DEC (pool->element) &&
+    memcpy (pool->plane_offset, offset, sizeof (offset));
+    memcpy (pool->plane_stride, stride, sizeof (stride));
+
+    if (gst_omx_buffer_pool_is_enc_dmabuf_export (pool)) {
+#if defined (HAVE_MMNGRBUF) && defined (HAVE_MMNGR)
+      if (pool->allocator && GST_IS_OMX_MEMORY_ALLOCATOR (pool->allocator)) {
+        gst_object_unref (pool->allocator);
+        pool->allocator = gst_dmabuf_allocator_new ();
+      }
+      GST_DEBUG_OBJECT (pool, "DMABUF export - Using %s allocator",
+          pool->allocator->mem_type);
+
+      buf = gst_omx_buffer_pool_create_buffer_export_dmabuf (pool,
+          (gint *) (&stride), (gint *) (&slice), (gsize *) (&offset));
+      if (!buf) {
+        GST_ERROR_OBJECT (pool, "Can not create buffer contain dmabuf");
+        return GST_FLOW_ERROR;
+      }
+#else
+      GST_ELEMENT_ERROR (pool->element, STREAM, FAILED, (NULL),
+          ("dmabuf mode is invalid now due to not have MMNGR or MMNGR_BUF"));
+      return GST_FLOW_ERROR;
+#endif
+    } else if (GST_IS_OMX_VIDEO_DEC (pool->element) &&
         GST_OMX_VIDEO_DEC (pool->element)->use_dmabuf == TRUE &&
         (omx_buf->omx_buf->pOutputPortPrivate)) {
 #if defined (HAVE_MMNGRBUF) && defined (HAVE_VIDEODEC_EXT)
@@ -566,39 +1012,17 @@ gst_omx_buffer_pool_alloc_buffer (GstBufferPool * bpool,
 
       buf = gst_buffer_new ();
       gst_buffer_append_memory (buf, mem);
+      if (g_strcmp0 (mem->allocator->mem_type, GST_OMX_MEMORY_TYPE) == 0)
+        ((GstOMXMemory *) mem)->buffer = buf;
       g_ptr_array_add (pool->buffers, buf);
-      if (pool->add_videometa) {
-        pool->need_copy = FALSE;
-      } else {
-        GstVideoInfo info;
-        gboolean need_copy = FALSE;
-        gint i;
-
-        gst_video_info_init (&info);
-        gst_video_info_set_format (&info,
-            GST_VIDEO_INFO_FORMAT (&pool->video_info),
-            GST_VIDEO_INFO_WIDTH (&pool->video_info),
-            GST_VIDEO_INFO_HEIGHT (&pool->video_info));
-
-        for (i = 0; i < GST_VIDEO_INFO_N_PLANES (&pool->video_info); i++) {
-          if (info.stride[i] != stride[i] || info.offset[i] != offset[i]) {
-            need_copy = TRUE;
-            break;
-          }
-        }
-
-        pool->need_copy = need_copy;
-      }
+      pool->need_copy = !pool->add_videometa
+          && gst_omx_buffer_pool_needs_copy (pool, offset, stride);
 
       if (pool->need_copy || pool->add_videometa) {
         /* We always add the videometa. It's the job of the user
          * to copy the buffer if pool->need_copy is TRUE
          */
-        gst_buffer_add_video_meta_full (buf, GST_VIDEO_FRAME_FLAG_NONE,
-            GST_VIDEO_INFO_FORMAT (&pool->video_info),
-            GST_VIDEO_INFO_WIDTH (&pool->video_info),
-            GST_VIDEO_INFO_HEIGHT (&pool->video_info),
-            GST_VIDEO_INFO_N_PLANES (&pool->video_info), offset, stride);
+        gst_omx_buffer_pool_add_video_meta (pool, buf, offset, stride);
       }
     }
   }
@@ -626,6 +1050,8 @@ gst_omx_buffer_pool_free_buffer (GstBufferPool * bpool, GstBuffer * buffer)
   }
   GST_OBJECT_UNLOCK (pool);
 
+  gst_omx_memory_cancel_release (buffer);
+
   gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (buffer),
       gst_omx_buffer_data_quark, NULL, NULL);
 
@@ -650,9 +1076,11 @@ gst_omx_buffer_pool_acquire_buffer (GstBufferPool * bpool,
     *buffer = buf;
     ret = GST_FLOW_OK;
 
+    g_atomic_int_inc (&pool->outstanding);
+
     /* If it's our own memory we have to set the sizes */
-    if ((!pool->other_pool) &&
-        ((GST_OMX_VIDEO_DEC (pool->element)->use_dmabuf) == FALSE)) {
+    if ((!pool->other_pool) && !(GST_IS_OMX_VIDEO_DEC (pool->element)
+            && GST_OMX_VIDEO_DEC (pool->element)->use_dmabuf)) {
       GstMemory *mem = gst_buffer_peek_memory (*buffer, 0);
 
       g_assert (mem
@@ -660,8 +1088,12 @@ gst_omx_buffer_pool_acquire_buffer (GstBufferPool * bpool,
       mem->size = ((GstOMXMemory *) mem)->buf->omx_buf->nFilledLen;
       mem->offset = ((GstOMXMemory *) mem)->buf->omx_buf->nOffset;
     }
+
+    if (!pool->other_pool)
+      gst_omx_buffer_pool_refresh_video_meta (pool, buf);
   } else {
-    if (GST_IS_OMX_VIDEO_ENC (pool->element)) {
+    if (GST_IS_OMX_VIDEO_ENC (pool->element) &&
+        !gst_omx_buffer_pool_is_enc_dmabuf_export (pool)) {
       GstBuffer *buf;
       GstOMXBuffer *omx_buf;
       gint count = 0;
@@ -693,6 +1125,55 @@ gst_omx_buffer_pool_acquire_buffer (GstBufferPool * bpool,
         *buffer = buf;
         ret = GST_FLOW_OK;
       }
+    } else if (gst_omx_buffer_pool_is_dec_input (pool)) {
+      GstOMXAcquireBufferReturn acq_ret;
+      GstOMXBuffer *omx_buf;
+      GstBuffer *buf;
+      gsize offset;
+      gint i;
+
+      /* Take an empty OMX buffer from the port, this waits until the
+       * component returned one if all of them are in use */
+      acq_ret = gst_omx_port_acquire_buffer (pool->port, &omx_buf);
+      if (acq_ret == GST_OMX_ACQUIRE_BUFFER_FLUSHING)
+        return GST_FLOW_FLUSHING;
+      else if (acq_ret != GST_OMX_ACQUIRE_BUFFER_OK)
+        return GST_FLOW_ERROR;
+
+      GST_OBJECT_LOCK (pool);
+      i = gst_omx_buffer_pool_find_buffer_index (pool, omx_buf);
+      if (i < 0) {
+        GST_OBJECT_UNLOCK (pool);
+        GST_ERROR_OBJECT (pool, "Buffer %p does not belong to this pool",
+            omx_buf);
+        gst_omx_port_return_buffer (pool->port, omx_buf);
+        return GST_FLOW_ERROR;
+      }
+
+      buf = g_ptr_array_index (pool->buffers, i);
+      if (g_queue_find (&pool->acquired_buffers, buf)) {
+        /* Still referenced by somebody after the component consumed it.
+         * Its memory must not be written again until it is released, the
+         * OMX buffer is kept until then. Upstream gets a buffer in system
+         * memory meanwhile, which is copied into the OMX buffers */
+        g_queue_push_tail (&pool->parked_buffers, buf);
+        GST_OBJECT_UNLOCK (pool);
+
+        GST_DEBUG_OBJECT (pool, "Buffer %p still in use, parking it", omx_buf);
+        *buffer = gst_buffer_new_allocate (NULL, omx_buf->omx_buf->nAllocLen,
+            NULL);
+        return *buffer ? GST_FLOW_OK : GST_FLOW_ERROR;
+      }
+      g_queue_push_tail (&pool->lent_buffers, buf);
+      g_queue_push_tail (&pool->acquired_buffers, buf);
+      GST_OBJECT_UNLOCK (pool);
+
+      /* Upstream might have resized it the last time */
+      gst_buffer_get_sizes (buf, &offset, NULL);
+      gst_buffer_resize (buf, -(gssize) offset, omx_buf->omx_buf->nAllocLen);
+
+      *buffer = buf;
+      ret = GST_FLOW_OK;
     } else {
       /* Acquire any buffer that is available to be filled by upstream */
       ret =
@@ -705,27 +1186,93 @@ gst_omx_buffer_pool_acquire_buffer (GstBufferPool * bpool,
   return ret;
 }
 
+/* Releases the output buffer @omx_buf back to the port, it can be
+ * filled again */
+static void
+gst_omx_buffer_pool_release_to_port (GstOMXBufferPool * pool,
+    GstOMXBuffer * omx_buf)
+{
+  OMX_ERRORTYPE err;
+
+  if (pool->allocating || pool->deactivated)
+    return;
+
+  g_atomic_int_add (&pool->outstanding, -1);
+  err = gst_omx_port_release_buffer (pool->port, omx_buf);
+  if (err != OMX_ErrorNone) {
+    GST_ELEMENT_ERROR (pool->element, LIBRARY, SETTINGS, (NULL),
+        ("Failed to relase output buffer to component: %s (0x%08x)",
+            gst_omx_error_to_string (err), err));
+  }
+}
+
 static void
 gst_omx_buffer_pool_release_buffer (GstBufferPool * bpool, GstBuffer * buffer)
 {
   GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (bpool);
-  OMX_ERRORTYPE err;
   GstOMXBuffer *omx_buf;
 
   g_assert (pool->component && pool->port);
 
+  if (gst_omx_buffer_pool_is_enc_dmabuf_export (pool)) {
+    /* Exported buffers are not bound to an OMX buffer, the encoder
+     * looks up the physical address when it receives them. Upstream
+     * can fill them again as soon as they are released */
+    GST_BUFFER_POOL_CLASS (gst_omx_buffer_pool_parent_class)->release_buffer
+        (bpool, buffer);
+    return;
+  }
+
+  if (gst_omx_buffer_pool_is_dec_input (pool)) {
+    GList *lent;
+    gboolean parked, stale = TRUE;
+    gint i;
+
+    if (pool->allocating)
+      return;
+
+    GST_OBJECT_LOCK (pool);
+    lent = g_queue_find (&pool->lent_buffers, buffer);
+    if (lent)
+      g_queue_delete_link (&pool->lent_buffers, lent);
+    g_queue_remove (&pool->acquired_buffers, buffer);
+    parked = g_queue_remove (&pool->parked_buffers, buffer);
+    for (i = 0; i < pool->buffers->len && stale; i++)
+      stale = g_ptr_array_index (pool->buffers, i) != buffer;
+    g_cond_broadcast (&pool->input_cond);
+    GST_OBJECT_UNLOCK (pool);
+
+    /* Not passed to the decoder, or kept until now after the component
+     * consumed it. The OMX buffer can be filled again */
+    if ((lent || parked) && !pool->deactivated) {
+      omx_buf =
+          gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (buffer),
+          gst_omx_buffer_data_quark);
+      gst_omx_port_return_buffer (pool->port, omx_buf);
+    }
+
+    /* Handed out in system memory while the OMX buffer was in use */
+    if (stale)
+      gst_omx_buffer_pool_free_buffer (bpool, buffer);
+    return;
+  }
+
   if (!pool->allocating && !pool->deactivated) {
     omx_buf =
         gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (buffer),
         gst_omx_buffer_data_quark);
     if (pool->port->port_def.eDir == OMX_DirOutput && !omx_buf->used) {
-      /* Release back to the port, can be filled again */
-      err = gst_omx_port_release_buffer (pool->port, omx_buf);
-      if (err != OMX_ErrorNone) {
-        GST_ELEMENT_ERROR (pool->element, LIBRARY, SETTINGS, (NULL),
-            ("Failed to relase output buffer to component: %s (0x%08x)",
-                gst_omx_error_to_string (err), err));
+      gst_omx_memory_restore (buffer);
+
+      /* Parts of the memory might still be used through shared
+       * memories, the OMX buffer is released once they are all freed */
+      if (gst_omx_memory_defer_release (bpool, buffer)) {
+        GST_DEBUG_OBJECT (pool, "Buffer %p still shared, delaying release",
+            buffer);
+        return;
       }
+
+      gst_omx_buffer_pool_release_to_port (pool, omx_buf);
     } else if (!omx_buf->used) {
       /* TODO: Implement.
        *
@@ -756,7 +1303,10 @@ gst_omx_buffer_pool_finalize (GObject * object)
   GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (object);
 
 #ifdef HAVE_MMNGRBUF
-  if (GST_OMX_VIDEO_DEC (pool->element)->use_dmabuf) {
+  if ((GST_IS_OMX_VIDEO_DEC (pool->element)
+          && GST_OMX_VIDEO_DEC (pool->element)->use_dmabuf)
+      || (GST_IS_OMX_VIDEO_ENC (pool->element)
+          && GST_OMX_VIDEO_ENC (pool->element)->use_dmabuf)) {
     gint i;
     gint dmabuf_id;
 
@@ -772,6 +1322,20 @@ gst_omx_buffer_pool_finalize (GObject * object)
   }
   g_array_free (pool->id_array, TRUE);
 #endif
+#ifdef HAVE_MMNGR
+  {
+    gint i;
+
+    /* Exports are ended above, the memory itself can be freed now */
+    for (i = 0; i < pool->alloc_id_array->len; i++) {
+      GST_DEBUG_OBJECT (pool, "mmngr_free_in_user (%d)",
+          g_array_index (pool->alloc_id_array, MMNGR_ID, i));
+      mmngr_free_in_user_ext (g_array_index (pool->alloc_id_array, MMNGR_ID,
+              i));
+    }
+    g_array_free (pool->alloc_id_array, TRUE);
+  }
+#endif
 
   if (pool->element)
     gst_object_unref (pool->element);
@@ -781,6 +1345,11 @@ gst_omx_buffer_pool_finalize (GObject * object)
     g_ptr_array_unref (pool->buffers);
   pool->buffers = NULL;
 
+  g_queue_clear (&pool->lent_buffers);
+  g_queue_clear (&pool->acquired_buffers);
+  g_queue_clear (&pool->parked_buffers);
+  g_cond_clear (&pool->input_cond);
+
   if (pool->other_pool)
     gst_object_unref (pool->other_pool);
   pool->other_pool = NULL;
@@ -803,6 +1372,8 @@ gst_omx_buffer_pool_class_init (GstOMXBufferPoolClass * klass)
   GstBufferPoolClass *gstbufferpool_class = (GstBufferPoolClass *) klass;
 
   gst_omx_buffer_data_quark = g_quark_from_static_string ("GstOMXBufferData");
+  gst_omx_buffer_pool_frame_size_quark =
+      g_quark_from_static_string ("GstOMXBufferPoolFrameSize");
 
   gobject_class->finalize = gst_omx_buffer_pool_finalize;
   gstbufferpool_class->start = gst_omx_buffer_pool_start;
@@ -822,8 +1393,15 @@ gst_omx_buffer_pool_init (GstOMXBufferPool * pool)
   pool->allocator = g_object_new (gst_omx_memory_allocator_get_type (), NULL);
 #ifdef HAVE_MMNGRBUF
   pool->id_array = g_array_new (FALSE, FALSE, sizeof (gint));
+#endif
+#ifdef HAVE_MMNGR
+  pool->alloc_id_array = g_array_new (FALSE, FALSE, sizeof (MMNGR_ID));
 #endif
   pool->enc_buffer_index = 0;
+  g_queue_init (&pool->lent_buffers);
+  g_queue_init (&pool->acquired_buffers);
+  g_queue_init (&pool->parked_buffers);
+  g_cond_init (&pool->input_cond);
 }
 
 GstBufferPool *
@@ -839,3 +1417,144 @@ gst_omx_buffer_pool_new (GstElement * element, GstOMXComponent * component,
 
   return GST_BUFFER_POOL (pool);
 }
+
+/* Takes the OMX buffer of @buffer, acquired from the decoder input pool
+ * @pool and filled by upstream, to pass it to the component. nOffset and
+ * nFilledLen are set from the buffer. Returns NULL if @buffer does not own
+ * an OMX buffer of @pool (anymore), if its data is not inside of it or if
+ * somebody else holds @buffer or its memory, the data has to be copied
+ * then. The caller has to release @buffer right after, the component must
+ * not get back the OMX buffer while it is still in use.
+ */
+GstOMXBuffer *
+gst_omx_buffer_pool_claim_input_buffer (GstOMXBufferPool * pool,
+    GstBuffer * buffer)
+{
+  GstOMXBuffer *omx_buf;
+  OMX_U8 *data;
+  GstMapInfo map;
+  GList *lent;
+
+  g_return_val_if_fail (gst_omx_buffer_pool_is_dec_input (pool), NULL);
+
+  if (buffer->pool != GST_BUFFER_POOL_CAST (pool)
+      || gst_buffer_n_memory (buffer) != 1
+      || GST_MINI_OBJECT_REFCOUNT_VALUE (buffer) != 1
+      || GST_MINI_OBJECT_REFCOUNT_VALUE (gst_buffer_peek_memory (buffer,
+              0)) != 1)
+    return NULL;
+
+  omx_buf =
+      gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (buffer),
+      gst_omx_buffer_data_quark);
+  if (!omx_buf || !gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return NULL;
+
+  data = omx_buf->omx_buf->pBuffer;
+  if (map.size == 0 || map.data < data
+      || map.data + map.size > data + omx_buf->omx_buf->nAllocLen) {
+    gst_buffer_unmap (buffer, &map);
+    return NULL;
+  }
+
+  GST_OBJECT_LOCK (pool);
+  lent = g_queue_find (&pool->lent_buffers, buffer);
+  if (lent)
+    g_queue_delete_link (&pool->lent_buffers, lent);
+  GST_OBJECT_UNLOCK (pool);
+
+  if (lent) {
+    omx_buf->omx_buf->nOffset = map.data - data;
+    omx_buf->omx_buf->nFilledLen = map.size;
+  } else {
+    omx_buf = NULL;
+  }
+  gst_buffer_unmap (buffer, &map);
+
+  return omx_buf;
+}
+
+/* Changes the frame size of the buffers of the active output pool @pool to
+ * the one of @caps, after the port kept its buffers over a resolution
+ * switch. The crop has to be set before. Buffers get their video metas
+ * updated when they're acquired next.
+ */
+gboolean
+gst_omx_buffer_pool_update_frame_size (GstOMXBufferPool * pool,
+    GstCaps * caps)
+{
+  GstVideoInfo info;
+
+  if (!gst_video_info_from_caps (&info, caps)) {
+    GST_WARNING_OBJECT (pool,
+        "failed getting geometry from caps %" GST_PTR_FORMAT, caps);
+    return FALSE;
+  }
+
+  GST_OBJECT_LOCK (pool);
+  pool->video_info = info;
+  gst_caps_replace (&pool->caps, caps);
+  if (pool->allocator && GST_IS_OMX_MEMORY_ALLOCATOR (pool->allocator))
+    pool->need_copy = !pool->add_videometa
+        && gst_omx_buffer_pool_needs_copy (pool, pool->plane_offset,
+        pool->plane_stride);
+  pool->frame_size_cookie++;
+  GST_OBJECT_UNLOCK (pool);
+
+  GST_DEBUG_OBJECT (pool, "Frame size changed to %dx%d",
+      GST_VIDEO_INFO_WIDTH (&info), GST_VIDEO_INFO_HEIGHT (&info));
+
+  return TRUE;
+}
+
+/* Returns the OMX buffers of all buffers of the decoder input pool @pool
+ * that are still in use to the port, e.g. before the port is disabled.
+ * Their content is not passed to the component anymore. The port must
+ * not free them before gst_omx_buffer_pool_wait_input_buffers() returned
+ * TRUE.
+ */
+void
+gst_omx_buffer_pool_return_input_buffers (GstOMXBufferPool * pool)
+{
+  GstBuffer *buf;
+
+  g_return_if_fail (gst_omx_buffer_pool_is_dec_input (pool));
+
+  GST_OBJECT_LOCK (pool);
+  while ((buf = g_queue_pop_head (&pool->lent_buffers))
+      || (buf = g_queue_pop_head (&pool->parked_buffers))) {
+    GstOMXBuffer *omx_buf =
+        gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (buf),
+        gst_omx_buffer_data_quark);
+
+    GST_DEBUG_OBJECT (pool, "Returning buffer %p still in use", omx_buf);
+    gst_omx_port_return_buffer (pool->port, omx_buf);
+  }
+  GST_OBJECT_UNLOCK (pool);
+}
+
+/* Waits until all buffers of the decoder input pool @pool that wrap OMX
+ * buffers are released, their memory is freed with the port buffers.
+ * Returns FALSE if some are still in use after @timeout.
+ */
+gboolean
+gst_omx_buffer_pool_wait_input_buffers (GstOMXBufferPool * pool,
+    GstClockTime timeout)
+{
+  gint64 end_time = g_get_monotonic_time () + timeout / GST_USECOND;
+  gboolean ret;
+
+  g_return_val_if_fail (gst_omx_buffer_pool_is_dec_input (pool), FALSE);
+
+  GST_OBJECT_LOCK (pool);
+  while (!g_queue_is_empty (&pool->acquired_buffers)
+      && g_cond_wait_until (&pool->input_cond, GST_OBJECT_GET_LOCK (pool),
+          end_time));
+  ret = g_queue_is_empty (&pool->acquired_buffers);
+  if (!ret)
+    GST_DEBUG_OBJECT (pool, "%u buffers are still in use",
+        g_queue_get_length (&pool->acquired_buffers));
+  GST_OBJECT_UNLOCK (pool);
+
+  return ret;
+}
@@ -68,6 +68,18 @@ struct _GstOMXBufferPool
   gboolean allocating;
   /* TRUE if the pool is not used anymore */
   gboolean deactivated;
+  /* Visible area of the frames on a decoder output port, the rest of
+   * the OMX buffers is padding */
+  OMX_CONFIG_RECTTYPE crop;
+  /* TRUE if downstream handles GstVideoCropMeta, the whole frame is
+   * described by the video meta then and the visible area by a crop meta */
+  gboolean add_cropmeta;
+  /* Layout of the raw video frames in the OMX buffers */
+  gsize plane_offset[GST_VIDEO_MAX_PLANES];
+  gint plane_stride[GST_VIDEO_MAX_PLANES];
+  /* Increased whenever the frame size changes while the buffers are
+   * allocated, their video metas are updated when they're acquired */
+  guint frame_size_cookie;
 
   /* For populating the pool from another one */
   GstBufferPool *other_pool;
@@ -82,10 +94,32 @@ struct _GstOMXBufferPool
 
   /* Used during acquire for input port */
   gint enc_buffer_index;
+
+  /* Decoder input buffers acquired by upstream whose OMX buffer was not
+   * passed to the component yet, protected by the object lock */
+  GQueue lent_buffers;
+  /* Decoder input buffers that are acquired and not released yet. Their
+   * memory must not be handed out again before, nor be freed */
+  GQueue acquired_buffers;
+  /* Decoder input buffers whose OMX buffer the component returned while
+   * they were still in use. The OMX buffer goes back to the port once
+   * they are released */
+  GQueue parked_buffers;
+  /* Signalled when a decoder input buffer is released */
+  GCond input_cond;
+
+  /* Number of output buffers currently acquired from this pool and
+   * not released back to the port yet */
+  gint outstanding;
 #ifdef HAVE_MMNGRBUF
   /* Array use to contain dma_id. It is used in export_end dmabuf area */
   GArray *id_array;
 #endif
+#ifdef HAVE_MMNGR
+  /* Array use to contain id of memory allocated by mmngr for buffers
+   * exported to upstream. It is used in free area */
+  GArray *alloc_id_array;
+#endif
 };
 
 struct _GstOMXBufferPoolClass
@@ -96,6 +130,10 @@ struct _GstOMXBufferPoolClass
 GType gst_omx_buffer_pool_get_type (void);
 
 GstBufferPool *gst_omx_buffer_pool_new (GstElement * element, GstOMXComponent * component, GstOMXPort * port);
+GstOMXBuffer *gst_omx_buffer_pool_claim_input_buffer (GstOMXBufferPool * pool, GstBuffer * buffer);
+void gst_omx_buffer_pool_return_input_buffers (GstOMXBufferPool * pool);
+gboolean gst_omx_buffer_pool_update_frame_size (GstOMXBufferPool * pool, GstCaps * caps);
+gboolean gst_omx_buffer_pool_wait_input_buffers (GstOMXBufferPool * pool, GstClockTime timeout);
 
 G_END_DECLS
 
@@ -34,6 +34,8 @@ static gboolean gst_omx_h264_dec_is_format_change (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoCodecState * state);
 static gboolean gst_omx_h264_dec_set_format (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoCodecState * state);
+static gboolean gst_omx_h264_dec_is_droppable (GstOMXVideoDec * dec,
+    GstVideoCodecFrame * frame);
 
 enum
 {
@@ -58,11 +60,13 @@ gst_omx_h264_dec_class_init (GstOMXH264DecClass * klass)
   videodec_class->is_format_change =
       GST_DEBUG_FUNCPTR (gst_omx_h264_dec_is_format_change);
   videodec_class->set_format = GST_DEBUG_FUNCPTR (gst_omx_h264_dec_set_format);
+  videodec_class->is_droppable =
+      GST_DEBUG_FUNCPTR (gst_omx_h264_dec_is_droppable);
 
   videodec_class->cdata.default_sink_template_caps = "video/x-h264, "
       "parsed=(boolean) true, "
-      "alignment=(string) au, "
-      "stream-format=(string) byte-stream, "
+      "alignment=(string) { au, nal }, "
+      "stream-format=(string) { byte-stream, avc }, "
       "width=(int) [1,MAX], " "height=(int) [1,MAX]";
 
   gst_element_class_set_static_metadata (element_class,
@@ -92,6 +96,18 @@ gst_omx_h264_dec_set_format (GstOMXVideoDec * dec, GstOMXPort * port,
 {
   gboolean ret;
   OMX_PARAM_PORTDEFINITIONTYPE port_def;
+  GstStructure *s;
+
+  /* The component only takes byte-stream, convert avc while copying */
+  s = gst_caps_get_structure (state->caps, 0);
+  if (g_strcmp0 (gst_structure_get_string (s, "stream-format"), "avc") == 0
+      && !gst_omx_bitstream_set_avc (&dec->bitstream, state->codec_data)) {
+    GST_ERROR_OBJECT (dec, "Can't convert avc stream");
+    return FALSE;
+  }
+  /* Single NAL units are passed as they arrive to cut the latency */
+  dec->nal_input =
+      g_strcmp0 (gst_structure_get_string (s, "alignment"), "nal") == 0;
 
   gst_omx_port_get_port_definition (port, &port_def);
   port_def.format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
@@ -99,3 +115,61 @@ gst_omx_h264_dec_set_format (GstOMXVideoDec * dec, GstOMXPort * port,
 
   return ret;
 }
+
+static gboolean
+gst_omx_h264_dec_is_droppable (GstOMXVideoDec * dec, GstVideoCodecFrame * frame)
+{
+  GstMapInfo map = GST_MAP_INFO_INIT;
+  gboolean ret = FALSE;
+  gsize i;
+
+  if (GST_OMX_VIDEO_DEC_CLASS (gst_omx_h264_dec_parent_class)->is_droppable
+      (dec, frame))
+    return TRUE;
+
+  if (!gst_buffer_map (frame->input_buffer, &map, GST_MAP_READ))
+    return FALSE;
+
+  /* A picture is a non-reference picture if nal_ref_idc of its first
+   * slice is 0 */
+  if (dec->bitstream.format == GST_OMX_BITSTREAM_NAL_LENGTH) {
+    guint len_size = dec->bitstream.nal_length_size;
+
+    for (i = 0; i + len_size < map.size;) {
+      guint8 nal_type = map.data[i + len_size] & 0x1f;
+      gsize len = 0, j;
+
+      if (nal_type >= 1 && nal_type <= 5) {
+        ret = (map.data[i + len_size] & 0x60) == 0;
+        break;
+      }
+      for (j = 0; j < len_size; j++)
+        len = (len << 8) | map.data[i + j];
+      i += len_size + len;
+    }
+
+    gst_buffer_unmap (frame->input_buffer, &map);
+
+    return ret;
+  }
+
+  /* In byte-stream format the NAL units are found by their start codes */
+  for (i = 0; i + 3 < map.size; i++) {
+    guint8 nal_type;
+
+    if (map.data[i] != 0x00 || map.data[i + 1] != 0x00
+        || map.data[i + 2] != 0x01)
+      continue;
+
+    nal_type = map.data[i + 3] & 0x1f;
+    if (nal_type >= 1 && nal_type <= 5) {
+      ret = (map.data[i + 3] & 0x60) == 0;
+      break;
+    }
+    i += 2;
+  }
+
+  gst_buffer_unmap (frame->input_buffer, &map);
+
+  return ret;
+}
@@ -63,8 +63,8 @@ gst_omx_h265_dec_class_init (GstOMXH265DecClass * klass)
 
   videodec_class->cdata.default_sink_template_caps = "video/x-h265, "
       "parsed=(boolean) true, "
-      "alignment=(string) au, "
-      "stream-format=(string) byte-stream, "
+      "alignment=(string) { au, nal }, "
+      "stream-format=(string) { byte-stream, hvc1, hev1 }, "
       "width=(int) [1,MAX], " "height=(int) [1,MAX]";
 
   gst_element_class_set_static_metadata (element_class,
@@ -93,6 +93,22 @@ gst_omx_h265_dec_set_format (GstOMXVideoDec * dec, GstOMXPort * port,
 {
   gboolean ret;
   OMX_PARAM_PORTDEFINITIONTYPE port_def;
+  GstStructure *s;
+  const gchar *stream_format;
+
+  /* The component only takes byte-stream, convert hvc1 and hev1 while
+   * copying */
+  s = gst_caps_get_structure (state->caps, 0);
+  stream_format = gst_structure_get_string (s, "stream-format");
+  if ((g_strcmp0 (stream_format, "hvc1") == 0
+          || g_strcmp0 (stream_format, "hev1") == 0)
+      && !gst_omx_bitstream_set_hevc (&dec->bitstream, state->codec_data)) {
+    GST_ERROR_OBJECT (dec, "Can't convert %s stream", stream_format);
+    return FALSE;
+  }
+  /* Single NAL units are passed as they arrive to cut the latency */
+  dec->nal_input =
+      g_strcmp0 (gst_structure_get_string (s, "alignment"), "nal") == 0;
 
   gst_omx_port_get_port_definition (port, &port_def);
 #ifdef HAVE_H265DEC_EXT
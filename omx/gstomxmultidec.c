@@ -0,0 +1,493 @@
+/*
+ * Copyright (C) 2016, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Decodes many independent streams, as for a grid of cameras.
+ *
+ * Every request sink pad sink_%u gets its own decoder element, whose
+ * output appears on the matching src pad src_%u. The number of streams
+ * is limited by max-streams, as every decoder holds an OMX component, and
+ * by the plugin-wide memory budget: a new stream needs stream-memory MiB
+ * of it to be left. Streams whose visible pad property is FALSE only get
+ * their keyframes decoded, so that hidden tiles drop their frames first
+ * and stay cheap while they can be shown again at the next keyframe.
+ *
+ * All streams share the decoder hardware, so the QoS of the shown
+ * streams is looked at together. Once one of them is late, all decoders
+ * skip late non-reference frames until all of them keep up again. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+
+#include "gstomx.h"
+#include "gstomxmultidec.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_omx_multi_dec_debug_category);
+#define GST_CAT_DEFAULT gst_omx_multi_dec_debug_category
+
+/* prototypes */
+static void gst_omx_multi_dec_finalize (GObject * object);
+static void gst_omx_multi_dec_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_omx_multi_dec_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
+
+static GstPad *gst_omx_multi_dec_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps);
+static void gst_omx_multi_dec_release_pad (GstElement * element,
+    GstPad * pad);
+
+static void gst_omx_multi_dec_pad_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_omx_multi_dec_pad_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+
+enum
+{
+  PROP_0,
+  PROP_DECODER,
+  PROP_MAX_STREAMS,
+  PROP_STREAM_MEMORY
+};
+
+enum
+{
+  PROP_PAD_0,
+  PROP_PAD_VISIBLE
+};
+
+#define GST_OMX_MULTI_DEC_DECODER_DEFAULT "omxh264dec"
+#define GST_OMX_MULTI_DEC_MAX_STREAMS_DEFAULT 16
+/* Ten 1080p NV12 frames */
+#define GST_OMX_MULTI_DEC_STREAM_MEMORY_DEFAULT 32
+/* QoS proportions above which the shown streams are late, and below
+ * which all of them keep up again */
+#define GST_OMX_MULTI_DEC_LATE_PROPORTION 1.0
+#define GST_OMX_MULTI_DEC_IN_TIME_PROPORTION 0.9
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink_%u",
+    GST_PAD_SINK,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src_%u",
+    GST_PAD_SRC,
+    GST_PAD_SOMETIMES,
+    GST_STATIC_CAPS_ANY);
+
+/* class initialization */
+
+#define DEBUG_INIT \
+  GST_DEBUG_CATEGORY_INIT (gst_omx_multi_dec_debug_category, \
+      "omxmultidec", 0, "debug category for gst-omx multi-stream decoder");
+
+G_DEFINE_TYPE_WITH_CODE (GstOMXMultiDec, gst_omx_multi_dec, GST_TYPE_BIN,
+    DEBUG_INIT);
+
+G_DEFINE_TYPE (GstOMXMultiDecPad, gst_omx_multi_dec_pad, GST_TYPE_GHOST_PAD);
+
+static void
+gst_omx_multi_dec_class_init (GstOMXMultiDecClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  gobject_class->finalize = gst_omx_multi_dec_finalize;
+  gobject_class->set_property = gst_omx_multi_dec_set_property;
+  gobject_class->get_property = gst_omx_multi_dec_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_DECODER,
+      g_param_spec_string ("decoder", "Decoder",
+          "Name of the decoder element factory used for new streams",
+          GST_OMX_MULTI_DEC_DECODER_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_STREAMS,
+      g_param_spec_uint ("max-streams", "Maximum streams",
+          "Maximum number of streams, requesting more sink pads fails",
+          1, G_MAXUINT, GST_OMX_MULTI_DEC_MAX_STREAMS_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STREAM_MEMORY,
+      g_param_spec_uint ("stream-memory", "Stream memory",
+          "MiB of the memory budget (GST_OMX_MEMORY_BUDGET) that have to be "
+          "left to add a stream",
+          0, G_MAXUINT, GST_OMX_MULTI_DEC_STREAM_MEMORY_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  element_class->request_new_pad =
+      GST_DEBUG_FUNCPTR (gst_omx_multi_dec_request_new_pad);
+  element_class->release_pad =
+      GST_DEBUG_FUNCPTR (gst_omx_multi_dec_release_pad);
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&sink_template));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&src_template));
+
+  gst_element_class_set_static_metadata (element_class,
+      "OpenMAX Multi-Stream Video Decoder",
+      "Codec/Decoder/Video",
+      "Decode many independent video streams",
+      "Renesas Electronics Corporation");
+}
+
+static void
+gst_omx_multi_dec_init (GstOMXMultiDec * self)
+{
+  self->decoder_name = g_strdup (GST_OMX_MULTI_DEC_DECODER_DEFAULT);
+  self->max_streams = GST_OMX_MULTI_DEC_MAX_STREAMS_DEFAULT;
+  self->stream_memory = GST_OMX_MULTI_DEC_STREAM_MEMORY_DEFAULT;
+}
+
+static void
+gst_omx_multi_dec_finalize (GObject * object)
+{
+  GstOMXMultiDec *self = GST_OMX_MULTI_DEC (object);
+
+  g_free (self->decoder_name);
+
+  G_OBJECT_CLASS (gst_omx_multi_dec_parent_class)->finalize (object);
+}
+
+static void
+gst_omx_multi_dec_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstOMXMultiDec *self = GST_OMX_MULTI_DEC (object);
+
+  switch (prop_id) {
+    case PROP_DECODER:
+      GST_OBJECT_LOCK (self);
+      g_free (self->decoder_name);
+      self->decoder_name = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_MAX_STREAMS:
+      GST_OBJECT_LOCK (self);
+      self->max_streams = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_STREAM_MEMORY:
+      GST_OBJECT_LOCK (self);
+      self->stream_memory = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_omx_multi_dec_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstOMXMultiDec *self = GST_OMX_MULTI_DEC (object);
+
+  switch (prop_id) {
+    case PROP_DECODER:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->decoder_name);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_MAX_STREAMS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->max_streams);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_STREAM_MEMORY:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->stream_memory);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* Drops the delta units of hidden streams before they reach the
+ * decoder */
+static GstPadProbeReturn
+gst_omx_multi_dec_pad_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GstOMXMultiDecPad *mpad = GST_OMX_MULTI_DEC_PAD (pad);
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    if (g_atomic_int_get (&mpad->visible))
+      g_atomic_int_set (&mpad->waiting_keyframe, FALSE);
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (!g_atomic_int_get (&mpad->visible)
+      || g_atomic_int_get (&mpad->waiting_keyframe)) {
+    GST_LOG_OBJECT (pad, "Dropping delta unit of hidden stream");
+    return GST_PAD_PROBE_DROP;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Lets all decoders skip late non-reference frames while one of the
+ * shown streams is late, so that the load goes down for all of them */
+static void
+gst_omx_multi_dec_update_qos (GstOMXMultiDec * self)
+{
+  GList *l, *decoders = NULL;
+  gdouble max_proportion = 0.0;
+  gboolean overloaded;
+
+  GST_OBJECT_LOCK (self);
+  for (l = GST_ELEMENT (self)->sinkpads; l; l = l->next) {
+    GstOMXMultiDecPad *mpad = l->data;
+
+    if (g_atomic_int_get (&mpad->visible))
+      max_proportion = MAX (max_proportion, mpad->proportion);
+  }
+
+  overloaded = self->overloaded;
+  if (!overloaded && max_proportion > GST_OMX_MULTI_DEC_LATE_PROPORTION)
+    overloaded = TRUE;
+  else if (overloaded
+      && max_proportion < GST_OMX_MULTI_DEC_IN_TIME_PROPORTION)
+    overloaded = FALSE;
+
+  if (overloaded == self->overloaded) {
+    GST_OBJECT_UNLOCK (self);
+    return;
+  }
+  self->overloaded = overloaded;
+
+  for (l = GST_ELEMENT (self)->sinkpads; l; l = l->next) {
+    GstOMXMultiDecPad *mpad = l->data;
+
+    decoders = g_list_prepend (decoders, gst_object_ref (mpad->decoder));
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  GST_INFO_OBJECT (self, "%s, proportion %f", overloaded ? "Overloaded" :
+      "Keeping up again", max_proportion);
+
+  for (l = decoders; l; l = l->next) {
+    if (g_object_class_find_property (G_OBJECT_GET_CLASS (l->data),
+            "skip-frames"))
+      g_object_set (l->data, "skip-frames", overloaded, NULL);
+  }
+  g_list_free_full (decoders, gst_object_unref);
+}
+
+/* Remembers the QoS proportion of the stream whose src pad is @pad */
+static GstPadProbeReturn
+gst_omx_multi_dec_qos_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GstOMXMultiDecPad *mpad = user_data;
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstOMXMultiDec *self;
+  gdouble proportion;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_QOS)
+    return GST_PAD_PROBE_OK;
+
+  self = GST_OMX_MULTI_DEC (gst_pad_get_parent (pad));
+  if (!self)
+    return GST_PAD_PROBE_OK;
+
+  gst_event_parse_qos (event, NULL, &proportion, NULL, NULL);
+  GST_OBJECT_LOCK (self);
+  mpad->proportion = proportion;
+  GST_OBJECT_UNLOCK (self);
+
+  gst_omx_multi_dec_update_qos (self);
+  gst_object_unref (self);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPad *
+gst_omx_multi_dec_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps)
+{
+  GstOMXMultiDec *self = GST_OMX_MULTI_DEC (element);
+  GstOMXMultiDecPad *mpad;
+  GstElement *decoder;
+  GstPad *target;
+  gchar *decoder_name, *pad_name;
+  guint index;
+
+  GST_OBJECT_LOCK (self);
+  if (self->n_streams >= self->max_streams) {
+    GST_OBJECT_UNLOCK (self);
+    GST_WARNING_OBJECT (self, "Already decoding %u streams",
+        self->max_streams);
+    return NULL;
+  }
+  /* The streams decoding already have their buffers allocated from the
+   * budget, what is left has to be enough for one more */
+  if (gst_omx_memory_get_available () < (guint64) self->stream_memory << 20) {
+    GST_OBJECT_UNLOCK (self);
+    GST_WARNING_OBJECT (self, "Not enough memory left for another stream");
+    return NULL;
+  }
+  index = self->next_index++;
+  self->n_streams++;
+  decoder_name = g_strdup (self->decoder_name);
+  GST_OBJECT_UNLOCK (self);
+
+  pad_name = g_strdup_printf ("decoder_%u", index);
+  decoder = gst_element_factory_make (decoder_name, pad_name);
+  g_free (pad_name);
+  if (!decoder) {
+    GST_ERROR_OBJECT (self, "Failed to create decoder '%s'",
+        GST_STR_NULL (decoder_name));
+    g_free (decoder_name);
+    GST_OBJECT_LOCK (self);
+    self->n_streams--;
+    GST_OBJECT_UNLOCK (self);
+    return NULL;
+  }
+  g_free (decoder_name);
+
+  gst_bin_add (GST_BIN (self), decoder);
+
+  pad_name = g_strdup_printf ("sink_%u", index);
+  mpad = g_object_new (GST_TYPE_OMX_MULTI_DEC_PAD, "name", pad_name,
+      "direction", GST_PAD_SINK, "template", templ, NULL);
+  g_free (pad_name);
+  gst_ghost_pad_construct (GST_GHOST_PAD (mpad));
+  target = gst_element_get_static_pad (decoder, "sink");
+  gst_ghost_pad_set_target (GST_GHOST_PAD (mpad), target);
+  gst_object_unref (target);
+  mpad->decoder = decoder;
+  gst_pad_add_probe (GST_PAD (mpad), GST_PAD_PROBE_TYPE_BUFFER,
+      gst_omx_multi_dec_pad_probe, NULL, NULL);
+
+  pad_name = g_strdup_printf ("src_%u", index);
+  target = gst_element_get_static_pad (decoder, "src");
+  mpad->srcpad = gst_ghost_pad_new_from_template (pad_name, target,
+      gst_element_class_get_pad_template (GST_ELEMENT_GET_CLASS (self),
+          "src_%u"));
+  gst_object_unref (target);
+  g_free (pad_name);
+  gst_pad_add_probe (mpad->srcpad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+      gst_omx_multi_dec_qos_probe, mpad, NULL);
+
+  gst_element_add_pad (element, mpad->srcpad);
+  gst_element_add_pad (element, GST_PAD (mpad));
+  gst_element_sync_state_with_parent (decoder);
+
+  GST_DEBUG_OBJECT (self, "Added stream %u", index);
+
+  return GST_PAD (mpad);
+}
+
+static void
+gst_omx_multi_dec_release_pad (GstElement * element, GstPad * pad)
+{
+  GstOMXMultiDec *self = GST_OMX_MULTI_DEC (element);
+  GstOMXMultiDecPad *mpad = GST_OMX_MULTI_DEC_PAD (pad);
+  GstElement *decoder = mpad->decoder;
+  GstPad *srcpad = mpad->srcpad;
+
+  GST_DEBUG_OBJECT (self, "Removing stream %s", GST_PAD_NAME (pad));
+
+  gst_element_remove_pad (element, srcpad);
+  gst_element_remove_pad (element, pad);
+
+  gst_element_set_state (decoder, GST_STATE_NULL);
+  gst_bin_remove (GST_BIN (self), decoder);
+
+  GST_OBJECT_LOCK (self);
+  self->n_streams--;
+  GST_OBJECT_UNLOCK (self);
+
+  /* The released stream might have been the late one */
+  gst_omx_multi_dec_update_qos (self);
+}
+
+static void
+gst_omx_multi_dec_pad_class_init (GstOMXMultiDecPadClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->set_property = gst_omx_multi_dec_pad_set_property;
+  gobject_class->get_property = gst_omx_multi_dec_pad_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_PAD_VISIBLE,
+      g_param_spec_boolean ("visible", "Visible",
+          "Whether the stream is shown, hidden streams only decode "
+          "keyframes", TRUE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_omx_multi_dec_pad_init (GstOMXMultiDecPad * self)
+{
+  self->visible = TRUE;
+}
+
+static void
+gst_omx_multi_dec_pad_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstOMXMultiDecPad *self = GST_OMX_MULTI_DEC_PAD (object);
+  GstObject *parent;
+
+  switch (prop_id) {
+    case PROP_PAD_VISIBLE:{
+      gboolean visible = g_value_get_boolean (value);
+
+      /* A shown stream needs a keyframe again to be decoded correctly */
+      if (visible && !g_atomic_int_get (&self->visible))
+        g_atomic_int_set (&self->waiting_keyframe, TRUE);
+      g_atomic_int_set (&self->visible, visible);
+
+      /* Only the shown streams count for the QoS */
+      parent = gst_object_get_parent (GST_OBJECT (self));
+      if (parent) {
+        gst_omx_multi_dec_update_qos (GST_OMX_MULTI_DEC (parent));
+        gst_object_unref (parent);
+      }
+      break;
+    }
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_omx_multi_dec_pad_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstOMXMultiDecPad *self = GST_OMX_MULTI_DEC_PAD (object);
+
+  switch (prop_id) {
+    case PROP_PAD_VISIBLE:
+      g_value_set_boolean (value, g_atomic_int_get (&self->visible));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2016, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_MULTI_DEC_H__
+#define __GST_OMX_MULTI_DEC_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_OMX_MULTI_DEC \
+  (gst_omx_multi_dec_get_type())
+#define GST_OMX_MULTI_DEC(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_OMX_MULTI_DEC,GstOMXMultiDec))
+#define GST_OMX_MULTI_DEC_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_OMX_MULTI_DEC,GstOMXMultiDecClass))
+#define GST_OMX_MULTI_DEC_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS((obj),GST_TYPE_OMX_MULTI_DEC,GstOMXMultiDecClass))
+#define GST_IS_OMX_MULTI_DEC(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_OMX_MULTI_DEC))
+#define GST_IS_OMX_MULTI_DEC_CLASS(obj) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_OMX_MULTI_DEC))
+
+#define GST_TYPE_OMX_MULTI_DEC_PAD \
+  (gst_omx_multi_dec_pad_get_type())
+#define GST_OMX_MULTI_DEC_PAD(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_OMX_MULTI_DEC_PAD,GstOMXMultiDecPad))
+#define GST_IS_OMX_MULTI_DEC_PAD(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_OMX_MULTI_DEC_PAD))
+
+typedef struct _GstOMXMultiDec GstOMXMultiDec;
+typedef struct _GstOMXMultiDecClass GstOMXMultiDecClass;
+typedef struct _GstOMXMultiDecPad GstOMXMultiDecPad;
+typedef struct _GstOMXMultiDecPadClass GstOMXMultiDecPadClass;
+
+struct _GstOMXMultiDec
+{
+  GstBin parent;
+
+  /* properties */
+  gchar *decoder_name;
+  guint max_streams;
+  guint stream_memory;
+
+  /* Protected by the object lock */
+  guint n_streams;
+  guint next_index;
+  /* TRUE while the QoS of a shown stream reports that its frames are
+   * late, all decoders skip late non-reference frames then */
+  gboolean overloaded;
+};
+
+struct _GstOMXMultiDecClass
+{
+  GstBinClass parent_class;
+};
+
+/* Request sink pad of one stream, proxying the sink pad of its decoder */
+struct _GstOMXMultiDecPad
+{
+  GstGhostPad parent;
+
+  GstElement *decoder;
+  /* Matching src pad, proxying the src pad of the decoder */
+  GstPad *srcpad;
+
+  /* Whether the stream is shown. Hidden streams only decode keyframes
+   * (atomic) */
+  gint visible;
+  /* Delta units are dropped until the next keyframe after the stream
+   * was shown again (atomic) */
+  gint waiting_keyframe;
+  /* Proportion of the last QoS event from downstream, protected by the
+   * object lock of the element */
+  gdouble proportion;
+};
+
+struct _GstOMXMultiDecPadClass
+{
+  GstGhostPadClass parent_class;
+};
+
+GType gst_omx_multi_dec_get_type (void);
+GType gst_omx_multi_dec_pad_get_type (void);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_MULTI_DEC_H__ */
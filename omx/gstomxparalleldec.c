@@ -0,0 +1,915 @@
+/*
+ * Copyright (C) 2016, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Decodes a stream on several decoder elements, and so on several OMX
+ * components, in parallel. This is meant for offline transcoding.
+ *
+ * The input is split into segments that start at a keyframe. Segment n
+ * is passed to decoder n % instances, followed by EOS so that the decoder
+ * outputs all its frames. The output of every decoder is queued, and a
+ * task on the source pad pushes the queued segments downstream one after
+ * another. A decoder gets its next segment only once its previous one
+ * was pushed out, and its output queue holds at most segment-frames
+ * frames, which bounds the memory to about one segment per decoder. As
+ * every segment is decoded on its own the stream must only have closed
+ * GOPs. For intra-only codecs every frame is a keyframe and the segments
+ * are cut after segment-frames frames. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+
+#include "gstomxparalleldec.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_omx_parallel_dec_debug_category);
+#define GST_CAT_DEFAULT gst_omx_parallel_dec_debug_category
+
+typedef struct _GstOMXParallelDecBranch GstOMXParallelDecBranch;
+
+struct _GstOMXParallelDecBranch
+{
+  GstOMXParallelDec *self;
+
+  GstElement *queue, *decoder;
+  /* Feeds the queue in front of the decoder and receives the decoded
+   * frames. Not added to the element */
+  GstPad *srcpad, *sinkpad;
+
+  /* Index of the segment passed last */
+  guint64 segment;
+  /* TRUE if the decoder got a segment since the last flush */
+  gboolean used;
+  /* Decoded buffers and serialized events of the decoder waiting to be
+   * pushed downstream, the EOS event ends the segment. Protected by the
+   * lock of the element */
+  GQueue output;
+  guint output_buffers;
+};
+
+/* prototypes */
+static void gst_omx_parallel_dec_finalize (GObject * object);
+static void gst_omx_parallel_dec_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_omx_parallel_dec_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+
+static GstStateChangeReturn gst_omx_parallel_dec_change_state (GstElement *
+    element, GstStateChange transition);
+
+static GstFlowReturn gst_omx_parallel_dec_sink_chain (GstPad * pad,
+    GstObject * parent, GstBuffer * buffer);
+static gboolean gst_omx_parallel_dec_sink_event (GstPad * pad,
+    GstObject * parent, GstEvent * event);
+static gboolean gst_omx_parallel_dec_sink_query (GstPad * pad,
+    GstObject * parent, GstQuery * query);
+static gboolean gst_omx_parallel_dec_src_event (GstPad * pad,
+    GstObject * parent, GstEvent * event);
+static gboolean gst_omx_parallel_dec_src_query (GstPad * pad,
+    GstObject * parent, GstQuery * query);
+
+static GstFlowReturn gst_omx_parallel_dec_branch_chain (GstPad * pad,
+    GstObject * parent, GstBuffer * buffer);
+static gboolean gst_omx_parallel_dec_branch_event (GstPad * pad,
+    GstObject * parent, GstEvent * event);
+static gboolean gst_omx_parallel_dec_branch_query (GstPad * pad,
+    GstObject * parent, GstQuery * query);
+static void gst_omx_parallel_dec_loop (GstOMXParallelDec * self);
+
+enum
+{
+  PROP_0,
+  PROP_DECODER,
+  PROP_INSTANCES,
+  PROP_SEGMENT_FRAMES
+};
+
+#define GST_OMX_PARALLEL_DEC_DECODER_DEFAULT "omxh264dec"
+#define GST_OMX_PARALLEL_DEC_INSTANCES_DEFAULT 2
+#define GST_OMX_PARALLEL_DEC_SEGMENT_FRAMES_DEFAULT 30
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+/* class initialization */
+
+#define DEBUG_INIT \
+  GST_DEBUG_CATEGORY_INIT (gst_omx_parallel_dec_debug_category, \
+      "omxparalleldec", 0, "debug category for gst-omx parallel decoder");
+
+G_DEFINE_TYPE_WITH_CODE (GstOMXParallelDec, gst_omx_parallel_dec,
+    GST_TYPE_BIN, DEBUG_INIT);
+
+static void
+gst_omx_parallel_dec_class_init (GstOMXParallelDecClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  gobject_class->finalize = gst_omx_parallel_dec_finalize;
+  gobject_class->set_property = gst_omx_parallel_dec_set_property;
+  gobject_class->get_property = gst_omx_parallel_dec_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_DECODER,
+      g_param_spec_string ("decoder", "Decoder",
+          "Name of the decoder element factory to run in parallel",
+          GST_OMX_PARALLEL_DEC_DECODER_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_INSTANCES,
+      g_param_spec_uint ("instances", "Instances",
+          "Number of decoders that decode segments in parallel",
+          1, 16, GST_OMX_PARALLEL_DEC_INSTANCES_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_SEGMENT_FRAMES,
+      g_param_spec_uint ("segment-frames", "Segment frames",
+          "Minimum number of frames of a segment, the next segment starts "
+          "at the first keyframe after them",
+          1, G_MAXUINT, GST_OMX_PARALLEL_DEC_SEGMENT_FRAMES_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  element_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_change_state);
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&sink_template));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&src_template));
+
+  gst_element_class_set_static_metadata (element_class,
+      "OpenMAX Parallel Video Decoder",
+      "Codec/Decoder/Video",
+      "Decode segments of a video stream on several decoders in parallel",
+      "Renesas Electronics Corporation");
+}
+
+static void
+gst_omx_parallel_dec_init (GstOMXParallelDec * self)
+{
+  self->sinkpad = gst_pad_new_from_static_template (&sink_template, "sink");
+  gst_pad_set_chain_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_sink_chain));
+  gst_pad_set_event_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_sink_event));
+  gst_pad_set_query_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_sink_query));
+  gst_element_add_pad (GST_ELEMENT (self), self->sinkpad);
+
+  self->srcpad = gst_pad_new_from_static_template (&src_template, "src");
+  gst_pad_set_event_function (self->srcpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_src_event));
+  gst_pad_set_query_function (self->srcpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_src_query));
+  gst_element_add_pad (GST_ELEMENT (self), self->srcpad);
+
+  self->decoder_name = g_strdup (GST_OMX_PARALLEL_DEC_DECODER_DEFAULT);
+  self->instances = GST_OMX_PARALLEL_DEC_INSTANCES_DEFAULT;
+  self->segment_frames = GST_OMX_PARALLEL_DEC_SEGMENT_FRAMES_DEFAULT;
+
+  self->branches = g_ptr_array_new ();
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+}
+
+static void
+gst_omx_parallel_dec_finalize (GObject * object)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (object);
+
+  g_free (self->decoder_name);
+  g_ptr_array_free (self->branches, TRUE);
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+
+  G_OBJECT_CLASS (gst_omx_parallel_dec_parent_class)->finalize (object);
+}
+
+static void
+gst_omx_parallel_dec_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (object);
+
+  switch (prop_id) {
+    case PROP_DECODER:
+      g_free (self->decoder_name);
+      self->decoder_name = g_value_dup_string (value);
+      break;
+    case PROP_INSTANCES:
+      self->instances = g_value_get_uint (value);
+      break;
+    case PROP_SEGMENT_FRAMES:
+      self->segment_frames = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_omx_parallel_dec_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (object);
+
+  switch (prop_id) {
+    case PROP_DECODER:
+      g_value_set_string (value, self->decoder_name);
+      break;
+    case PROP_INSTANCES:
+      g_value_set_uint (value, self->instances);
+      break;
+    case PROP_SEGMENT_FRAMES:
+      g_value_set_uint (value, self->segment_frames);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* NOTE: Must be called with the lock held */
+static void
+gst_omx_parallel_dec_clear_output (GstOMXParallelDecBranch * branch)
+{
+  g_queue_foreach (&branch->output, (GFunc) gst_mini_object_unref, NULL);
+  g_queue_clear (&branch->output);
+  branch->output_buffers = 0;
+}
+
+static void
+gst_omx_parallel_dec_remove_branches (GstOMXParallelDec * self)
+{
+  guint i;
+
+  for (i = 0; i < self->branches->len; i++) {
+    GstOMXParallelDecBranch *branch = g_ptr_array_index (self->branches, i);
+
+    gst_pad_set_active (branch->srcpad, FALSE);
+    gst_pad_set_active (branch->sinkpad, FALSE);
+
+    if (branch->queue) {
+      gst_element_set_state (branch->queue, GST_STATE_NULL);
+      gst_bin_remove (GST_BIN (self), branch->queue);
+    }
+    if (branch->decoder) {
+      gst_element_set_state (branch->decoder, GST_STATE_NULL);
+      gst_bin_remove (GST_BIN (self), branch->decoder);
+    }
+
+    gst_object_unref (branch->srcpad);
+    gst_object_unref (branch->sinkpad);
+    gst_omx_parallel_dec_clear_output (branch);
+    g_slice_free (GstOMXParallelDecBranch, branch);
+  }
+  g_ptr_array_set_size (self->branches, 0);
+}
+
+static gboolean
+gst_omx_parallel_dec_add_branch (GstOMXParallelDec * self, guint index)
+{
+  GstOMXParallelDecBranch *branch;
+  GstPad *pad;
+  gchar *name;
+  gboolean ret;
+
+  branch = g_slice_new0 (GstOMXParallelDecBranch);
+  branch->self = self;
+  g_queue_init (&branch->output);
+
+  name = g_strdup_printf ("src_%u", index);
+  branch->srcpad = gst_pad_new (name, GST_PAD_SRC);
+  g_free (name);
+  gst_pad_set_element_private (branch->srcpad, branch);
+
+  name = g_strdup_printf ("sink_%u", index);
+  branch->sinkpad = gst_pad_new (name, GST_PAD_SINK);
+  g_free (name);
+  gst_pad_set_element_private (branch->sinkpad, branch);
+  gst_pad_set_chain_function (branch->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_branch_chain));
+  gst_pad_set_event_function (branch->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_branch_event));
+  gst_pad_set_query_function (branch->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_branch_query));
+
+  /* Added first so that it is cleaned up on errors */
+  g_ptr_array_add (self->branches, branch);
+
+  branch->queue = gst_element_factory_make ("queue", NULL);
+  branch->decoder = gst_element_factory_make (self->decoder_name, NULL);
+  if (!branch->queue || !branch->decoder) {
+    if (branch->queue)
+      gst_object_unref (branch->queue);
+    if (branch->decoder)
+      gst_object_unref (branch->decoder);
+    branch->queue = branch->decoder = NULL;
+    return FALSE;
+  }
+
+  /* The decoders take their segment from the queue while the sink pad
+   * passes the next segment to another one. It holds at most one segment
+   * to keep the memory bounded */
+  g_object_set (branch->queue, "max-size-buffers", self->segment_frames,
+      "max-size-bytes", 0, "max-size-time", G_GUINT64_CONSTANT (0), NULL);
+
+  gst_bin_add_many (GST_BIN (self), branch->queue, branch->decoder, NULL);
+  ret = gst_element_link (branch->queue, branch->decoder);
+
+  pad = gst_element_get_static_pad (branch->queue, "sink");
+  ret &= gst_pad_link (branch->srcpad, pad) == GST_PAD_LINK_OK;
+  gst_object_unref (pad);
+
+  pad = gst_element_get_static_pad (branch->decoder, "src");
+  ret &= gst_pad_link (pad, branch->sinkpad) == GST_PAD_LINK_OK;
+  gst_object_unref (pad);
+
+  ret &= gst_pad_set_active (branch->srcpad, TRUE);
+  ret &= gst_pad_set_active (branch->sinkpad, TRUE);
+
+  return ret;
+}
+
+static void
+gst_omx_parallel_dec_reset (GstOMXParallelDec * self)
+{
+  guint i;
+
+  self->in_segment = 0;
+  self->out_segment = 0;
+  self->in_started = FALSE;
+  self->in_frames = 0;
+  self->eos = FALSE;
+  self->flow_ret = GST_FLOW_OK;
+
+  for (i = 0; i < self->branches->len; i++) {
+    GstOMXParallelDecBranch *branch = g_ptr_array_index (self->branches, i);
+
+    branch->segment = 0;
+    branch->used = FALSE;
+    gst_omx_parallel_dec_clear_output (branch);
+  }
+}
+
+static void
+gst_omx_parallel_dec_set_flushing (GstOMXParallelDec * self,
+    gboolean flushing)
+{
+  g_mutex_lock (&self->lock);
+  self->flushing = flushing;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+static GstStateChangeReturn
+gst_omx_parallel_dec_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (element);
+  GstStateChangeReturn ret;
+  guint i;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      for (i = 0; i < self->instances; i++) {
+        if (!gst_omx_parallel_dec_add_branch (self, i))
+          goto branch_error;
+      }
+      gst_omx_parallel_dec_reset (self);
+      gst_omx_parallel_dec_set_flushing (self, FALSE);
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      /* Wakes up decoders that wait for space in their output queue and
+       * the output task, so that the streaming threads can be stopped */
+      gst_omx_parallel_dec_set_flushing (self, TRUE);
+      for (i = 0; i < self->branches->len; i++) {
+        GstOMXParallelDecBranch *branch =
+            g_ptr_array_index (self->branches, i);
+
+        gst_pad_set_active (branch->sinkpad, FALSE);
+      }
+      break;
+    default:
+      break;
+  }
+
+  ret =
+      GST_ELEMENT_CLASS (gst_omx_parallel_dec_parent_class)->change_state
+      (element, transition);
+
+  if (ret == GST_STATE_CHANGE_FAILURE)
+    return ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      gst_pad_start_task (self->srcpad,
+          (GstTaskFunction) gst_omx_parallel_dec_loop, self, NULL);
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_omx_parallel_dec_remove_branches (self);
+      break;
+    default:
+      break;
+  }
+
+  return ret;
+
+branch_error:
+  {
+    gst_omx_parallel_dec_remove_branches (self);
+    GST_ELEMENT_ERROR (self, CORE, MISSING_PLUGIN, (NULL),
+        ("Failed to set up %u instances of decoder '%s'", self->instances,
+            GST_STR_NULL (self->decoder_name)));
+    return GST_STATE_CHANGE_FAILURE;
+  }
+}
+
+/* Passes EOS to the decoder of the current input segment, so that it
+ * outputs all frames of it.
+ *
+ * NOTE: Must be called with the lock held, releases it meanwhile */
+static void
+gst_omx_parallel_dec_end_segment (GstOMXParallelDec * self)
+{
+  GstOMXParallelDecBranch *branch;
+
+  branch = g_ptr_array_index (self->branches,
+      self->in_segment % self->branches->len);
+
+  GST_DEBUG_OBJECT (self, "Ending segment %" G_GUINT64_FORMAT " after %u "
+      "frames", self->in_segment, self->in_frames);
+
+  self->in_started = FALSE;
+  self->in_frames = 0;
+  self->in_segment++;
+
+  g_mutex_unlock (&self->lock);
+  gst_pad_push_event (branch->srcpad, gst_event_new_eos ());
+  g_mutex_lock (&self->lock);
+}
+
+static gboolean
+gst_omx_parallel_dec_forward_sticky (GstPad * pad, GstEvent ** event,
+    gpointer user_data)
+{
+  GstPad *srcpad = user_data;
+
+  if (GST_EVENT_TYPE (*event) != GST_EVENT_EOS)
+    gst_pad_push_event (srcpad, gst_event_ref (*event));
+
+  return TRUE;
+}
+
+static GstFlowReturn
+gst_omx_parallel_dec_sink_chain (GstPad * pad, GstObject * parent,
+    GstBuffer * buffer)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (parent);
+  GstOMXParallelDecBranch *branch;
+  gboolean keyframe, used;
+
+  keyframe = !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  g_mutex_lock (&self->lock);
+  if (self->flushing)
+    goto flushing;
+  if (self->flow_ret != GST_FLOW_OK)
+    goto flow_error;
+
+  if (self->in_started && keyframe
+      && self->in_frames >= self->segment_frames)
+    gst_omx_parallel_dec_end_segment (self);
+
+  branch = g_ptr_array_index (self->branches,
+      self->in_segment % self->branches->len);
+
+  if (!self->in_started) {
+    if (!keyframe) {
+      GST_DEBUG_OBJECT (self, "Dropping delta unit before the first "
+          "keyframe");
+      g_mutex_unlock (&self->lock);
+      gst_buffer_unref (buffer);
+      return GST_FLOW_OK;
+    }
+
+    /* The decoder gets the next segment once its previous one was pushed
+     * out completely */
+    while (!self->flushing
+        && self->out_segment + self->branches->len <= self->in_segment)
+      g_cond_wait (&self->cond, &self->lock);
+    if (self->flushing)
+      goto flushing;
+
+    GST_DEBUG_OBJECT (self, "Starting segment %" G_GUINT64_FORMAT
+        " on decoder %s", self->in_segment, GST_ELEMENT_NAME
+        (branch->decoder));
+
+    self->in_started = TRUE;
+    used = branch->used;
+    branch->used = TRUE;
+    branch->segment = self->in_segment;
+    g_mutex_unlock (&self->lock);
+
+    /* Takes the decoder out of EOS. Caps and segment are passed again as
+     * the segment was reset */
+    if (used) {
+      gst_pad_push_event (branch->srcpad, gst_event_new_flush_start ());
+      gst_pad_push_event (branch->srcpad, gst_event_new_flush_stop (FALSE));
+    }
+    gst_pad_sticky_events_foreach (self->sinkpad,
+        gst_omx_parallel_dec_forward_sticky, branch->srcpad);
+
+    g_mutex_lock (&self->lock);
+  }
+
+  self->in_frames++;
+  g_mutex_unlock (&self->lock);
+
+  return gst_pad_push (branch->srcpad, buffer);
+
+flushing:
+  {
+    g_mutex_unlock (&self->lock);
+    gst_buffer_unref (buffer);
+    return GST_FLOW_FLUSHING;
+  }
+
+flow_error:
+  {
+    GstFlowReturn ret = self->flow_ret;
+
+    g_mutex_unlock (&self->lock);
+    gst_buffer_unref (buffer);
+    return ret;
+  }
+}
+
+static gboolean
+gst_omx_parallel_dec_sink_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (parent);
+  GstOMXParallelDecBranch *branch = NULL;
+  gboolean ret = TRUE;
+  guint i;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      gst_omx_parallel_dec_set_flushing (self, TRUE);
+      for (i = 0; i < self->branches->len; i++) {
+        branch = g_ptr_array_index (self->branches, i);
+        if (branch->used)
+          gst_pad_push_event (branch->srcpad, gst_event_ref (event));
+      }
+      ret = gst_pad_push_event (self->srcpad, event);
+      gst_pad_pause_task (self->srcpad);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      for (i = 0; i < self->branches->len; i++) {
+        branch = g_ptr_array_index (self->branches, i);
+        if (branch->used)
+          gst_pad_push_event (branch->srcpad, gst_event_ref (event));
+      }
+      g_mutex_lock (&self->lock);
+      gst_omx_parallel_dec_reset (self);
+      self->flushing = FALSE;
+      g_mutex_unlock (&self->lock);
+      ret = gst_pad_push_event (self->srcpad, event);
+      gst_pad_start_task (self->srcpad,
+          (GstTaskFunction) gst_omx_parallel_dec_loop, self, NULL);
+      break;
+    case GST_EVENT_EOS:{
+      gboolean done;
+
+      g_mutex_lock (&self->lock);
+      if (self->in_started)
+        gst_omx_parallel_dec_end_segment (self);
+      self->eos = TRUE;
+      done = self->out_segment == self->in_segment;
+      g_mutex_unlock (&self->lock);
+
+      /* Otherwise pushed once the decoder of the last segment is done */
+      if (done)
+        ret = gst_pad_push_event (self->srcpad, event);
+      else
+        gst_event_unref (event);
+      break;
+    }
+    default:
+      if (!GST_EVENT_IS_SERIALIZED (event)) {
+        ret = gst_pad_push_event (self->srcpad, event);
+        break;
+      }
+
+      /* Sticky events are passed at the start of the next segment
+       * otherwise */
+      g_mutex_lock (&self->lock);
+      if (self->in_started)
+        branch = g_ptr_array_index (self->branches,
+            self->in_segment % self->branches->len);
+      g_mutex_unlock (&self->lock);
+
+      if (branch)
+        ret = gst_pad_push_event (branch->srcpad, event);
+      else
+        gst_event_unref (event);
+      break;
+  }
+
+  return ret;
+}
+
+static gboolean
+gst_omx_parallel_dec_sink_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (parent);
+  GstOMXParallelDecBranch *branch;
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CAPS:
+    case GST_QUERY_ACCEPT_CAPS:
+      /* All decoders are the same, ask the first one */
+      if (self->branches->len > 0) {
+        branch = g_ptr_array_index (self->branches, 0);
+        return gst_pad_peer_query (branch->srcpad, query);
+      }
+      break;
+    default:
+      break;
+  }
+
+  return gst_pad_query_default (pad, parent, query);
+}
+
+static gboolean
+gst_omx_parallel_dec_src_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (parent);
+
+  return gst_pad_push_event (self->sinkpad, event);
+}
+
+static gboolean
+gst_omx_parallel_dec_src_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (parent);
+  GstOMXParallelDecBranch *branch;
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CAPS:
+    case GST_QUERY_ACCEPT_CAPS:
+      if (self->branches->len > 0) {
+        branch = g_ptr_array_index (self->branches, 0);
+        return gst_pad_peer_query (branch->sinkpad, query);
+      }
+      break;
+    default:
+      return gst_pad_peer_query (self->sinkpad, query);
+  }
+
+  return gst_pad_query_default (pad, parent, query);
+}
+
+/* Queues @obj, a decoded buffer or a serialized event of the decoder of
+ * @branch, to be pushed downstream in order. Buffers wait for space in
+ * the queue. Returns FALSE when flushing */
+static gboolean
+gst_omx_parallel_dec_queue_output (GstOMXParallelDecBranch * branch,
+    GstMiniObject * obj)
+{
+  GstOMXParallelDec *self = branch->self;
+  gboolean is_buffer = GST_IS_BUFFER (obj);
+
+  g_mutex_lock (&self->lock);
+  while (is_buffer && !self->flushing
+      && branch->output_buffers >= self->segment_frames)
+    g_cond_wait (&self->cond, &self->lock);
+  if (self->flushing) {
+    g_mutex_unlock (&self->lock);
+    gst_mini_object_unref (obj);
+    return FALSE;
+  }
+
+  g_queue_push_tail (&branch->output, obj);
+  if (is_buffer)
+    branch->output_buffers++;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+
+  return TRUE;
+}
+
+static GstFlowReturn
+gst_omx_parallel_dec_branch_chain (GstPad * pad, GstObject * parent,
+    GstBuffer * buffer)
+{
+  GstOMXParallelDecBranch *branch = gst_pad_get_element_private (pad);
+  GstOMXParallelDec *self = branch->self;
+  GstFlowReturn ret;
+
+  if (!gst_omx_parallel_dec_queue_output (branch,
+          GST_MINI_OBJECT_CAST (buffer)))
+    return GST_FLOW_FLUSHING;
+
+  /* Errors downstream stop the decoder too */
+  g_mutex_lock (&self->lock);
+  ret = self->flow_ret;
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+/* Whether @event equals the sticky event of the same type on @pad, so
+ * the events that every decoder repeats are only pushed once */
+static gboolean
+gst_omx_parallel_dec_is_sticky_on_pad (GstPad * pad, GstEvent * event)
+{
+  GstEvent *current;
+  gboolean ret = FALSE;
+
+  current = gst_pad_get_sticky_event (pad, GST_EVENT_TYPE (event), 0);
+  if (!current)
+    return FALSE;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_STREAM_START:{
+      const gchar *a, *b;
+
+      gst_event_parse_stream_start (event, &a);
+      gst_event_parse_stream_start (current, &b);
+      ret = g_strcmp0 (a, b) == 0;
+      break;
+    }
+    case GST_EVENT_CAPS:{
+      GstCaps *a, *b;
+
+      gst_event_parse_caps (event, &a);
+      gst_event_parse_caps (current, &b);
+      ret = gst_caps_is_equal (a, b);
+      break;
+    }
+    case GST_EVENT_SEGMENT:{
+      const GstSegment *a, *b;
+
+      gst_event_parse_segment (event, &a);
+      gst_event_parse_segment (current, &b);
+      ret = a->format == b->format && a->rate == b->rate
+          && a->applied_rate == b->applied_rate && a->base == b->base
+          && a->offset == b->offset && a->start == b->start
+          && a->stop == b->stop && a->time == b->time;
+      break;
+    }
+    default:
+      break;
+  }
+  gst_event_unref (current);
+
+  return ret;
+}
+
+static gboolean
+gst_omx_parallel_dec_branch_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstOMXParallelDecBranch *branch = gst_pad_get_element_private (pad);
+  GstOMXParallelDec *self = branch->self;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+    case GST_EVENT_FLUSH_STOP:
+      /* Flushes are pushed downstream by the sink pad, the ones of the
+       * decoders only end their segments */
+      gst_event_unref (event);
+      return TRUE;
+    default:
+      break;
+  }
+
+  if (!GST_EVENT_IS_SERIALIZED (event))
+    return gst_pad_push_event (self->srcpad, event);
+
+  /* EOS ends the segment of the decoder and is queued too */
+  return gst_omx_parallel_dec_queue_output (branch,
+      GST_MINI_OBJECT_CAST (event));
+}
+
+static gboolean
+gst_omx_parallel_dec_branch_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  GstOMXParallelDecBranch *branch = gst_pad_get_element_private (pad);
+
+  /* Caps and allocation are negotiated with downstream by every
+   * decoder */
+  return gst_pad_peer_query (branch->self->srcpad, query);
+}
+
+/* Pushes the queued output of the decoder of the current output segment
+ * downstream, and moves on to the next segment once its EOS is taken
+ * from the queue */
+static void
+gst_omx_parallel_dec_loop (GstOMXParallelDec * self)
+{
+  GstOMXParallelDecBranch *branch;
+  GstMiniObject *obj;
+  GstFlowReturn ret;
+  gboolean done;
+
+  g_mutex_lock (&self->lock);
+  do {
+    branch = self->branches->len == 0 ? NULL :
+        g_ptr_array_index (self->branches,
+        self->out_segment % self->branches->len);
+    obj = branch ? g_queue_pop_head (&branch->output) : NULL;
+    if (!obj && !self->flushing)
+      g_cond_wait (&self->cond, &self->lock);
+  } while (!obj && !self->flushing);
+
+  if (obj && GST_IS_BUFFER (obj))
+    branch->output_buffers--;
+  if (self->flushing) {
+    if (obj)
+      gst_mini_object_unref (obj);
+    goto flushing;
+  }
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+
+  if (GST_IS_BUFFER (obj)) {
+    ret = gst_pad_push (self->srcpad, GST_BUFFER_CAST (obj));
+    if (ret != GST_FLOW_OK) {
+      GST_DEBUG_OBJECT (self, "Pausing task, reason %s",
+          gst_flow_get_name (ret));
+      g_mutex_lock (&self->lock);
+      self->flow_ret = ret;
+      g_cond_broadcast (&self->cond);
+      g_mutex_unlock (&self->lock);
+      if (ret == GST_FLOW_NOT_LINKED || ret < GST_FLOW_EOS)
+        GST_ELEMENT_ERROR (self, STREAM, FAILED, (NULL),
+            ("Internal data stream error, reason %s",
+                gst_flow_get_name (ret)));
+      gst_pad_pause_task (self->srcpad);
+    }
+  } else if (GST_EVENT_TYPE (obj) == GST_EVENT_EOS) {
+    gst_mini_object_unref (obj);
+
+    g_mutex_lock (&self->lock);
+    GST_DEBUG_OBJECT (self, "Segment %" G_GUINT64_FORMAT " done",
+        self->out_segment);
+    self->out_segment++;
+    done = self->eos && !self->in_started
+        && self->out_segment == self->in_segment;
+    g_cond_broadcast (&self->cond);
+    g_mutex_unlock (&self->lock);
+
+    if (done)
+      gst_pad_push_event (self->srcpad, gst_event_new_eos ());
+  } else if (GST_EVENT_IS_STICKY (GST_EVENT_CAST (obj))
+      && gst_omx_parallel_dec_is_sticky_on_pad (self->srcpad,
+          GST_EVENT_CAST (obj))) {
+    gst_mini_object_unref (obj);
+  } else {
+    gst_pad_push_event (self->srcpad, GST_EVENT_CAST (obj));
+  }
+
+  return;
+
+flushing:
+  {
+    g_mutex_unlock (&self->lock);
+    GST_DEBUG_OBJECT (self, "Flushing, pausing task");
+    gst_pad_pause_task (self->srcpad);
+  }
+}
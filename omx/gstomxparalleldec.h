@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2016, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_PARALLEL_DEC_H__
+#define __GST_OMX_PARALLEL_DEC_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_OMX_PARALLEL_DEC \
+  (gst_omx_parallel_dec_get_type())
+#define GST_OMX_PARALLEL_DEC(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_OMX_PARALLEL_DEC,GstOMXParallelDec))
+#define GST_OMX_PARALLEL_DEC_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_OMX_PARALLEL_DEC,GstOMXParallelDecClass))
+#define GST_OMX_PARALLEL_DEC_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS((obj),GST_TYPE_OMX_PARALLEL_DEC,GstOMXParallelDecClass))
+#define GST_IS_OMX_PARALLEL_DEC(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_OMX_PARALLEL_DEC))
+#define GST_IS_OMX_PARALLEL_DEC_CLASS(obj) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_OMX_PARALLEL_DEC))
+
+typedef struct _GstOMXParallelDec GstOMXParallelDec;
+typedef struct _GstOMXParallelDecClass GstOMXParallelDecClass;
+
+struct _GstOMXParallelDec
+{
+  GstBin parent;
+
+  GstPad *sinkpad, *srcpad;
+
+  /* properties */
+  gchar *decoder_name;
+  guint instances;
+  guint segment_frames;
+
+  /* One GstOMXParallelDecBranch per decoder instance */
+  GPtrArray *branches;
+
+  /* Protects the segment state and the output queues of the branches,
+   * signalled when any of them changes or on flushing */
+  GMutex lock;
+  GCond cond;
+  gboolean flushing;
+  /* Result of the last push downstream by the output task */
+  GstFlowReturn flow_ret;
+  /* Index of the segment passed to a decoder and of the segment whose
+   * frames are pushed downstream. Segment n goes to branch
+   * n % instances */
+  guint64 in_segment, out_segment;
+  /* TRUE if frames of in_segment were passed already */
+  gboolean in_started;
+  guint in_frames;
+  /* Upstream sent EOS, it is pushed after the last segment */
+  gboolean eos;
+};
+
+struct _GstOMXParallelDecClass
+{
+  GstBinClass parent_class;
+};
+
+GType gst_omx_parallel_dec_get_type (void);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_PARALLEL_DEC_H__ */
@@ -31,8 +31,46 @@
 GST_DEBUG_CATEGORY (gst_omx_video_debug_category);
 #define GST_CAT_DEFAULT gst_omx_video_debug_category
 
+/* Parses the vendor color formats in @formats, each as
+ * "<GstVideoFormat>:<OMX_COLOR_FORMATTYPE>", e.g. "P010_10LE:0x7f000100".
+ * The OMX IL headers have no formats with more than 8 bits per sample,
+ * and the vendor values differ between components, so every element
+ * class keeps the returned table of its own */
+GHashTable *
+gst_omx_video_parse_vendor_formats (gchar ** formats)
+{
+  GHashTable *vendor_formats = g_hash_table_new (NULL, NULL);
+
+  for (; *formats; formats++) {
+    gchar **pair = g_strsplit (*formats, ":", 2);
+    GstVideoFormat format = GST_VIDEO_FORMAT_UNKNOWN;
+    guint64 omx_colorformat = 0;
+
+    if (pair[0] && pair[1]) {
+      format = gst_video_format_from_string (g_strstrip (pair[0]));
+      omx_colorformat = g_ascii_strtoull (pair[1], NULL, 0);
+    }
+
+    if (format == GST_VIDEO_FORMAT_UNKNOWN || omx_colorformat == 0) {
+      GST_ERROR ("Invalid color format '%s'", *formats);
+    } else {
+      GST_DEBUG ("Using color format 0x%08x for %s", (guint) omx_colorformat,
+          gst_video_format_to_string (format));
+      g_hash_table_insert (vendor_formats,
+          GUINT_TO_POINTER ((guint) omx_colorformat),
+          GINT_TO_POINTER (format));
+    }
+    g_strfreev (pair);
+  }
+
+  return vendor_formats;
+}
+
+/* @vendor_formats is the color-formats table of the element class, or
+ * NULL for the standard formats only */
 GstVideoFormat
-gst_omx_video_get_format_from_omx (OMX_COLOR_FORMATTYPE omx_colorformat)
+gst_omx_video_get_format_from_omx (OMX_COLOR_FORMATTYPE omx_colorformat,
+    GHashTable * vendor_formats)
 {
   GstVideoFormat format;
 
@@ -77,6 +115,9 @@ gst_omx_video_get_format_from_omx (OMX_COLOR_FORMATTYPE omx_colorformat)
       break;
     default:
       format = GST_VIDEO_FORMAT_UNKNOWN;
+      if (vendor_formats)
+        format = GPOINTER_TO_INT (g_hash_table_lookup (vendor_formats,
+                GUINT_TO_POINTER ((guint) omx_colorformat)));
       break;
   }
 
@@ -85,7 +126,7 @@ gst_omx_video_get_format_from_omx (OMX_COLOR_FORMATTYPE omx_colorformat)
 
 GList *
 gst_omx_video_get_supported_colorformats (GstOMXPort * port,
-    GstVideoCodecState * state)
+    GstVideoCodecState * state, GHashTable * vendor_formats)
 {
   GstOMXComponent *comp = port->comp;
   OMX_VIDEO_PARAM_PORTFORMATTYPE param;
@@ -117,7 +158,8 @@ gst_omx_video_get_supported_colorformats (GstOMXPort * port,
       break;
 
     if (err == OMX_ErrorNone || err == OMX_ErrorNoMore) {
-      f = gst_omx_video_get_format_from_omx (param.eColorFormat);
+      f = gst_omx_video_get_format_from_omx (param.eColorFormat,
+          vendor_formats);
 
       if (f != GST_VIDEO_FORMAT_UNKNOWN) {
         m = g_slice_new (GstOMXVideoNegotiationMap);
@@ -163,6 +205,427 @@ gst_omx_video_negotiation_map_free (GstOMXVideoNegotiationMap * m)
   g_slice_free (GstOMXVideoNegotiationMap, m);
 }
 
+/* Index of the frames passed to a component, keyed by the OMX timestamp of
+ * their input buffer. The entries are kept sorted by timestamp and hold a
+ * reference to their frame. One hash table points to the first entry with
+ * a given timestamp and another one to the entry of a system frame number,
+ * which makes exact matching and removing a frame O(1) and expiring older
+ * frames proportional to their number.
+ * Frames finished or dropped by other means than the index have to be
+ * removed from it. The ones the base class drops on its own are swept out
+ * at EOS, and all entries are cleared when flushing.
+ * The index is not locked, it has to be used with the stream lock held */
+struct _GstOMXVideoFrameIndex
+{
+  GstElement *element;
+  GQueue entries;
+  GHashTable *first;
+  GHashTable *links;
+};
+
+typedef struct
+{
+  gint64 ticks;
+  GstVideoCodecFrame *frame;
+} GstOMXVideoFrameIndexEntry;
+
+/* @element is the GstVideoDecoder or GstVideoEncoder owning the frames,
+ * not reffed */
+GstOMXVideoFrameIndex *
+gst_omx_video_frame_index_new (GstElement * element)
+{
+  GstOMXVideoFrameIndex *index = g_slice_new0 (GstOMXVideoFrameIndex);
+
+  index->element = element;
+  g_queue_init (&index->entries);
+  index->first = g_hash_table_new (g_int64_hash, g_int64_equal);
+  index->links = g_hash_table_new (NULL, NULL);
+
+  return index;
+}
+
+void
+gst_omx_video_frame_index_free (GstOMXVideoFrameIndex * index)
+{
+  gst_omx_video_frame_index_clear (index);
+  g_hash_table_destroy (index->first);
+  g_hash_table_destroy (index->links);
+  g_slice_free (GstOMXVideoFrameIndex, index);
+}
+
+static void
+gst_omx_video_frame_index_entry_free (GstOMXVideoFrameIndexEntry * entry)
+{
+  gst_video_codec_frame_unref (entry->frame);
+  g_slice_free (GstOMXVideoFrameIndexEntry, entry);
+}
+
+void
+gst_omx_video_frame_index_clear (GstOMXVideoFrameIndex * index)
+{
+  GstOMXVideoFrameIndexEntry *entry;
+
+  g_hash_table_remove_all (index->first);
+  g_hash_table_remove_all (index->links);
+  while ((entry = g_queue_pop_head (&index->entries)))
+    gst_omx_video_frame_index_entry_free (entry);
+}
+
+static void
+gst_omx_video_frame_index_remove_link (GstOMXVideoFrameIndex * index,
+    GList * link)
+{
+  GstOMXVideoFrameIndexEntry *entry = link->data;
+
+  if (g_hash_table_lookup (index->first, &entry->ticks) == link) {
+    GstOMXVideoFrameIndexEntry *next = link->next ? link->next->data : NULL;
+
+    /* The key is owned by the entry, so replace it as well */
+    if (next && next->ticks == entry->ticks)
+      g_hash_table_replace (index->first, &next->ticks, link->next);
+    else
+      g_hash_table_remove (index->first, &entry->ticks);
+  }
+  g_hash_table_remove (index->links,
+      GUINT_TO_POINTER (entry->frame->system_frame_number));
+
+  g_queue_delete_link (&index->entries, link);
+  gst_omx_video_frame_index_entry_free (entry);
+}
+
+/* Removes the entries of frames that are not pending anymore, e.g. the ones
+ * the base class dropped on its own. Walks all pending frames, so it is
+ * only meant to be called at EOS */
+void
+gst_omx_video_frame_index_sweep (GstOMXVideoFrameIndex * index)
+{
+  GHashTable *pending;
+  GList *frames, *l, *next;
+
+  if (index->entries.length == 0)
+    return;
+
+  if (GST_IS_VIDEO_DECODER (index->element))
+    frames = gst_video_decoder_get_frames (GST_VIDEO_DECODER
+        (index->element));
+  else
+    frames = gst_video_encoder_get_frames (GST_VIDEO_ENCODER
+        (index->element));
+
+  pending = g_hash_table_new (NULL, NULL);
+  for (l = frames; l; l = l->next)
+    g_hash_table_add (pending, l->data);
+
+  for (l = index->entries.head; l; l = next) {
+    GstOMXVideoFrameIndexEntry *entry = l->data;
+
+    next = l->next;
+    if (!g_hash_table_contains (pending, entry->frame))
+      gst_omx_video_frame_index_remove_link (index, l);
+  }
+  g_hash_table_destroy (pending);
+
+  g_list_free_full (frames, (GDestroyNotify) gst_video_codec_frame_unref);
+}
+
+void
+gst_omx_video_frame_index_add (GstOMXVideoFrameIndex * index, gint64 ticks,
+    GstVideoCodecFrame * frame)
+{
+  GstOMXVideoFrameIndexEntry *entry;
+  GList *l;
+
+  /* A frame is only passed once, but don't leave a stale entry behind */
+  gst_omx_video_frame_index_remove (index, frame);
+
+  entry = g_slice_new (GstOMXVideoFrameIndexEntry);
+  entry->ticks = ticks;
+  entry->frame = gst_video_codec_frame_ref (frame);
+
+  /* Frames mostly arrive in timestamp order, only reordered ones walk back */
+  for (l = index->entries.tail; l; l = l->prev) {
+    if (((GstOMXVideoFrameIndexEntry *) l->data)->ticks <= ticks)
+      break;
+  }
+
+  if (l) {
+    g_queue_insert_after (&index->entries, l, entry);
+    l = l->next;
+  } else {
+    g_queue_push_head (&index->entries, entry);
+    l = index->entries.head;
+  }
+
+  if (!g_hash_table_contains (index->first, &entry->ticks))
+    g_hash_table_insert (index->first, &entry->ticks, l);
+  g_hash_table_insert (index->links,
+      GUINT_TO_POINTER (frame->system_frame_number), l);
+}
+
+/* Returns a new reference to the frame passed with timestamp @ticks,
+ * leaving it in the index */
+GstVideoCodecFrame *
+gst_omx_video_frame_index_lookup (GstOMXVideoFrameIndex * index, gint64 ticks)
+{
+  GList *link = g_hash_table_lookup (index->first, &ticks);
+
+  if (!link)
+    return NULL;
+
+  return gst_video_codec_frame_ref (((GstOMXVideoFrameIndexEntry *)
+          link->data)->frame);
+}
+
+/* Removes the frame passed with timestamp @ticks from the index and
+ * returns a new reference to it */
+GstVideoCodecFrame *
+gst_omx_video_frame_index_take (GstOMXVideoFrameIndex * index, gint64 ticks)
+{
+  GList *link = g_hash_table_lookup (index->first, &ticks);
+  GstVideoCodecFrame *frame;
+
+  if (!link)
+    return NULL;
+
+  frame = gst_video_codec_frame_ref (((GstOMXVideoFrameIndexEntry *)
+          link->data)->frame);
+  gst_omx_video_frame_index_remove_link (index, link);
+
+  return frame;
+}
+
+/* Removes all frames passed with a timestamp older than @ticks and returns
+ * new references to them, in timestamp order */
+GList *
+gst_omx_video_frame_index_take_older (GstOMXVideoFrameIndex * index,
+    gint64 ticks)
+{
+  GList *frames = NULL;
+  GstOMXVideoFrameIndexEntry *entry;
+
+  while (index->entries.head
+      && (entry = index->entries.head->data)->ticks < ticks) {
+    frames = g_list_prepend (frames, gst_video_codec_frame_ref (entry->frame));
+    gst_omx_video_frame_index_remove_link (index, index->entries.head);
+  }
+
+  return g_list_reverse (frames);
+}
+
+/* Removes @frame from the index, for frames that were found or finished
+ * by other means than their timestamp */
+void
+gst_omx_video_frame_index_remove (GstOMXVideoFrameIndex * index,
+    GstVideoCodecFrame * frame)
+{
+  GList *link = g_hash_table_lookup (index->links,
+      GUINT_TO_POINTER (frame->system_frame_number));
+
+  if (link)
+    gst_omx_video_frame_index_remove_link (index, link);
+}
+
+/* Bounded queue of frames that are passed on by a thread of its own, so
+ * that the thread queueing them doesn't block on the component. The
+ * thread is started with the first frame and runs until the queue is
+ * stopped. The flow return of the last frame passed on is kept and
+ * returned when queueing the next one. Once it isn't GST_FLOW_OK the
+ * queue drops all frames until it is reset by unsetting flushing */
+struct _GstOMXVideoFrameQueue
+{
+  GMutex lock;
+  GCond cond;
+  GQueue frames;
+  GThread *thread;
+  gchar *name;
+  /* TRUE while the thread passes on a frame and if it has to exit */
+  gboolean busy;
+  gboolean stopping;
+  GstFlowReturn flow_ret;
+
+  GstOMXVideoFrameQueueFunc func;
+  GstOMXVideoFrameQueueDropFunc drop;
+  gpointer user_data;
+};
+
+GstOMXVideoFrameQueue *
+gst_omx_video_frame_queue_new (const gchar * name,
+    GstOMXVideoFrameQueueFunc func, GstOMXVideoFrameQueueDropFunc drop,
+    gpointer user_data)
+{
+  GstOMXVideoFrameQueue *queue = g_slice_new0 (GstOMXVideoFrameQueue);
+
+  g_mutex_init (&queue->lock);
+  g_cond_init (&queue->cond);
+  g_queue_init (&queue->frames);
+  queue->name = g_strdup (name);
+  queue->flow_ret = GST_FLOW_OK;
+  queue->func = func;
+  queue->drop = drop;
+  queue->user_data = user_data;
+
+  return queue;
+}
+
+void
+gst_omx_video_frame_queue_free (GstOMXVideoFrameQueue * queue)
+{
+  gst_omx_video_frame_queue_stop (queue);
+
+  g_free (queue->name);
+  g_cond_clear (&queue->cond);
+  g_mutex_clear (&queue->lock);
+  g_slice_free (GstOMXVideoFrameQueue, queue);
+}
+
+static gpointer
+gst_omx_video_frame_queue_thread (GstOMXVideoFrameQueue * queue)
+{
+  GstVideoCodecFrame *frame;
+  GstFlowReturn flow_ret;
+
+  g_mutex_lock (&queue->lock);
+  while (TRUE) {
+    while (!queue->stopping && g_queue_is_empty (&queue->frames))
+      g_cond_wait (&queue->cond, &queue->lock);
+    if (queue->stopping)
+      break;
+
+    frame = g_queue_pop_head (&queue->frames);
+    queue->busy = TRUE;
+    g_cond_broadcast (&queue->cond);
+    g_mutex_unlock (&queue->lock);
+
+    flow_ret = queue->func (frame, queue->user_data);
+
+    g_mutex_lock (&queue->lock);
+    queue->busy = FALSE;
+    if (queue->flow_ret == GST_FLOW_OK)
+      queue->flow_ret = flow_ret;
+    g_cond_broadcast (&queue->cond);
+  }
+  g_mutex_unlock (&queue->lock);
+
+  return NULL;
+}
+
+/* Queues the frame, waiting while max_size frames are queued already.
+ * Returns the flow return of the frames passed on before, the frame is
+ * dropped if it isn't GST_FLOW_OK */
+GstFlowReturn
+gst_omx_video_frame_queue_push (GstOMXVideoFrameQueue * queue,
+    GstVideoCodecFrame * frame, guint max_size)
+{
+  GstFlowReturn flow_ret;
+
+  g_mutex_lock (&queue->lock);
+  while (queue->flow_ret == GST_FLOW_OK
+      && g_queue_get_length (&queue->frames) >= max_size)
+    g_cond_wait (&queue->cond, &queue->lock);
+
+  flow_ret = queue->flow_ret;
+  if (flow_ret == GST_FLOW_OK) {
+    if (!queue->thread)
+      queue->thread = g_thread_new (queue->name,
+          (GThreadFunc) gst_omx_video_frame_queue_thread, queue);
+    g_queue_push_tail (&queue->frames, frame);
+    g_cond_broadcast (&queue->cond);
+  }
+  g_mutex_unlock (&queue->lock);
+
+  if (flow_ret != GST_FLOW_OK)
+    queue->drop (frame, queue->user_data);
+
+  return flow_ret;
+}
+
+/* Waits until all queued frames are passed on or dropped */
+void
+gst_omx_video_frame_queue_wait_empty (GstOMXVideoFrameQueue * queue)
+{
+  g_mutex_lock (&queue->lock);
+  while (queue->flow_ret == GST_FLOW_OK
+      && (queue->busy || !g_queue_is_empty (&queue->frames)))
+    g_cond_wait (&queue->cond, &queue->lock);
+  g_mutex_unlock (&queue->lock);
+}
+
+/* Drops the queued frames and all following ones if flushing. Doesn't
+ * wait for a frame being passed on then, as that might wait for the
+ * flush. Otherwise waits for that frame and accepts frames again */
+void
+gst_omx_video_frame_queue_set_flushing (GstOMXVideoFrameQueue * queue,
+    gboolean flushing)
+{
+  GQueue frames = G_QUEUE_INIT;
+  GstVideoCodecFrame *frame;
+
+  g_mutex_lock (&queue->lock);
+  if (flushing) {
+    queue->flow_ret = GST_FLOW_FLUSHING;
+    frames = queue->frames;
+    g_queue_init (&queue->frames);
+  } else {
+    while (queue->busy)
+      g_cond_wait (&queue->cond, &queue->lock);
+    queue->flow_ret = GST_FLOW_OK;
+  }
+  g_cond_broadcast (&queue->cond);
+  g_mutex_unlock (&queue->lock);
+
+  while ((frame = g_queue_pop_head (&frames)))
+    queue->drop (frame, queue->user_data);
+}
+
+gboolean
+gst_omx_video_frame_queue_is_flushing (GstOMXVideoFrameQueue * queue)
+{
+  gboolean flushing;
+
+  g_mutex_lock (&queue->lock);
+  flushing = queue->flow_ret == GST_FLOW_FLUSHING;
+  g_mutex_unlock (&queue->lock);
+
+  return flushing;
+}
+
+/* Returns the number of queued frames */
+guint
+gst_omx_video_frame_queue_get_level (GstOMXVideoFrameQueue * queue)
+{
+  guint level;
+
+  g_mutex_lock (&queue->lock);
+  level = g_queue_get_length (&queue->frames);
+  g_mutex_unlock (&queue->lock);
+
+  return level;
+}
+
+/* Drops the queued frames and stops the thread. The queue stays flushing
+ * until that is unset */
+void
+gst_omx_video_frame_queue_stop (GstOMXVideoFrameQueue * queue)
+{
+  GThread *thread;
+
+  gst_omx_video_frame_queue_set_flushing (queue, TRUE);
+
+  g_mutex_lock (&queue->lock);
+  thread = queue->thread;
+  queue->thread = NULL;
+  queue->stopping = TRUE;
+  g_cond_broadcast (&queue->cond);
+  g_mutex_unlock (&queue->lock);
+
+  if (thread)
+    g_thread_join (thread);
+
+  g_mutex_lock (&queue->lock);
+  queue->stopping = FALSE;
+  g_mutex_unlock (&queue->lock);
+}
+
 GstVideoCodecFrame *
 gst_omx_video_find_nearest_frame (GstOMXBuffer * buf, GList * frames)
 {
@@ -196,3 +659,50 @@ gst_omx_video_find_nearest_frame (GstOMXBuffer * buf, GList * frames)
 
   return best;
 }
+
+/* Moves the plane offsets @offset of a frame laid out with @stride to the
+ * pixel at @x, @y, e.g. to the top left corner of the visible area */
+void
+gst_omx_video_offset_planes (const GstVideoFormatInfo * finfo, gint x, gint y,
+    const gint * stride, gsize * offset)
+{
+  gboolean done[GST_VIDEO_MAX_PLANES] = { FALSE, };
+  guint i;
+
+  for (i = 0; i < GST_VIDEO_FORMAT_INFO_N_COMPONENTS (finfo); i++) {
+    guint p = GST_VIDEO_FORMAT_INFO_PLANE (finfo, i);
+
+    if (done[p])
+      continue;
+    done[p] = TRUE;
+
+    offset[p] += GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT (finfo, i, y) * stride[p]
+        + gst_omx_video_get_row_bytes (finfo, i, x);
+  }
+}
+
+/* Returns the bytes that component @comp takes in a row of @width
+ * pixels */
+guint
+gst_omx_video_get_row_bytes (const GstVideoFormatInfo * finfo, gint comp,
+    guint width)
+{
+  /* Formats without pixel stride pack 3 10 bit samples into 32 bits.
+   * Their chroma planes have 2 samples per subsampled pixel, as many as
+   * the luma plane */
+  if (GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, comp) == 0)
+    return (width + 2) / 3 * 4;
+
+  return GST_VIDEO_FORMAT_INFO_SCALE_WIDTH (finfo, comp, width)
+      * GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, comp);
+}
+
+/* Returns how many pixels of the first component fit into @bytes */
+guint
+gst_omx_video_get_row_width (const GstVideoFormatInfo * finfo, guint bytes)
+{
+  if (GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, 0) == 0)
+    return bytes / 4 * 3;
+
+  return bytes / GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, 0);
+}
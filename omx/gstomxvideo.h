@@ -31,9 +31,20 @@
 #include <gst/video/gstvideoencoder.h>
 
 #include "gstomx.h"
+#include "gstomxvideocopy.h"
 
 G_BEGIN_DECLS
 
+typedef struct _GstOMXVideoFrameIndex GstOMXVideoFrameIndex;
+typedef struct _GstOMXVideoFrameQueue GstOMXVideoFrameQueue;
+
+/* Passes a queued frame on, called from the thread of the queue */
+typedef GstFlowReturn (*GstOMXVideoFrameQueueFunc) (GstVideoCodecFrame *
+    frame, gpointer user_data);
+/* Releases a frame that is dropped from the queue */
+typedef void (*GstOMXVideoFrameQueueDropFunc) (GstVideoCodecFrame * frame,
+    gpointer user_data);
+
 typedef struct
 {
   GstVideoFormat format;
@@ -41,20 +52,83 @@ typedef struct
 } GstOMXVideoNegotiationMap;
 
 GstVideoFormat
-gst_omx_video_get_format_from_omx (OMX_COLOR_FORMATTYPE omx_colorformat);
+gst_omx_video_get_format_from_omx (OMX_COLOR_FORMATTYPE omx_colorformat,
+    GHashTable * vendor_formats);
+
+GHashTable *gst_omx_video_parse_vendor_formats (gchar ** formats);
 
 GList *
 gst_omx_video_get_supported_colorformats (GstOMXPort * port,
-    GstVideoCodecState * state);
+    GstVideoCodecState * state, GHashTable * vendor_formats);
 
 GstCaps * gst_omx_video_get_caps_for_map(GList * map);
 
 void
 gst_omx_video_negotiation_map_free (GstOMXVideoNegotiationMap * m);
 
+GstOMXVideoFrameIndex * gst_omx_video_frame_index_new (GstElement * element);
+
+void gst_omx_video_frame_index_free (GstOMXVideoFrameIndex * index);
+
+void gst_omx_video_frame_index_clear (GstOMXVideoFrameIndex * index);
+
+void gst_omx_video_frame_index_sweep (GstOMXVideoFrameIndex * index);
+
+void
+gst_omx_video_frame_index_add (GstOMXVideoFrameIndex * index, gint64 ticks,
+    GstVideoCodecFrame * frame);
+
+GstVideoCodecFrame *
+gst_omx_video_frame_index_lookup (GstOMXVideoFrameIndex * index, gint64 ticks);
+
+GstVideoCodecFrame *
+gst_omx_video_frame_index_take (GstOMXVideoFrameIndex * index, gint64 ticks);
+
+GList *
+gst_omx_video_frame_index_take_older (GstOMXVideoFrameIndex * index,
+    gint64 ticks);
+
+void
+gst_omx_video_frame_index_remove (GstOMXVideoFrameIndex * index,
+    GstVideoCodecFrame * frame);
+
+GstOMXVideoFrameQueue *
+gst_omx_video_frame_queue_new (const gchar * name,
+    GstOMXVideoFrameQueueFunc func, GstOMXVideoFrameQueueDropFunc drop,
+    gpointer user_data);
+
+void gst_omx_video_frame_queue_free (GstOMXVideoFrameQueue * queue);
+
+GstFlowReturn
+gst_omx_video_frame_queue_push (GstOMXVideoFrameQueue * queue,
+    GstVideoCodecFrame * frame, guint max_size);
+
+void gst_omx_video_frame_queue_wait_empty (GstOMXVideoFrameQueue * queue);
+
+void
+gst_omx_video_frame_queue_set_flushing (GstOMXVideoFrameQueue * queue,
+    gboolean flushing);
+
+gboolean gst_omx_video_frame_queue_is_flushing (GstOMXVideoFrameQueue * queue);
+
+guint gst_omx_video_frame_queue_get_level (GstOMXVideoFrameQueue * queue);
+
+void gst_omx_video_frame_queue_stop (GstOMXVideoFrameQueue * queue);
+
 GstVideoCodecFrame *
 gst_omx_video_find_nearest_frame (GstOMXBuffer * buf, GList * frames);
 
+void
+gst_omx_video_offset_planes (const GstVideoFormatInfo * finfo, gint x, gint y,
+    const gint * stride, gsize * offset);
+
+guint
+gst_omx_video_get_row_bytes (const GstVideoFormatInfo * finfo, gint comp,
+    guint width);
+
+guint
+gst_omx_video_get_row_width (const GstVideoFormatInfo * finfo, guint bytes);
+
 G_END_DECLS
 
 #endif /* __GST_OMX_VIDEO_H__ */
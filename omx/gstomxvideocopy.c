@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2011, Hewlett-Packard Development Company, L.P.
+ *   Author: Sebastian Dröge <sebastian.droege@collabora.co.uk>, Collabora Ltd.
+ * Copyright (C) 2013, Collabora Ltd.
+ *   Author: Sebastian Dröge <sebastian.droege@collabora.co.uk> *
+ * Copyright 2014 Advanced Micro Devices, Inc.
+ *   Author: Christian König <christian.koenig@amd.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Plane copies between OMX and GStreamer buffers. This only depends on
+ * GStreamer core, so that tools/copybench can build it on its own */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "gstomxvideocopy.h"
+
+#if defined (__aarch64__)
+#define GST_OMX_VIDEO_COPY_NEON_NT 1
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+#include <arm_neon.h>
+#define GST_OMX_VIDEO_COPY_NEON 1
+#if defined (__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_NEON
+#define HWCAP_NEON (1 << 12)
+#endif
+#endif
+#elif defined (__SSE2__)
+#include <emmintrin.h>
+#define GST_OMX_VIDEO_COPY_SSE2 1
+#endif
+
+GST_DEBUG_CATEGORY_EXTERN (gst_omx_video_debug_category);
+#define GST_CAT_DEFAULT gst_omx_video_debug_category
+
+typedef void (*GstOMXVideoCopyRowFunc) (guint8 * dest, const guint8 * src,
+    gsize len);
+
+static void
+copy_row_scalar (guint8 * dest, const guint8 * src, gsize len)
+{
+  memcpy (dest, src, len);
+}
+
+#ifdef GST_OMX_VIDEO_COPY_NEON_NT
+/* Streaming copy with non-temporal pair stores, so that writing a whole
+ * frame to uncached or write-combined memory neither allocates the
+ * destination lines in the cache nor evicts the source */
+static void
+copy_row_neon_nt (guint8 * dest, const guint8 * src, gsize len)
+{
+  while (len >= 64) {
+    __asm__ volatile ("ldp q0, q1, [%1]\n\t"
+        "ldp q2, q3, [%1, #32]\n\t"
+        "stnp q0, q1, [%0]\n\t"
+        "stnp q2, q3, [%0, #32]\n\t"
+        ::"r" (dest), "r" (src)
+        :"v0", "v1", "v2", "v3", "memory");
+    dest += 64;
+    src += 64;
+    len -= 64;
+  }
+
+  if (len)
+    memcpy (dest, src, len);
+}
+#endif
+
+#ifdef GST_OMX_VIDEO_COPY_NEON
+/* ARMv7 has no non-temporal store hint, but full 64 byte bursts are what
+ * write-combining buffers can merge best */
+static void
+copy_row_neon (guint8 * dest, const guint8 * src, gsize len)
+{
+  while (len >= 64) {
+    uint8x16_t q0, q1, q2, q3;
+
+    __builtin_prefetch (src + 256);
+    q0 = vld1q_u8 (src);
+    q1 = vld1q_u8 (src + 16);
+    q2 = vld1q_u8 (src + 32);
+    q3 = vld1q_u8 (src + 48);
+    vst1q_u8 (dest, q0);
+    vst1q_u8 (dest + 16, q1);
+    vst1q_u8 (dest + 32, q2);
+    vst1q_u8 (dest + 48, q3);
+    dest += 64;
+    src += 64;
+    len -= 64;
+  }
+
+  if (len)
+    memcpy (dest, src, len);
+}
+#endif
+
+#ifdef GST_OMX_VIDEO_COPY_SSE2
+static void
+copy_row_sse2_nt (guint8 * dest, const guint8 * src, gsize len)
+{
+  /* Streaming stores need an aligned destination */
+  while (len > 0 && ((guintptr) dest & 15)) {
+    *dest++ = *src++;
+    len--;
+  }
+
+  while (len >= 64) {
+    __m128i x0, x1, x2, x3;
+
+    x0 = _mm_loadu_si128 ((const __m128i *) src);
+    x1 = _mm_loadu_si128 ((const __m128i *) (src + 16));
+    x2 = _mm_loadu_si128 ((const __m128i *) (src + 32));
+    x3 = _mm_loadu_si128 ((const __m128i *) (src + 48));
+    _mm_stream_si128 ((__m128i *) dest, x0);
+    _mm_stream_si128 ((__m128i *) (dest + 16), x1);
+    _mm_stream_si128 ((__m128i *) (dest + 32), x2);
+    _mm_stream_si128 ((__m128i *) (dest + 48), x3);
+    dest += 64;
+    src += 64;
+    len -= 64;
+  }
+
+  if (len)
+    memcpy (dest, src, len);
+}
+#endif
+
+/* Row copy functions for cached and for uncached destinations, selected
+ * once for the CPU we are running on */
+static GstOMXVideoCopyRowFunc copy_row_cached = copy_row_scalar;
+static GstOMXVideoCopyRowFunc copy_row_uncached = copy_row_scalar;
+
+static void
+gst_omx_video_copy_init (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    const gchar *impl = "scalar";
+
+#if defined (GST_OMX_VIDEO_COPY_NEON_NT)
+    copy_row_uncached = copy_row_neon_nt;
+    impl = "neon";
+#elif defined (GST_OMX_VIDEO_COPY_NEON)
+#if defined (__linux__)
+    if (getauxval (AT_HWCAP) & HWCAP_NEON)
+#endif
+    {
+      copy_row_uncached = copy_row_neon;
+      impl = "neon";
+    }
+#elif defined (GST_OMX_VIDEO_COPY_SSE2)
+#if !defined (__x86_64__) && defined (__GNUC__)
+    if (__builtin_cpu_supports ("sse2"))
+#endif
+    {
+      copy_row_uncached = copy_row_sse2_nt;
+      impl = "sse2";
+    }
+#endif
+    GST_CAT_DEBUG (gst_omx_video_debug_category,
+        "Using %s plane copy for uncached destinations", impl);
+
+    g_once_init_leave (&initialized, 1);
+  }
+}
+
+/* Copies @height rows of @width bytes between two differently strided
+ * planes. This is used for all plane layouts (NV12, I420, NV16, YUY2, ...)
+ * when data is moved between OMX and GStreamer buffers. Set @uncached if
+ * @dest is not going to be read back by the CPU soon, e.g. OMX buffers
+ * which are usually uncached or write-combined */
+void
+gst_omx_video_copy_plane (guint8 * dest, gint dest_stride,
+    const guint8 * src, gint src_stride, gint width, gint height,
+    gboolean uncached)
+{
+  GstOMXVideoCopyRowFunc copy_row;
+  gint h;
+
+  if (width <= 0 || height <= 0)
+    return;
+
+  /* One copy for the whole plane if there is no padding between rows */
+  if (dest_stride == width && src_stride == width) {
+    width *= height;
+    height = 1;
+  }
+
+  gst_omx_video_copy_init ();
+  copy_row = uncached ? copy_row_uncached : copy_row_cached;
+
+  for (h = 0; h < height; h++) {
+    copy_row (dest, src, width);
+    dest += dest_stride;
+    src += src_stride;
+  }
+
+#ifdef GST_OMX_VIDEO_COPY_SSE2
+  /* Make the streaming stores globally visible before the buffer is
+   * handed to the component */
+  if (uncached && copy_row == copy_row_sse2_nt)
+    _mm_sfence ();
+#endif
+#ifdef GST_OMX_VIDEO_COPY_NEON_NT
+  /* Same for stnp, the component's hardware is no inner shareable
+   * observer, so wait for the stores to complete */
+  if (uncached && copy_row == copy_row_neon_nt)
+    __asm__ volatile ("dsb st":::"memory");
+#endif
+}
+
+/* Planes smaller than this are not worth waking up worker threads for,
+ * it is also the minimal amount of data copied by a stripe */
+#define GST_OMX_VIDEO_COPY_MIN_STRIPE_SIZE (512 * 1024)
+
+typedef struct
+{
+  GMutex lock;
+  GCond cond;
+  gint pending;
+} GstOMXVideoCopyJob;
+
+typedef struct
+{
+  GstOMXVideoCopyJob *job;
+  guint8 *dest;
+  const guint8 *src;
+  gint dest_stride, src_stride;
+  gint width, height;
+  gboolean uncached;
+} GstOMXVideoCopyStripe;
+
+static void
+gst_omx_video_copy_stripe_func (gpointer data, gpointer user_data)
+{
+  GstOMXVideoCopyStripe *stripe = data;
+  GstOMXVideoCopyJob *job = stripe->job;
+
+  gst_omx_video_copy_plane (stripe->dest, stripe->dest_stride, stripe->src,
+      stripe->src_stride, stripe->width, stripe->height, stripe->uncached);
+
+  g_mutex_lock (&job->lock);
+  if (--job->pending == 0)
+    g_cond_signal (&job->cond);
+  g_mutex_unlock (&job->lock);
+}
+
+/* One worker pool shared by all elements, limited to the number of CPU
+ * cores so that many streams copying at once don't oversubscribe them */
+static GThreadPool *
+gst_omx_video_copy_get_pool (void)
+{
+  static gsize pool = 0;
+
+  if (g_once_init_enter (&pool)) {
+    GThreadPool *tmp;
+    GError *err = NULL;
+
+    tmp = g_thread_pool_new (gst_omx_video_copy_stripe_func, NULL,
+        g_get_num_processors (), FALSE, &err);
+    if (!tmp) {
+      GST_CAT_WARNING (gst_omx_video_debug_category,
+          "Failed to create copy thread pool: %s", err->message);
+      g_clear_error (&err);
+    }
+
+    g_once_init_leave (&pool, (gsize) tmp);
+  }
+
+  return (GThreadPool *) pool;
+}
+
+/* Like gst_omx_video_copy_plane() but splits the plane into horizontal
+ * stripes copied by up to @n_threads threads, the calling thread being one
+ * of them. @n_threads 0 means one thread per CPU core */
+void
+gst_omx_video_copy_plane_threaded (guint8 * dest, gint dest_stride,
+    const guint8 * src, gint src_stride, gint width, gint height,
+    gboolean uncached, guint n_threads)
+{
+  GstOMXVideoCopyStripe stripes[GST_OMX_VIDEO_COPY_MAX_THREADS];
+  GstOMXVideoCopyJob job;
+  GThreadPool *pool;
+  guint n_stripes, i;
+  gint rows, y;
+
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+  n_threads = MIN (n_threads, GST_OMX_VIDEO_COPY_MAX_THREADS);
+
+  n_stripes = 1;
+  if (width > 0 && height > 0)
+    n_stripes = ((gsize) width * height) / GST_OMX_VIDEO_COPY_MIN_STRIPE_SIZE;
+  n_stripes = CLAMP (n_stripes, 1, MIN (n_threads, height));
+
+  if (n_stripes == 1 || !(pool = gst_omx_video_copy_get_pool ())) {
+    gst_omx_video_copy_plane (dest, dest_stride, src, src_stride, width,
+        height, uncached);
+    return;
+  }
+
+  g_mutex_init (&job.lock);
+  g_cond_init (&job.cond);
+
+  /* Rounding the rows up might leave fewer stripes, e.g. 100 rows in 16
+   * stripes of 7 rows are 15 stripes */
+  rows = (height + n_stripes - 1) / n_stripes;
+  n_stripes = (height + rows - 1) / rows;
+  job.pending = n_stripes - 1;
+  for (i = 0, y = 0; i < n_stripes; i++, y += rows) {
+    stripes[i].job = &job;
+    stripes[i].dest = dest + (gsize) y * dest_stride;
+    stripes[i].src = src + (gsize) y * src_stride;
+    stripes[i].dest_stride = dest_stride;
+    stripes[i].src_stride = src_stride;
+    stripes[i].width = width;
+    stripes[i].height = MIN (rows, height - y);
+    stripes[i].uncached = uncached;
+  }
+
+  /* The last stripe is copied by this thread while the workers do the
+   * others. A stripe that can't be queued is copied here as well */
+  for (i = 0; i < n_stripes - 1; i++) {
+    if (!g_thread_pool_push (pool, &stripes[i], NULL))
+      gst_omx_video_copy_stripe_func (&stripes[i], NULL);
+  }
+  gst_omx_video_copy_plane (stripes[i].dest, dest_stride, stripes[i].src,
+      src_stride, width, stripes[i].height, uncached);
+
+  g_mutex_lock (&job.lock);
+  while (job.pending > 0)
+    g_cond_wait (&job.cond, &job.lock);
+  g_mutex_unlock (&job.lock);
+
+  g_cond_clear (&job.cond);
+  g_mutex_clear (&job.lock);
+}
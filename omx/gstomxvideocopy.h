@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2011, Hewlett-Packard Development Company, L.P.
+ *   Author: Sebastian Dröge <sebastian.droege@collabora.co.uk>, Collabora Ltd.
+ * Copyright (C) 2013, Collabora Ltd.
+ *   Author: Sebastian Dröge <sebastian.droege@collabora.co.uk> *
+ * Copyright 2014 Advanced Micro Devices, Inc.
+ *   Author: Christian König <christian.koenig@amd.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_VIDEO_COPY_H__
+#define __GST_OMX_VIDEO_COPY_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Upper limit of threads copying a single plane */
+#define GST_OMX_VIDEO_COPY_MAX_THREADS (16)
+
+void
+gst_omx_video_copy_plane (guint8 * dest, gint dest_stride,
+    const guint8 * src, gint src_stride, gint width, gint height,
+    gboolean uncached);
+
+void
+gst_omx_video_copy_plane_threaded (guint8 * dest, gint dest_stride,
+    const guint8 * src, gint src_stride, gint width, gint height,
+    gboolean uncached, guint n_threads);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_VIDEO_COPY_H__ */
@@ -52,7 +52,6 @@
 #include "gstomxbufferpool.h"
 #include "gstomxvideo.h"
 #include "gstomxvideodec.h"
-#include "gstomxwmvdec.h"
 #ifdef HAVE_VIDEODEC_EXT
 #include "OMXR_Extension_vdcmn.h"
 #endif
@@ -77,9 +76,19 @@ static gboolean gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
 static gboolean gst_omx_video_dec_flush (GstVideoDecoder * decoder);
 static GstFlowReturn gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
     GstVideoCodecFrame * frame);
+static GstFlowReturn gst_omx_video_dec_feed_queued_frame (GstVideoCodecFrame *
+    frame, gpointer user_data);
+static GstFlowReturn gst_omx_video_dec_push_queued_frame (GstVideoCodecFrame *
+    frame, gpointer user_data);
+static void gst_omx_video_dec_release_queued_frame (GstVideoCodecFrame *
+    frame, gpointer user_data);
 static GstFlowReturn gst_omx_video_dec_finish (GstVideoDecoder * decoder);
 static gboolean gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec,
     GstQuery * query);
+static gboolean gst_omx_video_dec_propose_allocation (GstVideoDecoder *
+    decoder, GstQuery * query);
+static gboolean gst_omx_video_dec_sink_event (GstVideoDecoder * decoder,
+    GstEvent * event);
 
 static GstFlowReturn gst_omx_video_dec_drain (GstOMXVideoDec * self);
 
@@ -87,6 +96,12 @@ static OMX_ERRORTYPE gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec *
     self);
 static OMX_ERRORTYPE gst_omx_video_dec_deallocate_output_buffers (GstOMXVideoDec
     * self);
+static gboolean gst_omx_video_dec_is_droppable (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame);
+static gboolean gst_omx_video_dec_free_input_pool (GstOMXVideoDec * self,
+    GstClockTime timeout, gboolean locked);
+static GstFlowReturn gst_omx_video_dec_feed_frame (GstVideoDecoder * decoder,
+    GstVideoCodecFrame * frame);
 static void gst_omx_video_dec_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec);
 static void gst_omx_video_dec_get_property (GObject * object, guint prop_id,
@@ -98,7 +113,21 @@ enum
   PROP_NO_COPY,
   PROP_USE_DMABUF,
   PROP_NO_REORDER,
-  PROP_LOSSY_COMPRESS
+  PROP_LOSSY_COMPRESS,
+  PROP_COPY_THREADS,
+  PROP_SKIP_FRAMES,
+  PROP_MAX_WIDTH,
+  PROP_MAX_HEIGHT,
+  PROP_LOW_LATENCY,
+  PROP_PUSH_QUEUE_SIZE,
+  PROP_PUSH_QUEUE_LEVEL,
+  PROP_INPUT_QUEUE_SIZE,
+  PROP_MAX_INPUT_SIZE,
+  PROP_NO_COPY_INPUT,
+  PROP_AUTO_OUTPUT_BUFFERS,
+  PROP_MAX_OUTPUT_BUFFERS,
+  PROP_OUTPUT_MODE,
+  PROP_OUTPUT_MODE_REASON
 };
 
 /* class initialization */
@@ -111,9 +140,35 @@ enum
 G_DEFINE_ABSTRACT_TYPE_WITH_CODE (GstOMXVideoDec, gst_omx_video_dec,
     GST_TYPE_VIDEO_DECODER, DEBUG_INIT);
 
+#define GST_OMX_VIDEO_DEC_COPY_THREADS_DEFAULT (1)
+#define GST_OMX_VIDEO_DEC_PUSH_QUEUE_SIZE_DEFAULT (0)
+#define GST_OMX_VIDEO_DEC_PUSH_QUEUE_SIZE_MAX (64)
+#define GST_OMX_VIDEO_DEC_INPUT_QUEUE_SIZE_DEFAULT (0)
+#define GST_OMX_VIDEO_DEC_INPUT_QUEUE_SIZE_MAX (64)
+/* Input buffers are not grown beyond this for large frames */
+#define GST_OMX_VIDEO_DEC_INPUT_SIZE_LIMIT (16 * 1024 * 1024)
+#define GST_OMX_VIDEO_DEC_MAX_OUTPUT_BUFFERS_DEFAULT (16)
+#define GST_OMX_VIDEO_DEC_MAX_OUTPUT_BUFFERS_MAX (64)
+/* Output buffer tuning: number of decoded frames per period, percentage
+ * of frames without a free buffer that grows the buffers, and number of
+ * periods with buffers to spare that shrinks them */
+#define GST_OMX_VIDEO_DEC_TUNE_PERIOD (64)
+#define GST_OMX_VIDEO_DEC_TUNE_STALL_PERCENT (10)
+#define GST_OMX_VIDEO_DEC_TUNE_IDLE_PERIODS (4)
+
+#if GST_CHECK_VERSION (1, 6, 0)
+#define GST_OMX_VIDEO_DEC_SEGMENT_FLAG_KEY_UNITS \
+    GST_SEGMENT_FLAG_TRICKMODE_KEY_UNITS
+#else
+#define GST_OMX_VIDEO_DEC_SEGMENT_FLAG_KEY_UNITS GST_SEGMENT_FLAG_SKIP
+#endif
+
 /* Default fps for input files that does not support fps */
 #define DEFAULT_FRAME_PER_SECOND  30
 
+/* GST_CAPS_FEATURE_MEMORY_DMABUF is only in the headers since 1.12 */
+#define GST_OMX_VIDEO_DEC_CAPS_FEATURE_MEMORY_DMABUF "memory:DMABuf"
+
 static void
 gst_omx_video_dec_class_init (GstOMXVideoDecClass * klass)
 {
@@ -140,6 +195,12 @@ gst_omx_video_dec_class_init (GstOMXVideoDecClass * klass)
   video_decoder_class->finish = GST_DEBUG_FUNCPTR (gst_omx_video_dec_finish);
   video_decoder_class->decide_allocation =
       GST_DEBUG_FUNCPTR (gst_omx_video_dec_decide_allocation);
+  video_decoder_class->propose_allocation =
+      GST_DEBUG_FUNCPTR (gst_omx_video_dec_propose_allocation);
+  video_decoder_class->sink_event =
+      GST_DEBUG_FUNCPTR (gst_omx_video_dec_sink_event);
+
+  klass->is_droppable = GST_DEBUG_FUNCPTR (gst_omx_video_dec_is_droppable);
 
   klass->cdata.type = GST_OMX_COMPONENT_TYPE_FILTER;
   klass->cdata.default_src_template_caps =
@@ -171,6 +232,94 @@ gst_omx_video_dec_class_init (GstOMXVideoDecClass * klass)
           "Whether or not to use lossy image compression function",
           FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
           GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_COPY_THREADS,
+      g_param_spec_uint ("copy-threads", "Copy threads",
+          "Number of threads copying decoded frames in copy mode "
+          "(0=one per CPU core)",
+          0, GST_OMX_VIDEO_COPY_MAX_THREADS,
+          GST_OMX_VIDEO_DEC_COPY_THREADS_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property (gobject_class, PROP_SKIP_FRAMES,
+      g_param_spec_boolean ("skip-frames", "Skip frames",
+          "Whether or not to skip decoding late non-reference frames and "
+          "outputting frames before the segment start",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property (gobject_class, PROP_MAX_WIDTH,
+      g_param_spec_uint ("max-width", "Maximum width",
+          "Largest width of the stream, enables resolution switches without "
+          "reconfiguring the component together with max-height (0=disabled)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_MAX_HEIGHT,
+      g_param_spec_uint ("max-height", "Maximum height",
+          "Largest height of the stream, enables resolution switches without "
+          "reconfiguring the component together with max-width (0=disabled)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_LOW_LATENCY,
+      g_param_spec_boolean ("low-latency", "Low latency",
+          "Whether or not to use as few buffers as possible and to not wait "
+          "for reordering of streams without reordering",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_PUSH_QUEUE_SIZE,
+      g_param_spec_uint ("push-queue-size", "Push queue size",
+          "Number of decoded frames queued for pushing them downstream from "
+          "a separate thread (0=push from the output thread)",
+          0, GST_OMX_VIDEO_DEC_PUSH_QUEUE_SIZE_MAX,
+          GST_OMX_VIDEO_DEC_PUSH_QUEUE_SIZE_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_PUSH_QUEUE_LEVEL,
+      g_param_spec_uint ("push-queue-level", "Push queue level",
+          "Number of decoded frames currently waiting to be pushed",
+          0, GST_OMX_VIDEO_DEC_PUSH_QUEUE_SIZE_MAX, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_INPUT_QUEUE_SIZE,
+      g_param_spec_uint ("input-queue-size", "Input queue size",
+          "Number of input frames queued for passing them to the component "
+          "from a separate thread (0=pass from the upstream thread)",
+          0, GST_OMX_VIDEO_DEC_INPUT_QUEUE_SIZE_MAX,
+          GST_OMX_VIDEO_DEC_INPUT_QUEUE_SIZE_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_MAX_INPUT_SIZE,
+      g_param_spec_uint ("max-input-size", "Maximum input size",
+          "Size of the largest input frame in bytes, input buffers are "
+          "allocated for it (0=component default)",
+          0, GST_OMX_VIDEO_DEC_INPUT_SIZE_LIMIT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_NO_COPY_INPUT,
+      g_param_spec_boolean ("no-copy-input", "No copy input",
+          "Whether or not to propose the input buffers of the component to "
+          "upstream to pass the input without copy",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_AUTO_OUTPUT_BUFFERS,
+      g_param_spec_boolean ("auto-output-buffers", "Auto output buffers",
+          "Whether or not to adapt the number of output buffers to how many "
+          "of them downstream holds, up to max-output-buffers",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_MAX_OUTPUT_BUFFERS,
+      g_param_spec_uint ("max-output-buffers", "Maximum output buffers",
+          "Largest number of output buffers auto-output-buffers may use",
+          1, GST_OMX_VIDEO_DEC_MAX_OUTPUT_BUFFERS_MAX,
+          GST_OMX_VIDEO_DEC_MAX_OUTPUT_BUFFERS_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_OUTPUT_MODE,
+      g_param_spec_string ("output-mode", "Output mode",
+          "How decoded data is transferred downstream "
+          "(copy, no-copy or dmabuf)",
+          NULL, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_OUTPUT_MODE_REASON,
+      g_param_spec_string ("output-mode-reason", "Output mode reason",
+          "Why the current output mode is used",
+          NULL, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
 }
 
@@ -181,13 +330,34 @@ gst_omx_video_dec_init (GstOMXVideoDec * self)
 
   g_mutex_init (&self->drain_lock);
   g_cond_init (&self->drain_cond);
+  g_queue_init (&self->held_nals);
   self->no_copy = FALSE;
+  self->no_copy_input = FALSE;
 #ifdef HAVE_MMNGRBUF
   self->use_dmabuf = TRUE;
 #endif
   self->no_reorder = FALSE;
   self->lossy_compress = FALSE;
+  self->low_latency = FALSE;
+  self->reorder = TRUE;
+  self->skip_frames = FALSE;
+  gst_omx_bitstream_init (&self->bitstream);
+  self->frame_index =
+      gst_omx_video_frame_index_new (GST_ELEMENT_CAST (self));
+  self->copy_threads = GST_OMX_VIDEO_DEC_COPY_THREADS_DEFAULT;
+  self->auto_output_buffers = FALSE;
+  self->max_output_buffers = GST_OMX_VIDEO_DEC_MAX_OUTPUT_BUFFERS_DEFAULT;
+  self->push_queue_size = GST_OMX_VIDEO_DEC_PUSH_QUEUE_SIZE_DEFAULT;
+  self->push_queue = gst_omx_video_frame_queue_new ("omxvideodec-push",
+      gst_omx_video_dec_push_queued_frame,
+      gst_omx_video_dec_release_queued_frame, self);
+  self->input_queue_size = GST_OMX_VIDEO_DEC_INPUT_QUEUE_SIZE_DEFAULT;
+  self->input_queue = gst_omx_video_frame_queue_new ("omxvideodec-in",
+      gst_omx_video_dec_feed_queued_frame,
+      gst_omx_video_dec_release_queued_frame, self);
   self->has_set_property = FALSE;
+  self->auto_output_mode = FALSE;
+  self->output_mode_reason = "default";
 }
 
 static gboolean
@@ -292,7 +462,13 @@ gst_omx_video_dec_open (GstVideoDecoder * decoder)
   GST_DEBUG_OBJECT (self, "Opened EGL renderer");
 #endif
 
-  /* Use hacks to choose default mode, normally default mode is dmabuf */
+  /* Without properties or hacks the mode is chosen from what downstream
+   * answers to the allocation query, normally default mode is dmabuf */
+  self->auto_output_mode = !self->has_set_property;
+  self->output_mode_reason =
+      self->has_set_property ? "set by property" : "not negotiated yet";
+
+  /* Use hacks to choose default mode */
   if (!(klass->cdata.hacks & GST_OMX_HACK_USE_COPY_MODE_AS_DEFAULT &&
           klass->cdata.hacks & GST_OMX_HACK_USE_NO_COPY_MODE_AS_DEFAULT) &&
       (!self->has_set_property)) {
@@ -300,11 +476,15 @@ gst_omx_video_dec_open (GstVideoDecoder * decoder)
       GST_DEBUG_OBJECT (self, "Use copy mode as default");
       self->no_copy = FALSE;
       self->use_dmabuf = FALSE;
+      self->auto_output_mode = FALSE;
+      self->output_mode_reason = "set by hacks";
     }
     if (klass->cdata.hacks & GST_OMX_HACK_USE_NO_COPY_MODE_AS_DEFAULT) {
       GST_DEBUG_OBJECT (self, "Use no-copy mode as default");
       self->no_copy = TRUE;
       self->use_dmabuf = FALSE;
+      self->auto_output_mode = FALSE;
+      self->output_mode_reason = "set by hacks";
     }
   } else
     GST_DEBUG_OBJECT (self,
@@ -320,6 +500,20 @@ gst_omx_video_dec_shutdown (GstOMXVideoDec * self)
 
   GST_DEBUG_OBJECT (self, "Shutting down decoder");
 
+  /* Upstream is shut down already, so it should not hold any buffers
+   * anymore. The port buffers are freed in any case, the ones still in
+   * use must not be returned to the port later */
+  if (!gst_omx_video_dec_free_input_pool (self, 1 * GST_SECOND, FALSE)) {
+    GList *l;
+
+    for (l = self->old_in_port_pools; l; l = l->next) {
+      GST_OMX_BUFFER_POOL (l->data)->deactivated = TRUE;
+      gst_omx_buffer_pool_return_input_buffers (l->data);
+    }
+    g_list_free_full (self->old_in_port_pools, gst_object_unref);
+    self->old_in_port_pools = NULL;
+  }
+
 #if defined (USE_OMX_TARGET_RPI) && defined (HAVE_GST_GL)
   state = gst_omx_component_get_state (self->egl_render, 0);
   if (state > OMX_StateLoaded || state == OMX_StateInvalid) {
@@ -399,6 +593,10 @@ gst_omx_video_dec_finalize (GObject * object)
 
   g_mutex_clear (&self->drain_lock);
   g_cond_clear (&self->drain_cond);
+  gst_omx_video_frame_queue_free (self->push_queue);
+  gst_omx_video_frame_queue_free (self->input_queue);
+  gst_omx_video_frame_index_free (self->frame_index);
+  gst_omx_bitstream_clear (&self->bitstream);
 
   G_OBJECT_CLASS (gst_omx_video_dec_parent_class)->finalize (object);
 }
@@ -420,10 +618,13 @@ gst_omx_video_dec_change_state (GstElement * element, GstStateChange transition)
       self->downstream_flow_ret = GST_FLOW_OK;
       self->draining = FALSE;
       self->started = FALSE;
+      gst_omx_video_frame_queue_set_flushing (self->input_queue, FALSE);
+      gst_omx_video_frame_queue_set_flushing (self->push_queue, FALSE);
       break;
     case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
       break;
     case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_omx_video_frame_queue_set_flushing (self->input_queue, TRUE);
       if (self->dec_in_port)
         gst_omx_port_set_flushing (self->dec_in_port, 5 * GST_SECOND, TRUE);
       if (self->dec_out_port)
@@ -460,6 +661,7 @@ gst_omx_video_dec_change_state (GstElement * element, GstStateChange transition)
     case GST_STATE_CHANGE_PAUSED_TO_READY:
       self->downstream_flow_ret = GST_FLOW_FLUSHING;
       self->started = FALSE;
+      gst_omx_video_frame_queue_stop (self->input_queue);
 
       if (!gst_omx_video_dec_shutdown (self))
         ret = GST_STATE_CHANGE_FAILURE;
@@ -484,11 +686,10 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self,
   gboolean ret = FALSE;
   GstVideoFrame frame;
 
-  if (vinfo->width != port_def->format.video.nFrameWidth ||
-      vinfo->height != port_def->format.video.nFrameHeight) {
+  if (vinfo->width != self->crop.nWidth
+      || vinfo->height != self->crop.nHeight) {
     GST_ERROR_OBJECT (self, "Resolution do not match: port=%ux%u vinfo=%dx%d",
-        (guint) port_def->format.video.nFrameWidth,
-        (guint) port_def->format.video.nFrameHeight,
+        (guint) self->crop.nWidth, (guint) self->crop.nHeight,
         vinfo->width, vinfo->height);
     goto done;
   }
@@ -505,10 +706,12 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self,
   if (gst_video_frame_map (&frame, vinfo, outbuf, GST_MAP_WRITE)) {
     const guint nstride = port_def->format.video.nStride;
     const guint nslice = port_def->format.video.nSliceHeight;
-    guint src_stride[GST_VIDEO_MAX_PLANES] = { 0, };
+    gint src_stride[GST_VIDEO_MAX_PLANES] = { 0, };
+    gsize src_offset[GST_VIDEO_MAX_PLANES] = { 0, };
     guint src_size[GST_VIDEO_MAX_PLANES] = { 0, };
     gint dst_width[GST_VIDEO_MAX_PLANES] = { 0, };
     gint dst_height[GST_VIDEO_MAX_PLANES] = { 0, };
+    const guint n_threads = g_atomic_int_get (&self->copy_threads);
     const guint8 *src;
     guint p;
 
@@ -556,24 +759,45 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self,
         dst_width[1] = GST_VIDEO_INFO_WIDTH (vinfo);
         dst_height[1] = GST_VIDEO_INFO_HEIGHT (vinfo);
         break;
+#if GST_CHECK_VERSION (1, 10, 0)
+      case GST_VIDEO_FORMAT_P010_10LE:
+#endif
+#if GST_CHECK_VERSION (1, 14, 0)
+      case GST_VIDEO_FORMAT_NV12_10LE32:
+#endif
+        /* 10 bit samples with the layout of NV12 */
+        dst_width[0] = gst_omx_video_get_row_bytes (vinfo->finfo, 0,
+            GST_VIDEO_INFO_WIDTH (vinfo));
+        src_stride[1] = nstride;
+        src_size[1] = src_stride[1] * nslice / 2;
+        dst_width[1] = gst_omx_video_get_row_bytes (vinfo->finfo, 1,
+            GST_VIDEO_INFO_WIDTH (vinfo));
+        dst_height[1] = GST_VIDEO_INFO_HEIGHT (vinfo) / 2;
+        break;
+#if GST_CHECK_VERSION (1, 14, 0)
+      case GST_VIDEO_FORMAT_NV16_10LE32:
+        dst_width[0] = gst_omx_video_get_row_bytes (vinfo->finfo, 0,
+            GST_VIDEO_INFO_WIDTH (vinfo));
+        src_stride[1] = nstride;
+        src_size[1] = src_stride[1] * nslice;
+        dst_width[1] = dst_width[0];
+        dst_height[1] = GST_VIDEO_INFO_HEIGHT (vinfo);
+        break;
+#endif
       default:
         g_assert_not_reached ();
         break;
     }
 
+    /* Only the visible area is copied */
+    gst_omx_video_offset_planes (vinfo->finfo, self->crop.nLeft,
+        self->crop.nTop, src_stride, src_offset);
+
     src = inbuf->omx_buf->pBuffer + inbuf->omx_buf->nOffset;
     for (p = 0; p < GST_VIDEO_INFO_N_PLANES (vinfo); p++) {
-      const guint8 *data;
-      guint8 *dst;
-      guint h;
-
-      dst = GST_VIDEO_FRAME_PLANE_DATA (&frame, p);
-      data = src;
-      for (h = 0; h < dst_height[p]; h++) {
-        memcpy (dst, data, dst_width[p]);
-        dst += GST_VIDEO_FRAME_PLANE_STRIDE (&frame, p);
-        data += src_stride[p];
-      }
+      gst_omx_video_copy_plane_threaded (GST_VIDEO_FRAME_PLANE_DATA (&frame,
+              p), GST_VIDEO_FRAME_PLANE_STRIDE (&frame, p), src + src_offset[p],
+          src_stride[p], dst_width[p], dst_height[p], FALSE, n_threads);
       src += src_size[p];
       GST_DEBUG_OBJECT (self, "Finished copying plane with stride = %d",
           GST_VIDEO_FRAME_PLANE_STRIDE (&frame, p));
@@ -619,6 +843,128 @@ done:
   return ret;
 }
 
+/* Reads the visible area of the frames on the output port described by
+ * @port_def from the component */
+static void
+gst_omx_video_dec_update_crop (GstOMXVideoDec * self,
+    OMX_PARAM_PORTDEFINITIONTYPE * port_def)
+{
+  OMX_CONFIG_RECTTYPE crop;
+  OMX_ERRORTYPE err;
+
+  GST_OMX_INIT_STRUCT (&crop);
+  crop.nPortIndex = self->dec_out_port->index;
+  err = gst_omx_component_get_config (self->dec,
+      OMX_IndexConfigCommonOutputCrop, &crop);
+
+  /* Not every component reports it, the whole frame is visible then */
+  if (err != OMX_ErrorNone || crop.nWidth == 0 || crop.nHeight == 0
+      || crop.nLeft < 0 || crop.nTop < 0
+      || crop.nLeft + crop.nWidth > port_def->format.video.nFrameWidth
+      || crop.nTop + crop.nHeight > port_def->format.video.nFrameHeight) {
+    crop.nLeft = 0;
+    crop.nTop = 0;
+    crop.nWidth = port_def->format.video.nFrameWidth;
+    crop.nHeight = port_def->format.video.nFrameHeight;
+  } else if (crop.nWidth != port_def->format.video.nFrameWidth
+      || crop.nHeight != port_def->format.video.nFrameHeight) {
+    GST_DEBUG_OBJECT (self, "Visible area %ux%u at %d,%d of %ux%u frames",
+        (guint) crop.nWidth, (guint) crop.nHeight, (gint) crop.nLeft,
+        (gint) crop.nTop, (guint) port_def->format.video.nFrameWidth,
+        (guint) port_def->format.video.nFrameHeight);
+  }
+
+  self->crop = crop;
+}
+
+/* Tells out_port_pool how to describe the visible area, called before
+ * it allocates its buffers */
+static void
+gst_omx_video_dec_set_pool_crop (GstOMXVideoDec * self)
+{
+  GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (self->out_port_pool);
+
+  pool->crop = self->crop;
+  pool->add_cropmeta = self->downstream_cropmeta;
+}
+
+/* Sets the padding of the OMX output buffers around the visible area as
+ * video alignment in the buffer pool @config */
+static void
+gst_omx_video_dec_set_pool_alignment (GstOMXVideoDec * self,
+    GstStructure * config)
+{
+  OMX_VIDEO_PORTDEFINITIONTYPE *video =
+      &self->dec_out_port->port_def.format.video;
+  GstVideoCodecState *state =
+      gst_video_decoder_get_output_state (GST_VIDEO_DECODER (self));
+  GstVideoAlignment align;
+  guint width;
+
+  if (!state)
+    return;
+  width = gst_omx_video_get_row_width (state->info.finfo, video->nStride);
+  gst_video_codec_state_unref (state);
+
+  gst_video_alignment_reset (&align);
+  align.padding_top = self->crop.nTop;
+  align.padding_left = self->crop.nLeft;
+  if (width > self->crop.nLeft + self->crop.nWidth)
+    align.padding_right = width - self->crop.nLeft - self->crop.nWidth;
+  if (video->nSliceHeight > self->crop.nTop + self->crop.nHeight)
+    align.padding_bottom =
+        video->nSliceHeight - self->crop.nTop - self->crop.nHeight;
+
+  gst_buffer_pool_config_add_option (config,
+      GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT);
+  gst_buffer_pool_config_set_video_alignment (config, &align);
+}
+
+/* Returns how many of the @wanted buffers of @port fit into the memory
+ * budget, but at least the minimum the component needs */
+static guint
+gst_omx_video_dec_fit_memory_budget (GstOMXVideoDec * self, GstOMXPort * port,
+    guint wanted)
+{
+  guint64 available = gst_omx_memory_get_available ();
+  guint64 size = port->port_def.nBufferSize;
+  guint n;
+
+  if (size == 0 || size * wanted <= available)
+    return wanted;
+
+  n = MAX (available / size, port->port_def.nBufferCountMin);
+  GST_WARNING_OBJECT (self, "Only %u of %u output buffers fit into the "
+      "memory budget", n, wanted);
+
+  return MIN (n, wanted);
+}
+
+#ifdef HAVE_VIDEODEC_EXT
+/* Whether uncompressed output buffers for @state would exceed the memory
+ * budget */
+static gboolean
+gst_omx_video_dec_is_memory_tight (GstOMXVideoDec * self,
+    GstVideoCodecState * state)
+{
+  guint64 available = gst_omx_memory_get_available ();
+  guint64 frame_size;
+  guint n;
+
+  if (available == G_MAXUINT64)
+    return FALSE;
+
+  /* The alignment and format of the component aren't known yet, assume
+   * 8 bit 4:2:0 */
+  frame_size = (guint64) GST_VIDEO_INFO_WIDTH (&state->info) *
+      GST_VIDEO_INFO_HEIGHT (&state->info) * 3 / 2;
+  n = MAX (self->dec_out_port->port_def.nBufferCountMin,
+      self->output_buffers > 0 ? self->output_buffers : 4);
+
+  return frame_size * n > available;
+}
+#endif
+
 static OMX_ERRORTYPE
 gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec * self)
 {
@@ -656,8 +1002,16 @@ gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec * self)
       goto done;
     }
 
-    /* Need at least 2 buffers for anything meaningful */
-    min = MAX (MAX (min, port->port_def.nBufferCountMin), 4);
+    /* Need at least 2 buffers for anything meaningful, keyframes only
+     * don't need any for reordering and low latency uses as few as
+     * possible */
+    if (self->key_unit_trickmode || self->low_latency)
+      min = MAX (min, port->port_def.nBufferCountMin);
+    else if (self->output_buffers > 0)
+      min = MAX (MAX (min, port->port_def.nBufferCountMin),
+          self->output_buffers);
+    else
+      min = MAX (MAX (min, port->port_def.nBufferCountMin), 4);
     if (max == 0) {
       max = min;
     } else if (max < port->port_def.nBufferCountMin || max < 2) {
@@ -838,6 +1192,9 @@ gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec * self)
   if (!eglimage) {
     gboolean was_enabled = TRUE;
 
+    /* Fewer buffers are better than failing the allocation */
+    min = gst_omx_video_dec_fit_memory_budget (self, port, min);
+
     if (min != port->port_def.nBufferCountActual) {
       err = gst_omx_port_update_port_definition (port, NULL);
       if (err == OMX_ErrorNone) {
@@ -940,6 +1297,7 @@ gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec * self)
       goto done;
     }
 
+    gst_omx_video_dec_set_pool_crop (self);
     GST_OMX_BUFFER_POOL (self->out_port_pool)->allocating = TRUE;
     /* This now allocates all the buffers */
     if (!gst_buffer_pool_set_active (self->out_port_pool, TRUE)) {
@@ -969,11 +1327,87 @@ done:
   return err;
 }
 
+static void
+gst_omx_video_dec_free_copy_pool (GstOMXVideoDec * self)
+{
+  if (self->copy_pool) {
+    gst_buffer_pool_set_active (self->copy_pool, FALSE);
+    gst_object_unref (self->copy_pool);
+    self->copy_pool = NULL;
+  }
+}
+
+/* Takes back the input buffers proposed to upstream, must be called
+ * before the input port buffers are freed. Upstream is asked to query
+ * for a new pool then. Their memory is the one of the OMX buffers, so
+ * this waits up to @timeout until upstream released all of them. If the
+ * stream lock is @locked it is released meanwhile.
+ *
+ * Returns FALSE if some are still in use. Their OMX buffers are returned
+ * to the port once they are released then, the port buffers must not be
+ * freed before another call succeeded */
+static gboolean
+gst_omx_video_dec_free_input_pool (GstOMXVideoDec * self,
+    GstClockTime timeout, gboolean locked)
+{
+  gboolean ret = TRUE;
+  GList *l;
+
+  if (self->in_port_pool) {
+    gst_buffer_pool_set_active (self->in_port_pool, FALSE);
+    self->old_in_port_pools =
+        g_list_prepend (self->old_in_port_pools, self->in_port_pool);
+    self->in_port_pool = NULL;
+
+    gst_pad_push_event (GST_VIDEO_DECODER_SINK_PAD (self),
+        gst_event_new_reconfigure ());
+  }
+
+  if (!self->old_in_port_pools)
+    return TRUE;
+
+  if (locked)
+    GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+  for (l = self->old_in_port_pools; l && ret; l = l->next)
+    ret = gst_omx_buffer_pool_wait_input_buffers (l->data, timeout);
+  if (locked)
+    GST_VIDEO_DECODER_STREAM_LOCK (self);
+
+  if (!ret) {
+    GST_WARNING_OBJECT (self, "Upstream still holds input buffers");
+    return FALSE;
+  }
+
+  for (l = self->old_in_port_pools; l; l = l->next)
+    GST_OMX_BUFFER_POOL (l->data)->deactivated = TRUE;
+  g_list_free_full (self->old_in_port_pools, gst_object_unref);
+  self->old_in_port_pools = NULL;
+
+  return TRUE;
+}
+
+/* Replaces the input buffer of @frame, which might be one of in_port_pool,
+ * by one with the metadata only after its data was passed to the component.
+ * This way pending frames don't keep the pool buffers in use */
+static void
+gst_omx_video_dec_drop_input_data (GstVideoCodecFrame * frame)
+{
+  GstBuffer *input_buffer = gst_buffer_new ();
+
+  gst_buffer_copy_into (input_buffer, frame->input_buffer,
+      GST_BUFFER_COPY_METADATA, 0, -1);
+  gst_buffer_unref (frame->input_buffer);
+  frame->input_buffer = input_buffer;
+}
+
 static OMX_ERRORTYPE
 gst_omx_video_dec_deallocate_output_buffers (GstOMXVideoDec * self)
 {
   OMX_ERRORTYPE err;
 
+  /* The copy destinations follow the output configuration */
+  gst_omx_video_dec_free_copy_pool (self);
+
   if (self->out_port_pool) {
     gst_buffer_pool_set_active (self->out_port_pool, FALSE);
 #if 0
@@ -997,6 +1431,7 @@ gst_omx_video_dec_deallocate_output_buffers (GstOMXVideoDec * self)
 static OMX_ERRORTYPE
 gst_omx_video_dec_reconfigure_output_port (GstOMXVideoDec * self)
 {
+  GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
   GstOMXPort *port;
   OMX_ERRORTYPE err;
   GstVideoCodecState *state;
@@ -1192,7 +1627,8 @@ gst_omx_video_dec_reconfigure_output_port (GstOMXVideoDec * self)
   g_assert (port_def.format.video.eCompressionFormat == OMX_VIDEO_CodingUnused);
 
   format =
-      gst_omx_video_get_format_from_omx (port_def.format.video.eColorFormat);
+      gst_omx_video_get_format_from_omx (port_def.format.video.eColorFormat,
+      klass->cdata.vendor_formats);
 
   if (format == GST_VIDEO_FORMAT_UNKNOWN) {
     GST_ERROR_OBJECT (self, "Unsupported color format: %d",
@@ -1209,9 +1645,9 @@ gst_omx_video_dec_reconfigure_output_port (GstOMXVideoDec * self)
       (guint) port_def.format.video.nFrameWidth,
       (guint) port_def.format.video.nFrameHeight);
 
+  gst_omx_video_dec_update_crop (self, &port_def);
   state = gst_video_decoder_set_output_state (GST_VIDEO_DECODER (self),
-      format, port_def.format.video.nFrameWidth,
-      port_def.format.video.nFrameHeight, self->input_state);
+      format, self->crop.nWidth, self->crop.nHeight, self->input_state);
 
   if (!gst_video_decoder_negotiate (GST_VIDEO_DECODER (self))) {
     gst_video_codec_state_unref (state);
@@ -1247,9 +1683,9 @@ done:
 
 static void
 gst_omx_video_dec_clean_older_frames (GstOMXVideoDec * self,
-    GstOMXBuffer * buf, GList * frames)
+    GstOMXBuffer * buf)
 {
-  GList *l;
+  GList *frames, *l;
   GstClockTime timestamp;
 
   timestamp = gst_util_uint64_scale (buf->omx_buf->nTimeStamp, GST_SECOND,
@@ -1258,26 +1694,26 @@ gst_omx_video_dec_clean_older_frames (GstOMXVideoDec * self,
   if (GST_CLOCK_TIME_IS_VALID (timestamp)) {
     /* We could release all frames stored with pts < timestamp since the
      * decoder will likely output frames in display order */
+    frames = gst_omx_video_frame_index_take_older (self->frame_index,
+        buf->omx_buf->nTimeStamp);
     for (l = frames; l; l = l->next) {
       GstVideoCodecFrame *tmp = l->data;
 
-      if (tmp->pts < timestamp) {
-        gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), tmp);
-        GST_LOG_OBJECT (self,
-            "discarding ghost frame %p (#%d) PTS:%" GST_TIME_FORMAT " DTS:%"
-            GST_TIME_FORMAT, tmp, tmp->system_frame_number,
-            GST_TIME_ARGS (tmp->pts), GST_TIME_ARGS (tmp->dts));
-      } else {
-        gst_video_codec_frame_unref (tmp);
-      }
+      GST_LOG_OBJECT (self,
+          "discarding ghost frame %p (#%d) PTS:%" GST_TIME_FORMAT " DTS:%"
+          GST_TIME_FORMAT, tmp, tmp->system_frame_number,
+          GST_TIME_ARGS (tmp->pts), GST_TIME_ARGS (tmp->dts));
+      gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), tmp);
     }
   } else {
     /* We will release all frames with invalid timestamp because we don't even
      * know if they will be output some day. */
+    frames = gst_video_decoder_get_frames (GST_VIDEO_DECODER (self));
     for (l = frames; l; l = l->next) {
       GstVideoCodecFrame *tmp = l->data;
 
       if (!GST_CLOCK_TIME_IS_VALID (tmp->pts)) {
+        gst_omx_video_frame_index_remove (self->frame_index, tmp);
         gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), tmp);
         GST_LOG_OBJECT (self,
             "discarding frame %p (#%d) with invalid PTS:%" GST_TIME_FORMAT
@@ -1292,122 +1728,543 @@ gst_omx_video_dec_clean_older_frames (GstOMXVideoDec * self,
   g_list_free (frames);
 }
 
+static gboolean
+gst_omx_video_dec_configure_copy_pool (GstOMXVideoDec * self,
+    GstBufferPool * pool, const GstVideoInfo * info)
+{
+  GstStructure *config;
+  GstCaps *caps;
+
+  caps = gst_video_info_to_caps ((GstVideoInfo *) info);
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, info->size, 2, 0);
+  gst_caps_unref (caps);
+
+  if (!gst_buffer_pool_set_config (pool, config))
+    return FALSE;
+
+  return gst_buffer_pool_set_active (pool, TRUE);
+}
+
+static gboolean
+gst_omx_video_dec_activate_copy_pool (GstOMXVideoDec * self,
+    const GstVideoInfo * info)
+{
+  if (self->copy_pool && gst_buffer_pool_is_active (self->copy_pool)) {
+    GstStructure *config = gst_buffer_pool_get_config (self->copy_pool);
+    GstCaps *caps = NULL;
+    GstVideoInfo pool_info;
+    gboolean same;
+
+    /* The pool is kept over adaptive resolution changes */
+    same = gst_buffer_pool_config_get_params (config, &caps, NULL, NULL, NULL)
+        && caps && gst_video_info_from_caps (&pool_info, caps)
+        && gst_video_info_is_equal (&pool_info, info);
+    gst_structure_free (config);
+    if (same)
+      return TRUE;
+
+    GST_DEBUG_OBJECT (self, "Reconfiguring copy pool for the new format");
+    gst_buffer_pool_set_active (self->copy_pool, FALSE);
+  }
+
+  if (self->copy_pool
+      && gst_omx_video_dec_configure_copy_pool (self, self->copy_pool, info))
+    return TRUE;
+
+  if (self->copy_pool) {
+    GST_DEBUG_OBJECT (self, "Downstream pool %" GST_PTR_FORMAT
+        " can't be used for copies, using our own", self->copy_pool);
+    gst_object_unref (self->copy_pool);
+  }
+
+  self->copy_pool = gst_video_buffer_pool_new ();
+  if (!gst_omx_video_dec_configure_copy_pool (self, self->copy_pool, info)) {
+    GST_WARNING_OBJECT (self, "Failed to activate copy pool");
+    gst_object_unref (self->copy_pool);
+    self->copy_pool = NULL;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Copies @outbuf into a buffer of copy_pool and unrefs it. Returns NULL
+ * if the frame can't be copied */
 static GstBuffer *
-copy_frame (const GstVideoInfo * info, GstBuffer * outbuf)
+copy_frame (GstOMXVideoDec * self, const GstVideoInfo * info,
+    GstBuffer * outbuf)
 {
   GstVideoInfo out_info, tmp_info;
-  GstBuffer *tmpbuf;
+  GstBuffer *tmpbuf = NULL;
   GstVideoFrame out_frame, tmp_frame;
+  const GstVideoFormatInfo *finfo;
+  gboolean done[GST_VIDEO_MAX_PLANES] = { FALSE, };
+  guint n_threads, i;
 
   out_info = *info;
   tmp_info = *info;
 
-  tmpbuf = gst_buffer_new_and_alloc (out_info.size);
+  if (gst_omx_video_dec_activate_copy_pool (self, info)
+      && gst_buffer_pool_acquire_buffer (self->copy_pool, &tmpbuf,
+          NULL) != GST_FLOW_OK)
+    tmpbuf = NULL;
 
-  gst_video_frame_map (&out_frame, &out_info, outbuf, GST_MAP_READ);
-  gst_video_frame_map (&tmp_frame, &tmp_info, tmpbuf, GST_MAP_WRITE);
-  gst_video_frame_copy (&tmp_frame, &out_frame);
-  gst_video_frame_unmap (&out_frame);
+  if (!tmpbuf)
+    tmpbuf = gst_buffer_new_and_alloc (out_info.size);
+
+  if (!gst_video_frame_map (&out_frame, &out_info, outbuf, GST_MAP_READ)) {
+    GST_ERROR_OBJECT (self, "Failed to map the output buffer for copying");
+    goto error;
+  }
+  if (!gst_video_frame_map (&tmp_frame, &tmp_info, tmpbuf, GST_MAP_WRITE)) {
+    GST_ERROR_OBJECT (self, "Failed to map the buffer to copy into");
+    gst_video_frame_unmap (&out_frame);
+    goto error;
+  }
+
+  finfo = out_info.finfo;
+  n_threads = g_atomic_int_get (&self->copy_threads);
+
+  /* Like gst_video_frame_copy(), with copy-threads threads per plane */
+  for (i = 0; i < GST_VIDEO_FORMAT_INFO_N_COMPONENTS (finfo); i++) {
+    guint p = GST_VIDEO_FORMAT_INFO_PLANE (finfo, i);
+
+    if (done[p])
+      continue;
+    done[p] = TRUE;
+
+    gst_omx_video_copy_plane_threaded (GST_VIDEO_FRAME_PLANE_DATA
+        (&tmp_frame, p), GST_VIDEO_FRAME_PLANE_STRIDE (&tmp_frame, p),
+        GST_VIDEO_FRAME_PLANE_DATA (&out_frame, p),
+        GST_VIDEO_FRAME_PLANE_STRIDE (&out_frame, p),
+        gst_omx_video_get_row_bytes (finfo, i,
+            GST_VIDEO_FRAME_WIDTH (&out_frame)),
+        GST_VIDEO_FRAME_COMP_HEIGHT (&out_frame, i), FALSE, n_threads);
+  }
   gst_video_frame_unmap (&tmp_frame);
+  gst_video_frame_unmap (&out_frame);
 
   gst_buffer_unref (outbuf);
 
   return tmpbuf;
+
+error:
+  gst_buffer_unref (tmpbuf);
+  gst_buffer_unref (outbuf);
+
+  return NULL;
 }
 
-static void
-gst_omx_video_dec_loop (GstOMXVideoDec * self)
+static gboolean
+gst_omx_video_dec_is_adaptive (GstOMXVideoDec * self)
 {
-  GstOMXPort *port;
-  GstOMXBuffer *buf = NULL;
-  GstVideoCodecFrame *frame;
-  GstFlowReturn flow_ret = GST_FLOW_OK;
-  GstOMXAcquireBufferReturn acq_return;
-  GstClockTimeDiff deadline;
-  OMX_ERRORTYPE err;
-  GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+  return self->max_width > 0 && self->max_height > 0;
+}
 
-#if defined (USE_OMX_TARGET_RPI) && defined (HAVE_GST_GL)
-  port = self->eglimage ? self->egl_out_port : self->dec_out_port;
-#else
-  port = self->dec_out_port;
-#endif
+/* Returns TRUE if the buffers allocated on @port still fit the frames
+ * after its settings changed. Resolution switches within max-width and
+ * max-height only change the frame size then, the buffers are laid out
+ * for the maximum resolution already */
+static gboolean
+gst_omx_video_dec_keeps_output_buffers (GstOMXVideoDec * self,
+    GstOMXPort * port)
+{
+  OMX_PARAM_PORTDEFINITIONTYPE port_def;
+  OMX_VIDEO_PORTDEFINITIONTYPE *allocated = &port->allocated_def.format.video;
 
-  acq_return = gst_omx_port_acquire_buffer (port, &buf);
-  if (acq_return == GST_OMX_ACQUIRE_BUFFER_ERROR) {
-    goto component_error;
-  } else if (acq_return == GST_OMX_ACQUIRE_BUFFER_FLUSHING) {
-    goto flushing;
-  } else if (acq_return == GST_OMX_ACQUIRE_BUFFER_EOS) {
-    goto eos;
-  }
+  if (!gst_omx_video_dec_is_adaptive (self) || !port->buffers
+      || port->buffers->len == 0)
+    return FALSE;
 
-  if (!gst_pad_has_current_caps (GST_VIDEO_DECODER_SRC_PAD (self)) ||
-      acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
-    GstVideoCodecState *state;
-    OMX_PARAM_PORTDEFINITIONTYPE port_def;
-    GstVideoFormat format;
+  gst_omx_port_get_port_definition (port, &port_def);
+  return port_def.format.video.nFrameWidth <= self->max_width
+      && port_def.format.video.nFrameHeight <= self->max_height
+      && port_def.format.video.eColorFormat == allocated->eColorFormat
+      && port_def.format.video.nStride == allocated->nStride
+      && port_def.format.video.nSliceHeight == allocated->nSliceHeight
+      && port_def.nBufferSize <= port->allocated_def.nBufferSize
+      && port_def.nBufferCountMin <= port->buffers->len;
+}
 
-    GST_DEBUG_OBJECT (self, "Port settings have changed, updating caps");
+/* Returns FALSE for streams that are known to be coded in display order,
+ * waiting for reordering only adds latency for them */
+static gboolean
+gst_omx_video_dec_has_reordering (GstVideoCodecState * state)
+{
+  GstStructure *s = gst_caps_get_structure (state->caps, 0);
+  const gchar *profile;
 
-    /* Reallocate all buffers */
-    if (acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE
-        && gst_omx_port_is_enabled (port)) {
-      err = gst_omx_port_set_enabled (port, FALSE);
-      if (err != OMX_ErrorNone)
-        goto reconfigure_error;
+  if (gst_structure_has_name (s, "video/x-vp8")
+      || gst_structure_has_name (s, "image/jpeg"))
+    return FALSE;
 
-      err = gst_omx_port_wait_buffers_released (port, 5 * GST_SECOND);
-      if (err != OMX_ErrorNone)
-        goto reconfigure_error;
+  if (gst_structure_has_name (s, "video/x-h264")) {
+    profile = gst_structure_get_string (s, "profile");
+    return g_strcmp0 (profile, "baseline") != 0
+        && g_strcmp0 (profile, "constrained-baseline") != 0;
+  }
 
-      err = gst_omx_video_dec_deallocate_output_buffers (self);
-      if (err != OMX_ErrorNone)
-        goto reconfigure_error;
+  return TRUE;
+}
 
-      err = gst_omx_port_wait_enabled (port, 1 * GST_SECOND);
-      if (err != OMX_ErrorNone)
-        goto reconfigure_error;
-    }
+static void
+gst_omx_video_dec_free_queued_time (gpointer queued)
+{
+  g_slice_free (gint64, queued);
+}
 
-    if (acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
-#ifdef USE_OMX_TARGET_RCAR
-      gboolean was_enabled = TRUE;
-      if (!gst_omx_port_is_enabled (port)) {
-        guint plane_size;
-        gint page_size = getpagesize ();
+/* Reports the time frames spend in the component as latency. Until
+ * a frame came back it is estimated from the frames held back for
+ * reordering, afterwards from the observed decoding times. The output
+ * buffers downstream can hold add to the maximum latency. A new latency
+ * is only reported if it changed noticeably.
+ *
+ * NOTE: Must be called with the stream lock held */
+static void
+gst_omx_video_dec_update_latency (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
+{
+  OMX_PARAM_PORTDEFINITIONTYPE *port_def = &self->dec_out_port->port_def;
+  GstClockTime duration = GST_CLOCK_TIME_NONE;
+  GstClockTime min_latency, max_latency;
+  GstClockTimeDiff diff;
+  gint64 *queued;
 
-        /* Reconfigure port def to make output allocation align for pagesize */
-        gst_omx_port_get_port_definition (port, &port_def);
-        GST_DEBUG_OBJECT (self, "nStridexnSliceHeight = %dx%d",
-            port_def.format.video.nStride, port_def.format.video.nSliceHeight);
-        plane_size =
-            port_def.format.video.nStride * port_def.format.video.nSliceHeight;
-        if (plane_size % page_size) {
-          if (port_def.format.video.nStride % 64)
-            port_def.format.video.nStride =
-                GST_ROUND_UP_64 (port_def.format.video.nStride);
-          if (port_def.format.video.nSliceHeight % 64)
-            port_def.format.video.nSliceHeight =
-                GST_ROUND_UP_64 (port_def.format.video.nSliceHeight);
+  if (frame && (queued = gst_video_codec_frame_get_user_data (frame))) {
+    GstClockTime decode_time =
+        (g_get_monotonic_time () - *queued) * GST_USECOND;
 
-          err = gst_omx_port_update_port_definition (self->dec_out_port,
-              &port_def);
-          if (err != OMX_ErrorNone)
-            goto reconfigure_error;
-          GST_DEBUG_OBJECT (self,
-              "After reconfigure nStridexnSliceHeight = %dx%d",
-              port->port_def.format.video.nStride,
-              port->port_def.format.video.nSliceHeight);
-        }
+    if (GST_CLOCK_TIME_IS_VALID (self->decode_time))
+      self->decode_time = (7 * self->decode_time + decode_time) / 8;
+    else
+      self->decode_time = decode_time;
+  }
 
-        err = gst_omx_port_set_enabled (port, TRUE);
-        if (err != OMX_ErrorNone)
-          goto reconfigure_error;
-        was_enabled = FALSE;
-      }
+  if (self->input_state && self->input_state->info.fps_n > 0)
+    duration = gst_util_uint64_scale (GST_SECOND,
+        self->input_state->info.fps_d, self->input_state->info.fps_n);
 
-      /* Re-allocate output buffer */
+  if (GST_CLOCK_TIME_IS_VALID (self->decode_time))
+    min_latency = self->decode_time;
+  else if (GST_CLOCK_TIME_IS_VALID (duration))
+    min_latency = (self->reorder ? port_def->nBufferCountMin : 1) * duration;
+  else
+    return;
+
+  if (GST_CLOCK_TIME_IS_VALID (self->latency)) {
+    diff = GST_CLOCK_DIFF (self->latency, min_latency);
+    if (frame && ABS (diff) <= MAX (self->latency / 8, GST_MSECOND))
+      return;
+  }
+  self->latency = min_latency;
+
+  if (GST_CLOCK_TIME_IS_VALID (duration))
+    max_latency = min_latency + (port_def->nBufferCountActual +
+        self->push_queue_size + self->input_queue_size) * duration;
+  else
+    max_latency = GST_CLOCK_TIME_NONE;
+
+  GST_DEBUG_OBJECT (self, "Latency %" GST_TIME_FORMAT " - %" GST_TIME_FORMAT,
+      GST_TIME_ARGS (min_latency), GST_TIME_ARGS (max_latency));
+  gst_video_decoder_set_latency (GST_VIDEO_DECODER (self), min_latency,
+      max_latency);
+}
+
+/* Finishes the frame, or drops it if it has no output buffer */
+static GstFlowReturn
+gst_omx_video_dec_finish_frame (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
+{
+  if (frame->output_buffer)
+    return gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self), frame);
+  else
+    return gst_video_decoder_drop_frame (GST_VIDEO_DECODER (self), frame);
+}
+
+static GstFlowReturn
+gst_omx_video_dec_push_queued_frame (GstVideoCodecFrame * frame,
+    gpointer user_data)
+{
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (user_data);
+  GstFlowReturn flow_ret;
+
+  /* The frame might have been taken from the queue before a flush */
+  if (gst_omx_video_frame_queue_is_flushing (self->push_queue)) {
+    gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), frame);
+    return GST_FLOW_FLUSHING;
+  }
+
+  /* Without holding the stream lock, finish_frame() takes it and releases
+   * it again while pushing. Upstream and the output loop can go on then
+   * while downstream blocks */
+  flow_ret = gst_omx_video_dec_finish_frame (self, frame);
+  GST_LOG_OBJECT (self, "Pushed frame: %s", gst_flow_get_name (flow_ret));
+
+  return flow_ret;
+}
+
+/* Finishes the frame, from the thread of push_queue if push-queue-size
+ * is set. Waits for space in the queue then and returns the flow return
+ * of the previous pushes.
+ *
+ * NOTE: Must be called with the stream lock held once */
+static GstFlowReturn
+gst_omx_video_dec_push_frame (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
+{
+  GstFlowReturn flow_ret;
+
+  if (self->push_queue_size == 0)
+    return gst_omx_video_dec_finish_frame (self, frame);
+
+  /* The queue thread takes the stream lock to push the frames, it must
+   * not be held while waiting for it */
+  GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+  flow_ret = gst_omx_video_frame_queue_push (self->push_queue, frame,
+      self->push_queue_size);
+  GST_VIDEO_DECODER_STREAM_LOCK (self);
+
+  return flow_ret;
+}
+
+/* Waits until all queued frames are pushed downstream.
+ *
+ * NOTE: Must be called without the stream lock */
+static void
+gst_omx_video_dec_wait_pushed (GstOMXVideoDec * self)
+{
+  gst_omx_video_frame_queue_wait_empty (self->push_queue);
+}
+
+/* Drops all queued frames if flushing, otherwise waits for the frame
+ * being pushed and allows pushing again.
+ *
+ * NOTE: Must be called without the stream lock */
+static void
+gst_omx_video_dec_set_push_flushing (GstOMXVideoDec * self, gboolean flush)
+{
+  gst_omx_video_frame_queue_set_flushing (self->push_queue, flush);
+}
+
+/* Called for every decoded frame before it is taken from out_port_pool.
+ * Grows the output buffers if the component often runs out of them
+ * because downstream holds all others and the memory budget still has
+ * room, and shrinks them if downstream leaves some unused for a while.
+ * Shrinking never goes below the number the last growth led to, so that
+ * the count does not go back and forth. The new number is applied at the
+ * next keyframe */
+static void
+gst_omx_video_dec_tune_output_buffers (GstOMXVideoDec * self)
+{
+  GstOMXPort *port = self->dec_out_port;
+  guint n = port->buffers->len;
+  guint held, count = 0;
+
+  if (g_atomic_int_get (&self->output_buffers_changed))
+    return;
+
+  /* Buffers downstream or waiting to be pushed, this frame was the last
+   * one the component had if all others are held */
+  held = g_atomic_int_get (&GST_OMX_BUFFER_POOL (self->out_port_pool)->
+      outstanding);
+  self->tune_max_held = MAX (self->tune_max_held, held);
+  if (held + 1 >= n)
+    self->tune_stalls++;
+  if (++self->tune_frames < GST_OMX_VIDEO_DEC_TUNE_PERIOD)
+    return;
+
+  if (self->tune_stalls * 100 >
+      self->tune_frames * GST_OMX_VIDEO_DEC_TUNE_STALL_PERCENT) {
+    guint64 size = port->port_def.nBufferSize;
+    guint64 fit = G_MAXUINT;
+
+    /* The current buffers are reserved already, only grow by what is
+     * left of the memory budget */
+    if (size > 0)
+      fit = MIN (gst_omx_memory_get_available () / size, G_MAXUINT);
+
+    self->tune_idle_periods = 0;
+    if (n < self->max_output_buffers && fit > 0) {
+      count = MIN (n + MIN (fit, 2), self->max_output_buffers);
+      self->tune_floor = count;
+    } else if (fit == 0) {
+      GST_DEBUG_OBJECT (self, "No memory left to grow the output buffers");
+    }
+  } else if (self->tune_stalls == 0 && self->tune_max_held + 3 < n) {
+    /* Keep two buffers to spare next to the ones held downstream */
+    if (++self->tune_idle_periods >= GST_OMX_VIDEO_DEC_TUNE_IDLE_PERIODS) {
+      self->tune_idle_periods = 0;
+      count = MAX (self->tune_max_held + 2, port->port_def.nBufferCountMin);
+      count = MAX (count, self->tune_floor);
+    }
+  } else {
+    self->tune_idle_periods = 0;
+  }
+
+  if (count > 0 && count != n) {
+    GST_INFO_OBJECT (self, "Using %u instead of %u output buffers, %u of %u "
+        "frames without free buffer, at most %u held downstream", count, n,
+        self->tune_stalls, self->tune_frames, self->tune_max_held);
+    self->output_buffers = count;
+    g_atomic_int_set (&self->output_buffers_changed, TRUE);
+  }
+
+  self->tune_frames = 0;
+  self->tune_stalls = 0;
+  self->tune_max_held = 0;
+}
+
+static void
+gst_omx_video_dec_loop (GstOMXVideoDec * self)
+{
+  GstOMXPort *port;
+  GstOMXBuffer *buf = NULL;
+  GstVideoCodecFrame *frame;
+  GstFlowReturn flow_ret = GST_FLOW_OK;
+  GstOMXAcquireBufferReturn acq_return;
+  GstClockTimeDiff deadline;
+  OMX_ERRORTYPE err;
+  GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+  gboolean resize = FALSE;
+
+#if defined (USE_OMX_TARGET_RPI) && defined (HAVE_GST_GL)
+  port = self->eglimage ? self->egl_out_port : self->dec_out_port;
+#else
+  port = self->dec_out_port;
+#endif
+
+  /* The component was drained to use a new number of output buffers,
+   * this is done like for new port settings */
+  if (self->reallocate_output_buffers) {
+    self->reallocate_output_buffers = FALSE;
+    resize = TRUE;
+    acq_return = GST_OMX_ACQUIRE_BUFFER_RECONFIGURE;
+  } else {
+    acq_return = gst_omx_port_acquire_buffer (port, &buf);
+  }
+  if (acq_return == GST_OMX_ACQUIRE_BUFFER_ERROR) {
+    goto component_error;
+  } else if (acq_return == GST_OMX_ACQUIRE_BUFFER_FLUSHING) {
+    goto flushing;
+  } else if (acq_return == GST_OMX_ACQUIRE_BUFFER_EOS) {
+    goto eos;
+  }
+
+  if (!gst_pad_has_current_caps (GST_VIDEO_DECODER_SRC_PAD (self)) ||
+      acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
+    GstVideoCodecState *state;
+    OMX_PARAM_PORTDEFINITIONTYPE port_def;
+    GstVideoFormat format;
+    gboolean reallocate = acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE;
+
+    /* Queued frames have to be pushed with the old caps */
+    gst_omx_video_dec_wait_pushed (self);
+
+    GST_DEBUG_OBJECT (self, "Port settings have changed, updating caps");
+
+    if (reallocate && !resize && gst_omx_port_is_enabled (port)
+        && gst_omx_video_dec_keeps_output_buffers (self, port)) {
+      GST_DEBUG_OBJECT (self, "Keeping the output buffers");
+      err = gst_omx_port_mark_reconfigured (port);
+      if (err != OMX_ErrorNone)
+        goto reconfigure_error;
+      reallocate = FALSE;
+    }
+
+    /* Reallocate all buffers */
+    if (reallocate && gst_omx_port_is_enabled (port)) {
+      err = gst_omx_port_set_enabled (port, FALSE);
+      if (err != OMX_ErrorNone)
+        goto reconfigure_error;
+
+      err = gst_omx_port_wait_buffers_released (port, 5 * GST_SECOND);
+      if (err != OMX_ErrorNone)
+        goto reconfigure_error;
+
+      err = gst_omx_video_dec_deallocate_output_buffers (self);
+      if (err != OMX_ErrorNone)
+        goto reconfigure_error;
+
+      err = gst_omx_port_wait_enabled (port, 1 * GST_SECOND);
+      if (err != OMX_ErrorNone)
+        goto reconfigure_error;
+    }
+
+    if (reallocate) {
+#ifdef USE_OMX_TARGET_RCAR
+      gboolean was_enabled = TRUE;
+      if (!gst_omx_port_is_enabled (port)) {
+        guint plane_size;
+        gint page_size = getpagesize ();
+        gboolean update_port_def = FALSE;
+
+        /* Reconfigure port def to make output allocation align for pagesize */
+        gst_omx_port_get_port_definition (port, &port_def);
+        GST_DEBUG_OBJECT (self, "nStridexnSliceHeight = %dx%d",
+            port_def.format.video.nStride, port_def.format.video.nSliceHeight);
+        if (gst_omx_video_dec_is_adaptive (self)) {
+          guint max_stride = self->max_width;
+
+          /* Lay out the buffers for the maximum resolution, so that the
+           * layout stays the same over resolution switches and only the
+           * frame size changes */
+          format =
+              gst_omx_video_get_format_from_omx (port_def.format.
+              video.eColorFormat, klass->cdata.vendor_formats);
+          if (format != GST_VIDEO_FORMAT_UNKNOWN)
+            max_stride =
+                gst_omx_video_get_row_bytes (gst_video_format_get_info
+                (format), 0, self->max_width);
+          max_stride = GST_ROUND_UP_64 (max_stride);
+          if (port_def.format.video.nStride < max_stride) {
+            port_def.format.video.nStride = max_stride;
+            update_port_def = TRUE;
+          }
+          if (port_def.format.video.nSliceHeight <
+              GST_ROUND_UP_64 (self->max_height)) {
+            port_def.format.video.nSliceHeight =
+                GST_ROUND_UP_64 (self->max_height);
+            update_port_def = TRUE;
+          }
+        }
+        if (self->output_buffers > 0 && !self->key_unit_trickmode
+            && !self->low_latency && port_def.nBufferCountActual !=
+            MAX (self->output_buffers, port_def.nBufferCountMin)) {
+          port_def.nBufferCountActual =
+              MAX (self->output_buffers, port_def.nBufferCountMin);
+          update_port_def = TRUE;
+        }
+        plane_size =
+            port_def.format.video.nStride * port_def.format.video.nSliceHeight;
+        if (plane_size % page_size) {
+          if (port_def.format.video.nStride % 64)
+            port_def.format.video.nStride =
+                GST_ROUND_UP_64 (port_def.format.video.nStride);
+          if (port_def.format.video.nSliceHeight % 64)
+            port_def.format.video.nSliceHeight =
+                GST_ROUND_UP_64 (port_def.format.video.nSliceHeight);
+          update_port_def = TRUE;
+        }
+
+        if (update_port_def) {
+          err = gst_omx_port_update_port_definition (self->dec_out_port,
+              &port_def);
+          if (err != OMX_ErrorNone)
+            goto reconfigure_error;
+          GST_DEBUG_OBJECT (self,
+              "After reconfigure nStridexnSliceHeight = %dx%d",
+              port->port_def.format.video.nStride,
+              port->port_def.format.video.nSliceHeight);
+        }
+
+        err = gst_omx_port_set_enabled (port, TRUE);
+        if (err != OMX_ErrorNone)
+          goto reconfigure_error;
+        was_enabled = FALSE;
+      }
+
+      /* Re-allocate output buffer */
       err = gst_omx_port_allocate_buffers (port);
       if (err != OMX_ErrorNone)
         goto reconfigure_error;
@@ -1441,8 +2298,9 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
 
           caps = gst_pad_get_current_caps (GST_VIDEO_DECODER_SRC_PAD (self));
           config = gst_buffer_pool_get_config (self->out_port_pool);
-          gst_buffer_pool_config_add_option (config,
-              GST_BUFFER_POOL_OPTION_VIDEO_META);
+          if (self->downstream_videometa)
+            gst_buffer_pool_config_add_option (config,
+                GST_BUFFER_POOL_OPTION_VIDEO_META);
           gst_buffer_pool_config_set_params (config, caps,
               self->dec_out_port->port_def.nBufferSize,
               self->dec_out_port->port_def.nBufferCountActual,
@@ -1454,6 +2312,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
             self->out_port_pool = NULL;
             goto reconfigure_error;
           }
+          gst_omx_video_dec_set_pool_crop (self);
           GST_OMX_BUFFER_POOL (self->out_port_pool)->allocating = TRUE;
           if (!gst_buffer_pool_set_active (self->out_port_pool, TRUE)) {
             GST_INFO_OBJECT (self, "Failed to activate internal pool");
@@ -1484,7 +2343,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
 
       format =
           gst_omx_video_get_format_from_omx (port_def.format.
-          video.eColorFormat);
+          video.eColorFormat, klass->cdata.vendor_formats);
 
       if (format == GST_VIDEO_FORMAT_UNKNOWN) {
         GST_ERROR_OBJECT (self, "Unsupported color format: %d",
@@ -1502,15 +2361,16 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
           (guint) port_def.format.video.nFrameWidth,
           (guint) port_def.format.video.nFrameHeight);
 
+      gst_omx_video_dec_update_crop (self, &port_def);
       state = gst_video_decoder_set_output_state (GST_VIDEO_DECODER (self),
-          format, port_def.format.video.nFrameWidth,
-          port_def.format.video.nFrameHeight, self->input_state);
+          format, self->crop.nWidth, self->crop.nHeight, self->input_state);
 
       /* Update the cached data of output port definition after it changes
        * This change reflects the change by negotiating caps with
        * downstream
        */
       gst_omx_port_update_port_definition (self->dec_out_port, NULL);
+      gst_omx_video_dec_update_latency (self, NULL);
 
       /* Take framerate and pixel-aspect-ratio from sinkpad caps */
       if (klass->cdata.hacks & GST_OMX_HACK_DEFAULT_PIXEL_ASPECT_RATIO) {
@@ -1555,8 +2415,17 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
       (guint) buf->omx_buf->nFlags, (guint64) buf->omx_buf->nTimeStamp);
 
   GST_VIDEO_DECODER_STREAM_LOCK (self);
-  frame = gst_omx_video_find_nearest_frame (buf,
-      gst_video_decoder_get_frames (GST_VIDEO_DECODER (self)));
+  frame = gst_omx_video_frame_index_take (self->frame_index,
+      buf->omx_buf->nTimeStamp);
+  if (!frame) {
+    /* The component changed the timestamp, fall back to a search */
+    frame = gst_omx_video_find_nearest_frame (buf,
+        gst_video_decoder_get_frames (GST_VIDEO_DECODER (self)));
+    if (frame)
+      gst_omx_video_frame_index_remove (self->frame_index, frame);
+  }
+  if (frame)
+    gst_omx_video_dec_update_latency (self, frame);
 
   /* So we have a timestamped OMX buffer and get, or not, corresponding frame.
    * Assuming decoder output frames in display order, frames preceding this
@@ -1568,8 +2437,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
     /* Only clean older frames in reorder mode. Do not clean in
      * no_reorder mode, as in that mode the output frames are not in
      * display order */
-    gst_omx_video_dec_clean_older_frames (self, buf,
-        gst_video_decoder_get_frames (GST_VIDEO_DECODER (self)));
+    gst_omx_video_dec_clean_older_frames (self, buf);
 
   if (frame
       && (deadline = gst_video_decoder_get_max_decode_time
@@ -1613,8 +2481,8 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
 
       if (GST_OMX_BUFFER_POOL (self->out_port_pool)->need_copy)
         outbuf =
-            copy_frame (&GST_OMX_BUFFER_POOL (self->out_port_pool)->video_info,
-            outbuf);
+            copy_frame (self,
+            &GST_OMX_BUFFER_POOL (self->out_port_pool)->video_info, outbuf);
 
       buf = NULL;
     } else {
@@ -1627,13 +2495,20 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
       }
     }
 
-    flow_ret = gst_pad_push (GST_VIDEO_DECODER_SRC_PAD (self), outbuf);
+    if (outbuf)
+      flow_ret = gst_pad_push (GST_VIDEO_DECODER_SRC_PAD (self), outbuf);
+    else
+      flow_ret = GST_FLOW_ERROR;
   } else if (buf->omx_buf->nFilledLen > 0 || buf->eglimage) {
     if (self->out_port_pool) {
       gint i, n;
       GstBuffer *outbuf;
       GstBufferPoolAcquireParams params = { 0, };
 
+      if (self->auto_output_buffers && !self->low_latency
+          && !self->key_unit_trickmode)
+        gst_omx_video_dec_tune_output_buffers (self);
+
       n = port->buffers->len;
       for (i = 0; i < n; i++) {
         GstOMXBuffer *tmp = g_ptr_array_index (port->buffers, i);
@@ -1657,13 +2532,16 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
 
       if (GST_OMX_BUFFER_POOL (self->out_port_pool)->need_copy)
         outbuf =
-            copy_frame (&GST_OMX_BUFFER_POOL (self->out_port_pool)->video_info,
-            outbuf);
-
-      frame->output_buffer = outbuf;
+            copy_frame (self,
+            &GST_OMX_BUFFER_POOL (self->out_port_pool)->video_info, outbuf);
 
-      flow_ret =
-          gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self), frame);
+      if (outbuf) {
+        frame->output_buffer = outbuf;
+        flow_ret = gst_omx_video_dec_push_frame (self, frame);
+      } else {
+        gst_video_decoder_drop_frame (GST_VIDEO_DECODER (self), frame);
+        flow_ret = GST_FLOW_ERROR;
+      }
       frame = NULL;
       buf = NULL;
     } else {
@@ -1682,13 +2560,14 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
           gst_omx_port_release_buffer (port, buf);
           goto invalid_buffer;
         }
-        flow_ret =
-            gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self), frame);
+        flow_ret = gst_omx_video_dec_push_frame (self, frame);
         frame = NULL;
       }
     }
   } else if (frame != NULL) {
-    flow_ret = gst_video_decoder_drop_frame (GST_VIDEO_DECODER (self), frame);
+    /* Dropped in order with the queued frames */
+    gst_buffer_replace (&frame->output_buffer, NULL);
+    flow_ret = gst_omx_video_dec_push_frame (self, frame);
     frame = NULL;
   }
 
@@ -1735,6 +2614,8 @@ flushing:
 
 eos:
   {
+    gst_omx_video_dec_wait_pushed (self);
+
     g_mutex_lock (&self->drain_lock);
     if (self->draining) {
       GstQuery *query = gst_query_new_drain ();
@@ -1757,6 +2638,8 @@ eos:
 
     GST_VIDEO_DECODER_STREAM_LOCK (self);
     self->downstream_flow_ret = flow_ret;
+    /* All output is done, forget frames that were dropped on the way */
+    gst_omx_video_frame_index_sweep (self->frame_index);
 
     /* Here we fallback and pause the task for the EOS case */
     if (flow_ret != GST_FLOW_OK)
@@ -1850,6 +2733,17 @@ gst_omx_video_dec_start (GstVideoDecoder * decoder)
 
   self->last_upstream_ts = 0;
   self->downstream_flow_ret = GST_FLOW_OK;
+  self->decode_time = GST_CLOCK_TIME_NONE;
+  self->latency = GST_CLOCK_TIME_NONE;
+  self->max_frame_size = 0;
+  self->output_buffers = 0;
+  self->output_buffers_changed = FALSE;
+  self->reallocate_output_buffers = FALSE;
+  self->tune_frames = 0;
+  self->tune_stalls = 0;
+  self->tune_max_held = 0;
+  self->tune_idle_periods = 0;
+  self->tune_floor = 0;
 
   return TRUE;
 }
@@ -1872,6 +2766,8 @@ gst_omx_video_dec_stop (GstVideoDecoder * decoder)
 #endif
 
   gst_pad_stop_task (GST_VIDEO_DECODER_SRC_PAD (decoder));
+  gst_omx_video_frame_queue_stop (self->push_queue);
+  gst_omx_video_frame_index_clear (self->frame_index);
 
   if (gst_omx_component_get_state (self->dec, 0) > OMX_StateIdle)
     gst_omx_component_set_state (self->dec, OMX_StateIdle);
@@ -1882,6 +2778,8 @@ gst_omx_video_dec_stop (GstVideoDecoder * decoder)
 
   self->downstream_flow_ret = GST_FLOW_FLUSHING;
   self->started = FALSE;
+  self->key_unit_trickmode = FALSE;
+  self->trickmode_changed = FALSE;
 
   g_mutex_lock (&self->drain_lock);
   self->draining = FALSE;
@@ -1894,6 +2792,10 @@ gst_omx_video_dec_stop (GstVideoDecoder * decoder)
 #endif
 
   gst_buffer_replace (&self->codec_data, NULL);
+  if (self->au_frame)
+    gst_video_codec_frame_unref (self->au_frame);
+  self->au_frame = NULL;
+  gst_omx_video_dec_drop_held_nals (self);
 
   if (self->input_state)
     gst_video_codec_state_unref (self->input_state);
@@ -1907,6 +2809,7 @@ gst_omx_video_dec_stop (GstVideoDecoder * decoder)
 static gboolean
 gst_omx_video_dec_negotiate (GstOMXVideoDec * self)
 {
+  GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
   OMX_VIDEO_PARAM_PORTFORMATTYPE param;
   OMX_ERRORTYPE err;
   GstCaps *comp_supported_caps;
@@ -1928,7 +2831,7 @@ gst_omx_video_dec_negotiate (GstOMXVideoDec * self)
 
   negotiation_map =
       gst_omx_video_get_supported_colorformats (self->dec_out_port,
-      self->input_state);
+      self->input_state, klass->cdata.vendor_formats);
 
   comp_supported_caps = gst_omx_video_get_caps_for_map (negotiation_map);
 
@@ -2005,6 +2908,7 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
   GstOMXVideoDecClass *klass;
   GstVideoInfo *info = &state->info;
   gboolean is_format_change = FALSE;
+  gboolean is_resolution_change = FALSE;
   gboolean needs_disable = FALSE;
   OMX_PARAM_PORTDEFINITIONTYPE port_def;
 
@@ -2018,13 +2922,16 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
   /* Check if the caps change is a real format change or if only irrelevant
    * parts of the caps have changed or nothing at all.
    */
-  is_format_change |= port_def.format.video.nFrameWidth != info->width;
-  is_format_change |= port_def.format.video.nFrameHeight != info->height;
+  is_resolution_change |= port_def.format.video.nFrameWidth != info->width;
+  is_resolution_change |= port_def.format.video.nFrameHeight != info->height;
   is_format_change |= (port_def.format.video.xFramerate == 0
       && info->fps_n != 0)
       || (port_def.format.video.xFramerate !=
       (info->fps_n << 16) / (info->fps_d));
-  is_format_change |= (self->codec_data != state->codec_data);
+  is_format_change |= !self->input_state
+      || self->input_state->codec_data != state->codec_data;
+  is_format_change |= self->trickmode_changed;
+  self->trickmode_changed = FALSE;
   if (klass->is_format_change)
     is_format_change |=
         klass->is_format_change (self, self->dec_in_port, state);
@@ -2032,6 +2939,22 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
   needs_disable =
       gst_omx_component_get_state (self->dec,
       GST_CLOCK_TIME_NONE) != OMX_StateLoaded;
+
+  /* In adaptive mode the component picks up resolution changes from the
+   * bitstream and reports them as output port settings change, which only
+   * reconfigures the output port. The component keeps running */
+  if (needs_disable && is_resolution_change && !is_format_change
+      && gst_omx_video_dec_is_adaptive (self)
+      && info->width <= self->max_width && info->height <= self->max_height) {
+    GST_DEBUG_OBJECT (self, "Adaptive resolution change to %dx%d",
+        info->width, info->height);
+    if (self->input_state)
+      gst_video_codec_state_unref (self->input_state);
+    self->input_state = gst_video_codec_state_ref (state);
+    return TRUE;
+  }
+  is_format_change |= is_resolution_change;
+
   /* If the component is not in Loaded state and a real format change happens
    * we have to disable the port and re-allocate all buffers. If no real
    * format change happened we can just exit here.
@@ -2078,6 +3001,8 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
       }
 #endif
 
+      if (!gst_omx_video_dec_free_input_pool (self, 5 * GST_SECOND, TRUE))
+        return FALSE;
       if (gst_omx_port_set_enabled (self->dec_in_port, FALSE) != OMX_ErrorNone)
         return FALSE;
       if (gst_omx_port_set_enabled (out_port, FALSE) != OMX_ErrorNone)
@@ -2139,6 +3064,21 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
 
   port_def.format.video.nFrameWidth = info->width;
   port_def.format.video.nFrameHeight = info->height;
+  if (self->low_latency)
+    port_def.nBufferCountActual = port_def.nBufferCountMin;
+  {
+    GstStructure *s = gst_caps_get_structure (state->caps, 0);
+    gint caps_size = 0;
+    guint max_input_size;
+
+    /* Allocate the input buffers large enough for the largest frame
+     * right away, if its size is known */
+    gst_structure_get_int (s, "max-input-size", &caps_size);
+    max_input_size = MAX (MAX (caps_size, 0), self->max_input_size);
+    max_input_size = MIN (max_input_size, GST_OMX_VIDEO_DEC_INPUT_SIZE_LIMIT);
+    if (max_input_size > port_def.nBufferSize)
+      port_def.nBufferSize = max_input_size;
+  }
   if (info->fps_n == 0)
     port_def.format.video.xFramerate = 0;
   else
@@ -2150,6 +3090,10 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
           &port_def) != OMX_ErrorNone)
     return FALSE;
 
+  /* Passed as is unless the subclass sets up a conversion */
+  gst_omx_bitstream_set_plain (&self->bitstream, state->codec_data);
+  self->nal_input = FALSE;
+
   if (klass->set_format) {
     if (!klass->set_format (self, self->dec_in_port, state)) {
       GST_ERROR_OBJECT (self, "Subclass failed to set the new format");
@@ -2157,16 +3101,19 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
     }
   }
 #ifdef HAVE_VIDEODEC_EXT
+  /* Keyframes don't need to wait for reordering */
+  self->reorder = !self->no_reorder && !self->key_unit_trickmode
+      && (!self->low_latency || gst_omx_video_dec_has_reordering (state));
   if (!needs_disable) {
     /* Setting reorder mode (output port only) */
     OMXR_MC_VIDEO_PARAM_REORDERTYPE sReorder;
     GST_OMX_INIT_STRUCT (&sReorder);
     sReorder.nPortIndex = self->dec_out_port->index;    /* default */
 
-    if (self->no_reorder != FALSE)
-      sReorder.bReorder = OMX_FALSE;
-    else
+    if (self->reorder)
       sReorder.bReorder = OMX_TRUE;
+    else
+      sReorder.bReorder = OMX_FALSE;
 
     gst_omx_component_set_parameter (self->dec, OMXR_MC_IndexParamVideoReorder,
         &sReorder);
@@ -2177,15 +3124,22 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
     GST_OMX_INIT_STRUCT (&sLossy);
     sLossy.nPortIndex = self->dec_out_port->index;
 
-    if (self->lossy_compress == TRUE)
+    /* Compressed frames need less memory, use them before the output
+     * buffers don't fit into the memory budget anymore */
+    if (self->lossy_compress == TRUE) {
       sLossy.bEnable = OMX_TRUE;
-    else
+    } else if (gst_omx_video_dec_is_memory_tight (self, state)) {
+      GST_INFO_OBJECT (self, "Using lossy compression for the memory budget");
+      sLossy.bEnable = OMX_TRUE;
+    } else {
       sLossy.bEnable = OMX_FALSE;
+    }
 
     gst_omx_component_set_parameter (self->dec,
         OMXR_MC_IndexParamVideoLossyCompression, &sLossy);
   }
 #else
+  self->reorder = gst_omx_video_dec_has_reordering (state);
   if (self->no_reorder != FALSE)
     GST_ERROR_OBJECT (self,
         "no-reorder mode is invalid now due to MC does not support");
@@ -2211,11 +3165,31 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
   }
   /* To make source code flexible, accept getting port_def param again */
 #endif
+  if (self->key_unit_trickmode || self->low_latency) {
+    OMX_PARAM_PORTDEFINITIONTYPE out_port_def;
+
+    /* Nothing is held back for reordering with keyframes only and low
+     * latency uses as few buffers as possible */
+    gst_omx_port_get_port_definition (self->dec_out_port, &out_port_def);
+    out_port_def.nBufferCountActual = out_port_def.nBufferCountMin;
+    if (gst_omx_port_update_port_definition (self->dec_out_port,
+            &out_port_def) != OMX_ErrorNone)
+      return FALSE;
+  } else if (self->output_buffers > 0) {
+    OMX_PARAM_PORTDEFINITIONTYPE out_port_def;
+
+    gst_omx_port_get_port_definition (self->dec_out_port, &out_port_def);
+    out_port_def.nBufferCountActual =
+        MAX (self->output_buffers, out_port_def.nBufferCountMin);
+    if (gst_omx_port_update_port_definition (self->dec_out_port,
+            &out_port_def) != OMX_ErrorNone)
+      return FALSE;
+  }
   if (gst_omx_port_update_port_definition (self->dec_out_port,
           NULL) != OMX_ErrorNone)
     return FALSE;
 
-  gst_buffer_replace (&self->codec_data, state->codec_data);
+  gst_buffer_replace (&self->codec_data, self->bitstream.header);
   self->input_state = gst_video_codec_state_ref (state);
 
   GST_DEBUG_OBJECT (self, "Enabling component");
@@ -2326,55 +3300,83 @@ gst_omx_video_dec_flush (GstVideoDecoder * decoder)
 {
   GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (decoder);
   OMX_ERRORTYPE err = OMX_ErrorNone;
+  gboolean paused = FALSE;
 
   GST_DEBUG_OBJECT (self, "Flushing decoder");
 
+  /* The base class releases all pending frames */
+  if (self->au_frame)
+    gst_video_codec_frame_unref (self->au_frame);
+  self->au_frame = NULL;
+  gst_omx_video_dec_drop_held_nals (self);
+
   if (gst_omx_component_get_state (self->dec, 0) == OMX_StateLoaded)
     return TRUE;
 
-  /* 0) Pause the components */
-  if (gst_omx_component_get_state (self->dec, 0) == OMX_StateExecuting) {
-    gst_omx_component_set_state (self->dec, OMX_StatePause);
-    gst_omx_component_get_state (self->dec, GST_CLOCK_TIME_NONE);
-  }
+  /* 0) Flush all ports with a single command. This is allowed in the
+   * Executing state and keeps the buffers allocated and the ports enabled,
+   * so seeking doesn't have to wait for a pause and a resume */
+  GST_DEBUG_OBJECT (self, "flushing ports");
+  err = OMX_ErrorNotImplemented;
 #if defined (USE_OMX_TARGET_RPI) && defined (HAVE_GST_GL)
-  if (self->eglimage) {
-    if (gst_omx_component_get_state (self->egl_render, 0) == OMX_StateExecuting) {
-      gst_omx_component_set_state (self->egl_render, OMX_StatePause);
-      gst_omx_component_get_state (self->egl_render, GST_CLOCK_TIME_NONE);
+  if (!self->eglimage)
+#endif
+    err = gst_omx_component_set_flushing (self->dec, 5 * GST_SECOND, TRUE);
+
+  if (gst_omx_error_is_unsupported (err)) {
+    GST_DEBUG_OBJECT (self, "Flushing port by port");
+
+    /* 1) Pause the components and flush the ports one by one */
+    if (gst_omx_component_get_state (self->dec, 0) == OMX_StateExecuting) {
+      gst_omx_component_set_state (self->dec, OMX_StatePause);
+      gst_omx_component_get_state (self->dec, GST_CLOCK_TIME_NONE);
+    }
+#if defined (USE_OMX_TARGET_RPI) && defined (HAVE_GST_GL)
+    if (self->eglimage) {
+      if (gst_omx_component_get_state (self->egl_render,
+              0) == OMX_StateExecuting) {
+        gst_omx_component_set_state (self->egl_render, OMX_StatePause);
+        gst_omx_component_get_state (self->egl_render, GST_CLOCK_TIME_NONE);
+      }
     }
-  }
 #endif
+    paused = TRUE;
 
-  /* 1) Flush the ports */
-  GST_DEBUG_OBJECT (self, "flushing ports");
-  gst_omx_port_set_flushing (self->dec_in_port, 5 * GST_SECOND, TRUE);
-  gst_omx_port_set_flushing (self->dec_out_port, 5 * GST_SECOND, TRUE);
+    gst_omx_port_set_flushing (self->dec_in_port, 5 * GST_SECOND, TRUE);
+    gst_omx_port_set_flushing (self->dec_out_port, 5 * GST_SECOND, TRUE);
 
 #if defined (USE_OMX_TARGET_RPI) && defined (HAVE_GST_GL)
-  if (self->eglimage) {
-    gst_omx_port_set_flushing (self->egl_in_port, 5 * GST_SECOND, TRUE);
-    gst_omx_port_set_flushing (self->egl_out_port, 5 * GST_SECOND, TRUE);
-  }
+    if (self->eglimage) {
+      gst_omx_port_set_flushing (self->egl_in_port, 5 * GST_SECOND, TRUE);
+      gst_omx_port_set_flushing (self->egl_out_port, 5 * GST_SECOND, TRUE);
+    }
 #endif
+  }
 
   /* 2) Wait until the srcpad loop is stopped,
    * unlock GST_VIDEO_DECODER_STREAM_LOCK to prevent deadlocks
    * caused by using this lock from inside the loop function */
   GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+  gst_omx_video_dec_set_push_flushing (self, TRUE);
   gst_pad_stop_task (GST_VIDEO_DECODER_SRC_PAD (decoder));
+  gst_omx_video_dec_set_push_flushing (self, FALSE);
   GST_DEBUG_OBJECT (self, "Flushing -- task stopped");
   GST_VIDEO_DECODER_STREAM_LOCK (self);
 
+  /* The base class releases all pending frames */
+  gst_omx_video_frame_index_clear (self->frame_index);
+
   /* 3) Resume components */
-  gst_omx_component_set_state (self->dec, OMX_StateExecuting);
-  gst_omx_component_get_state (self->dec, GST_CLOCK_TIME_NONE);
+  if (paused) {
+    gst_omx_component_set_state (self->dec, OMX_StateExecuting);
+    gst_omx_component_get_state (self->dec, GST_CLOCK_TIME_NONE);
 #if defined (USE_OMX_TARGET_RPI) && defined (HAVE_GST_GL)
-  if (self->eglimage) {
-    gst_omx_component_set_state (self->egl_render, OMX_StateExecuting);
-    gst_omx_component_get_state (self->egl_render, GST_CLOCK_TIME_NONE);
-  }
+    if (self->eglimage) {
+      gst_omx_component_set_state (self->egl_render, OMX_StateExecuting);
+      gst_omx_component_get_state (self->egl_render, GST_CLOCK_TIME_NONE);
+    }
 #endif
+  }
 
   /* 4) Unset flushing to allow ports to accept data again */
   gst_omx_port_set_flushing (self->dec_in_port, 5 * GST_SECOND, FALSE);
@@ -2407,27 +3409,294 @@ gst_omx_video_dec_flush (GstVideoDecoder * decoder)
   return TRUE;
 }
 
-static GstFlowReturn
-gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
+static gboolean
+gst_omx_video_dec_is_droppable (GstOMXVideoDec * self,
     GstVideoCodecFrame * frame)
 {
-  GstOMXAcquireBufferReturn acq_ret = GST_OMX_ACQUIRE_BUFFER_ERROR;
-  GstOMXVideoDec *self;
-  GstOMXVideoDecClass *klass;
-  GstOMXPort *port;
-  GstOMXBuffer *buf;
-  GstBuffer *codec_data = NULL;
-  guint offset = 0, size;
-  GstClockTime timestamp, duration;
-  OMX_ERRORTYPE err;
+  return GST_BUFFER_FLAG_IS_SET (frame->input_buffer,
+      GST_BUFFER_FLAG_DROPPABLE);
+}
 
-  self = GST_OMX_VIDEO_DEC (decoder);
-  klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+/* Whether @frame is only needed as reference for later frames and would be
+ * clipped by the base class anyway, as after an accurate seek */
+static gboolean
+gst_omx_video_dec_is_decode_only (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
+{
+  GstSegment *segment = &GST_VIDEO_DECODER (self)->input_segment;
+
+  if (GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (frame))
+    return TRUE;
+
+  if (segment->format != GST_FORMAT_TIME || segment->rate < 0.0
+      || !GST_CLOCK_TIME_IS_VALID (segment->start)
+      || !GST_CLOCK_TIME_IS_VALID (frame->pts)
+      || !GST_CLOCK_TIME_IS_VALID (frame->duration))
+    return FALSE;
+
+  return frame->pts + frame->duration <= segment->start;
+}
+
+/* Reallocates the input buffers with the given size. Disabling the port
+ * discards the data queued in it, so the component has to consume all
+ * of it first and this is only done before keyframes. Only the input
+ * port is reconfigured, decoding continues with the frames passed
+ * before. If the buffers don't become free, the current ones are kept.
+ *
+ * NOTE: Must be called with the stream lock held once */
+static gboolean
+gst_omx_video_dec_resize_input_buffers (GstOMXVideoDec * self, guint size)
+{
+  GstOMXPort *port = self->dec_in_port;
+  OMX_PARAM_PORTDEFINITIONTYPE port_def;
+  OMX_ERRORTYPE err;
+
+  /* Upstream might still write into buffers of the pool, the frames are
+   * split over the current buffers until it released them */
+  if ((self->in_port_pool
+          && !gst_omx_buffer_pool_wait_input_buffers (GST_OMX_BUFFER_POOL
+              (self->in_port_pool), 0))
+      || !gst_omx_video_dec_free_input_pool (self, 1 * GST_SECOND, TRUE)) {
+    GST_DEBUG_OBJECT (self, "Input buffers in use, not growing them");
+    return TRUE;
+  }
+
+  GST_DEBUG_OBJECT (self, "Growing input buffers from %u to %u bytes",
+      (guint) port->port_def.nBufferSize, size);
+
+  /* The output loop has to go on while the component consumes the
+   * input, it returns the input buffers only when it has space for
+   * its output */
+  GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+  err = gst_omx_port_wait_buffers_released (port, 5 * GST_SECOND);
+  GST_VIDEO_DECODER_STREAM_LOCK (self);
+  if (err != OMX_ErrorNone) {
+    /* E.g. downstream holds all output buffers while paused, growing is
+     * only an optimisation */
+    GST_DEBUG_OBJECT (self, "Component keeps its input buffers (%s), not "
+        "growing them", gst_omx_error_to_string (err));
+    return TRUE;
+  }
+
+  if (gst_omx_port_set_enabled (port, FALSE) != OMX_ErrorNone)
+    return FALSE;
+  if (gst_omx_port_wait_buffers_released (port, 5 * GST_SECOND)
+      != OMX_ErrorNone)
+    return FALSE;
+  if (gst_omx_port_deallocate_buffers (port) != OMX_ErrorNone)
+    return FALSE;
+  if (gst_omx_port_wait_enabled (port, 1 * GST_SECOND) != OMX_ErrorNone)
+    return FALSE;
+
+  gst_omx_port_get_port_definition (port, &port_def);
+  port_def.nBufferSize = size;
+  if (gst_omx_port_update_port_definition (port, &port_def) != OMX_ErrorNone)
+    return FALSE;
+
+  if (gst_omx_port_set_enabled (port, TRUE) != OMX_ErrorNone)
+    return FALSE;
+  if (gst_omx_port_allocate_buffers (port) != OMX_ErrorNone)
+    return FALSE;
+  if (gst_omx_port_wait_enabled (port, 5 * GST_SECOND) != OMX_ErrorNone)
+    return FALSE;
+  if (gst_omx_port_mark_reconfigured (port) != OMX_ErrorNone)
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Drops the NAL units held back before the first keyframe. Like for
+ * passed access units only the first one counts as frame */
+static void
+gst_omx_video_dec_drop_held_nals (GstOMXVideoDec * self)
+{
+  GstVideoCodecFrame *frame;
+  gboolean first = TRUE;
+
+  while ((frame = g_queue_pop_head (&self->held_nals))) {
+    if (first)
+      gst_video_decoder_drop_frame (GST_VIDEO_DECODER (self), frame);
+    else
+      gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), frame);
+    first = FALSE;
+  }
+}
+
+/* Holds back the NAL units of each access unit until one of them is a
+ * keyframe, the ones of access units without are dropped. Decoding then
+ * starts from the first NAL unit of the access unit, usually its
+ * parameter sets.
+ *
+ * NOTE: Must be called with the stream lock held once */
+static GstFlowReturn
+gst_omx_video_dec_hold_nal (GstOMXVideoDec * self, GstVideoCodecFrame * frame)
+{
+  GstVideoCodecFrame *head = g_queue_peek_head (&self->held_nals);
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  if (head && (GST_CLOCK_TIME_IS_VALID (frame->pts) ? frame->pts !=
+          head->pts : frame->dts != head->dts)) {
+    GST_LOG_OBJECT (self, "Dropping access unit without keyframe");
+    gst_omx_video_dec_drop_held_nals (self);
+  }
+
+  g_queue_push_tail (&self->held_nals, frame);
+  if (!GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame))
+    return GST_FLOW_OK;
+
+  GST_DEBUG_OBJECT (self, "Starting with %u NAL units of a keyframe",
+      g_queue_get_length (&self->held_nals));
+  self->passing_held_nals = TRUE;
+  while (ret == GST_FLOW_OK && (frame = g_queue_pop_head (&self->held_nals)))
+    ret = gst_omx_video_dec_feed_frame (GST_VIDEO_DECODER (self), frame);
+  self->passing_held_nals = FALSE;
+  gst_omx_video_dec_drop_held_nals (self);
+
+  return ret;
+}
+
+/* Tells the component that the access unit of au_frame is complete, if
+ * its last NAL unit didn't do so already */
+static void
+gst_omx_video_dec_end_access_unit (GstOMXVideoDec * self)
+{
+  GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+  GstVideoCodecFrame *frame = self->au_frame;
+  GstOMXAcquireBufferReturn acq_ret;
+  GstOMXBuffer *buf;
+
+  self->au_frame = NULL;
+
+  /* Components that can't handle empty buffers have to find the end of
+   * the access unit in the bitstream */
+  if (!(klass->cdata.hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER)) {
+    GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+    acq_ret = gst_omx_port_acquire_buffer (self->dec_in_port, &buf);
+    GST_VIDEO_DECODER_STREAM_LOCK (self);
+
+    if (acq_ret == GST_OMX_ACQUIRE_BUFFER_OK) {
+      buf->omx_buf->nFilledLen = 0;
+      if (GST_CLOCK_TIME_IS_VALID (frame->pts))
+        buf->omx_buf->nTimeStamp =
+            gst_util_uint64_scale (frame->pts, OMX_TICKS_PER_SECOND,
+            GST_SECOND);
+      else
+        buf->omx_buf->nTimeStamp = 0;
+      buf->omx_buf->nTickCount = 0;
+      buf->omx_buf->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+      gst_omx_port_release_buffer (self->dec_in_port, buf);
+    }
+  }
+
+  gst_video_codec_frame_unref (frame);
+}
+
+/* Passes the frame to the component.
+ *
+ * NOTE: Must be called with the stream lock held once */
+static GstFlowReturn
+gst_omx_video_dec_feed_frame (GstVideoDecoder * decoder,
+    GstVideoCodecFrame * frame)
+{
+  GstOMXAcquireBufferReturn acq_ret = GST_OMX_ACQUIRE_BUFFER_ERROR;
+  GstOMXVideoDec *self;
+  GstOMXVideoDecClass *klass;
+  GstOMXPort *port;
+  GstOMXBuffer *buf, *claimed = NULL;
+  GstBuffer *codec_data = NULL;
+  GstMapInfo map;
+  gsize offset = 0, size, consumed;
+  GstClockTime timestamp, duration;
+  gboolean decode_only = FALSE, first = TRUE;
+  gboolean continuation = FALSE, end_of_frame = TRUE;
+  OMX_ERRORTYPE err;
+
+  self = GST_OMX_VIDEO_DEC (decoder);
+  klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
 
   GST_DEBUG_OBJECT (self, "Handling frame");
 
+  /* NAL units with the timestamp of the current access unit belong to it,
+   * any other one starts the next access unit */
+  if (self->nal_input && self->au_frame) {
+    if (GST_CLOCK_TIME_IS_VALID (frame->pts) ? frame->pts ==
+        self->au_frame->pts : frame->dts == self->au_frame->dts)
+      continuation = TRUE;
+    else
+      gst_omx_video_dec_end_access_unit (self);
+  }
+  if (self->nal_input)
+    end_of_frame = GST_BUFFER_FLAG_IS_SET (frame->input_buffer,
+        GST_BUFFER_FLAG_MARKER);
+  /* The first NAL unit is usually a parameter set or delimiter, the
+   * access unit is a keyframe if any of its NAL units is */
+  if (continuation && GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame))
+    GST_VIDEO_CODEC_FRAME_SET_SYNC_POINT (self->au_frame);
+
+  if (self->key_unit_trickmode && !continuation
+      && !GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)) {
+    GST_LOG_OBJECT (self, "Skipping non-keyframe in key unit trick mode");
+    return gst_video_decoder_drop_frame (decoder, frame);
+  }
+
+  /* Trick mode changes come with a flushing seek, the first frame after
+   * it is a keyframe */
+  if (self->trickmode_changed && self->input_state && !continuation
+      && GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)) {
+    GstVideoCodecState *state = gst_video_codec_state_ref (self->input_state);
+    gboolean ret;
+
+    GST_DEBUG_OBJECT (self, "Reconfiguring component for trick mode change");
+    ret = gst_omx_video_dec_set_format (decoder, state);
+    gst_video_codec_state_unref (state);
+    if (!ret) {
+      gst_video_codec_frame_unref (frame);
+      return GST_FLOW_NOT_NEGOTIATED;
+    }
+  }
+
+  /* A new number of output buffers is applied at a keyframe, so that
+   * decoding continues from it. Only the output port is reallocated once
+   * the frames before it are out of the component */
+  if (g_atomic_int_get (&self->output_buffers_changed) && self->started
+      && !continuation && GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)
+      && !(klass->cdata.hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER)) {
+    GST_DEBUG_OBJECT (self, "Reallocating output buffers");
+    g_atomic_int_set (&self->output_buffers_changed, FALSE);
+    if (gst_omx_video_dec_drain (self) != GST_FLOW_OK) {
+      gst_video_codec_frame_unref (frame);
+      return GST_FLOW_ERROR;
+    }
+    self->reallocate_output_buffers = TRUE;
+  }
+
+  /* Frames larger than the input buffers are split over several of them,
+   * which costs extra round-trips and which some components parse badly.
+   * Grow the buffers to the largest frame seen before the next keyframe,
+   * restarting the component with it */
+  self->max_frame_size = MAX (self->max_frame_size,
+      gst_buffer_get_size (frame->input_buffer));
+  if (GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame) && !continuation
+      && !(klass->cdata.hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER)
+      && self->max_frame_size > self->dec_in_port->port_def.nBufferSize
+      && self->dec_in_port->port_def.nBufferSize <
+      GST_OMX_VIDEO_DEC_INPUT_SIZE_LIMIT && (!self->in_port_pool
+          || frame->input_buffer->pool != self->in_port_pool)) {
+    gsize new_size = self->max_frame_size + self->max_frame_size / 4;
+
+    new_size = MIN (GST_ROUND_UP_N (new_size, 4096),
+        GST_OMX_VIDEO_DEC_INPUT_SIZE_LIMIT);
+    if (!gst_omx_video_dec_resize_input_buffers (self, new_size))
+      goto reconfigure_error;
+  }
+
   if (!self->started) {
-    if (!GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)) {
+    /* The parameter sets in front of the first keyframe aren't keyframes
+     * themselves, single NAL units are held back until the keyframe of
+     * their access unit */
+    if (self->nal_input && !self->passing_held_nals)
+      return gst_omx_video_dec_hold_nal (self, frame);
+    if (!GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame) && !self->nal_input) {
       gst_video_decoder_drop_frame (GST_VIDEO_DECODER (self), frame);
       return GST_FLOW_OK;
     }
@@ -2441,7 +3710,8 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
       GST_CLOCK_TIME_IS_VALID (frame->dts))
     frame->pts = frame->dts;
 
-  timestamp = frame->pts;
+  /* The whole access unit is passed with the timestamp of its first NAL */
+  timestamp = continuation ? self->au_frame->pts : frame->pts;
   duration = frame->duration;
 
   if (self->downstream_flow_ret != GST_FLOW_OK) {
@@ -2449,27 +3719,63 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
     return self->downstream_flow_ret;
   }
 
-  if (klass->prepare_frame) {
-    GstFlowReturn ret;
-
-    ret = klass->prepare_frame (self, frame);
-    if (ret != GST_FLOW_OK) {
-      GST_ERROR_OBJECT (self, "Preparing frame failed: %s",
-          gst_flow_get_name (ret));
-      gst_video_codec_frame_unref (frame);
-      return ret;
+  if (g_atomic_int_get (&self->skip_frames)) {
+    GstClockTimeDiff deadline;
+
+    /* Nothing depends on a non-reference frame, so there is no point in
+     * decoding it if downstream QoS says it will be late already. The
+     * deadline is cheap, so only late frames get parsed */
+    if (!GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame) && !self->nal_input
+        && klass->is_droppable
+        && (deadline =
+            gst_video_decoder_get_max_decode_time (decoder, frame)) < 0
+        && klass->is_droppable (self, frame)) {
+      GST_DEBUG_OBJECT (self, "Skipping late non-reference frame (deadline %"
+          GST_TIME_FORMAT ")", GST_TIME_ARGS (-deadline));
+      return gst_video_decoder_drop_frame (decoder, frame);
     }
+
+    /* Frames without output are only expired in reorder mode */
+    if (!self->no_reorder)
+      decode_only = gst_omx_video_dec_is_decode_only (self,
+          continuation ? self->au_frame : frame);
   }
 
   port = self->dec_in_port;
 
   size = gst_buffer_get_size (frame->input_buffer);
+
+  /* A buffer of in_port_pool holds the frame in an OMX buffer already,
+   * unless codec data has to be passed in front of it or the frame has
+   * to be converted */
+  if (self->in_port_pool && !self->codec_data
+      && self->bitstream.format == GST_OMX_BITSTREAM_PLAIN)
+    claimed =
+        gst_omx_buffer_pool_claim_input_buffer (GST_OMX_BUFFER_POOL
+        (self->in_port_pool), frame->input_buffer);
+  if (claimed) {
+    /* Only the metadata is needed from now on, the pool can hand out the
+     * buffer again as soon as the component returns the OMX buffer */
+    gst_omx_video_dec_drop_input_data (frame);
+  } else {
+    if (!gst_buffer_map (frame->input_buffer, &map, GST_MAP_READ))
+      goto map_error;
+    gst_omx_bitstream_start_frame (&self->bitstream, map.data, map.size,
+        GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame));
+    gst_buffer_unmap (frame->input_buffer, &map);
+  }
+
   while (offset < size) {
     /* Make sure to release the base class stream lock, otherwise
      * _loop() can't call _finish_frame() and we might block forever
      * because no input buffers are released */
     GST_VIDEO_DECODER_STREAM_UNLOCK (self);
-    acq_ret = gst_omx_port_acquire_buffer (port, &buf);
+    if (claimed) {
+      buf = claimed;
+      acq_ret = GST_OMX_ACQUIRE_BUFFER_OK;
+    } else {
+      acq_ret = gst_omx_port_acquire_buffer (port, &buf);
+    }
 
     if (acq_ret == GST_OMX_ACQUIRE_BUFFER_ERROR) {
       GST_VIDEO_DECODER_STREAM_LOCK (self);
@@ -2478,7 +3784,30 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
       GST_VIDEO_DECODER_STREAM_LOCK (self);
       goto flushing;
     } else if (acq_ret == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
+      GST_VIDEO_DECODER_STREAM_LOCK (self);
+      /* The rest of the frame is copied from a buffer of our own, the
+       * pool buffers are freed with the port */
+      if (self->in_port_pool
+          && frame->input_buffer->pool == self->in_port_pool) {
+        GstBuffer *input_buffer = gst_buffer_new_allocate (NULL, size, NULL);
+
+        if (!gst_buffer_map (frame->input_buffer, &map, GST_MAP_READ)) {
+          gst_buffer_unref (input_buffer);
+          goto map_error;
+        }
+        gst_buffer_fill (input_buffer, 0, map.data, map.size);
+        gst_buffer_unmap (frame->input_buffer, &map);
+        gst_buffer_copy_into (input_buffer, frame->input_buffer,
+            GST_BUFFER_COPY_METADATA, 0, -1);
+        gst_buffer_unref (frame->input_buffer);
+        frame->input_buffer = input_buffer;
+      }
+
       /* Reallocate all buffers */
+      if (!gst_omx_video_dec_free_input_pool (self, 5 * GST_SECOND, TRUE))
+        goto reconfigure_error;
+      GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+
       err = gst_omx_port_set_enabled (port, FALSE);
       if (err != OMX_ErrorNone) {
         GST_VIDEO_DECODER_STREAM_LOCK (self);
@@ -2580,53 +3909,40 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
     }
 
     /* Now handle the frame */
-    GST_DEBUG_OBJECT (self, "Passing frame offset %d to the component", offset);
-
-    /* Copy the buffer content in chunks of size as requested
-     * by the port */
-    buf->omx_buf->nFilledLen =
-        MIN (size - offset, buf->omx_buf->nAllocLen - buf->omx_buf->nOffset);
-
-    if (GST_IS_OMX_WMV_DEC (self) && GST_OMX_WMV_DEC (self)->advanced_profile) {
-      guint8 *pd_sc;            //start code of picture data
-      GstMapInfo map;
-      gboolean right_struct = FALSE;
-      OMX_U32 omx_offset = buf->omx_buf->nOffset;
-
+    GST_DEBUG_OBJECT (self, "Passing frame offset %" G_GSIZE_FORMAT
+        " to the component", offset);
+
+    if (buf == claimed) {
+      /* Upstream wrote the frame into the buffer already */
+      GST_LOG_OBJECT (self, "Passing %u bytes without copy",
+          (guint) buf->omx_buf->nFilledLen);
+      consumed = buf->omx_buf->nFilledLen;
+      claimed = NULL;
+    } else {
+      /* Copy the buffer content in chunks of size as requested by the
+       * port, converting it to what the component expects on the way */
       if (!gst_buffer_map (frame->input_buffer, &map, GST_MAP_READ)) {
-        GST_ERROR_OBJECT (self, "Failed to create a gstbuffer mapping");
-        return GST_FLOW_ERROR;
+        gst_omx_port_release_buffer (port, buf);
+        goto map_error;
       }
-      if (map.data[0] == 0x00 && map.data[1] == 0x00 && map.data[2] == 0x01
-          && (map.data[3] == 0x0d || map.data[3] == 0x0e))
-        right_struct = TRUE;
+      buf->omx_buf->nFilledLen =
+          gst_omx_bitstream_fill (&self->bitstream, map.data + offset,
+          size - offset, &consumed,
+          buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
+          buf->omx_buf->nAllocLen - buf->omx_buf->nOffset);
       gst_buffer_unmap (frame->input_buffer, &map);
 
-      if (!right_struct) {
-        pd_sc = (guint8 *) g_malloc (4);
-        pd_sc[0] = 0x00;
-        pd_sc[1] = 0x00;
-        pd_sc[2] = 0x01;
-        pd_sc[3] = 0x0d;
-
-        memcpy (buf->omx_buf->pBuffer + buf->omx_buf->nOffset, pd_sc, 4);
-        omx_offset += 4;
-
-        g_free (pd_sc);
+      if (buf->omx_buf->nFilledLen == 0 && consumed == 0) {
+        gst_omx_port_release_buffer (port, buf);
+        goto full_buffer;
       }
-      gst_buffer_extract (frame->input_buffer, offset,
-          buf->omx_buf->pBuffer + omx_offset, buf->omx_buf->nFilledLen);
-    } else {
-      gst_buffer_extract (frame->input_buffer, offset,
-          buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
-          buf->omx_buf->nFilledLen);
     }
 
     if (timestamp != GST_CLOCK_TIME_NONE) {
       self->last_upstream_ts = timestamp;
     } else {
       /* Video stream does not provide timestamp, try calculate */
-      if (offset == 0) {
+      if (first) {
         if (duration != GST_CLOCK_TIME_NONE)
           /* In case timestamp is invalid. may use duration to calculate
            * timestamp */
@@ -2643,21 +3959,30 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
 
     buf->omx_buf->nTimeStamp =
         gst_util_uint64_scale (timestamp, OMX_TICKS_PER_SECOND, GST_SECOND);
+    if (first && !continuation) {
+      gint64 *queued = g_slice_new (gint64);
+
+      /* Remember when the frame was passed to measure the latency */
+      *queued = g_get_monotonic_time ();
+      gst_video_codec_frame_set_user_data (frame, queued,
+          gst_omx_video_dec_free_queued_time);
+      gst_omx_video_frame_index_add (self->frame_index,
+          buf->omx_buf->nTimeStamp, frame);
+    }
 
     buf->omx_buf->nTickCount =
-        gst_util_uint64_scale (buf->omx_buf->nFilledLen, duration, size);
+        gst_util_uint64_scale (consumed, duration, size);
 
-    if (offset == 0 && GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame))
+    if (first && GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame))
       buf->omx_buf->nFlags |= OMX_BUFFERFLAG_SYNCFRAME;
 
-    /* TODO: Set flags
-     *   - OMX_BUFFERFLAG_DECODEONLY for buffers that are outside
-     *     the segment
-     */
+    if (decode_only)
+      buf->omx_buf->nFlags |= OMX_BUFFERFLAG_DECODEONLY;
 
-    offset += buf->omx_buf->nFilledLen;
+    offset += consumed;
+    first = FALSE;
 
-    if (offset == size)
+    if (offset == size && end_of_frame)
       buf->omx_buf->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
 
     self->started = TRUE;
@@ -2666,7 +3991,26 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
       goto release_error;
   }
 
-  gst_video_codec_frame_unref (frame);
+  /* Copied into the OMX buffers, upstream can fill it again */
+  if (self->in_port_pool && frame->input_buffer->pool == self->in_port_pool)
+    gst_omx_video_dec_drop_input_data (frame);
+
+  if (self->nal_input) {
+    if (end_of_frame) {
+      if (self->au_frame)
+        gst_video_codec_frame_unref (self->au_frame);
+      self->au_frame = NULL;
+    } else if (!continuation) {
+      self->au_frame = gst_video_codec_frame_ref (frame);
+    }
+  }
+
+  /* Only the frame of the first NAL unit of an access unit is finished
+   * by the output, the others are done once they are passed */
+  if (continuation)
+    gst_video_decoder_release_frame (decoder, frame);
+  else
+    gst_video_codec_frame_unref (frame);
 
   GST_DEBUG_OBJECT (self, "Passed frame to component");
 
@@ -2688,6 +4032,14 @@ flow_error:
     return self->downstream_flow_ret;
   }
 
+map_error:
+  {
+    gst_video_codec_frame_unref (frame);
+    GST_ELEMENT_ERROR (self, STREAM, FAILED, (NULL),
+        ("Failed to map input buffer"));
+    return GST_FLOW_ERROR;
+  }
+
 too_large_codec_data:
   {
     gst_video_codec_frame_unref (frame);
@@ -2731,6 +4083,53 @@ release_error:
   }
 }
 
+static GstFlowReturn
+gst_omx_video_dec_feed_queued_frame (GstVideoCodecFrame * frame,
+    gpointer user_data)
+{
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (user_data);
+  GstFlowReturn ret;
+
+  GST_VIDEO_DECODER_STREAM_LOCK (self);
+  /* The frame might have been taken from the queue before a flush */
+  if (gst_omx_video_frame_queue_is_flushing (self->input_queue)) {
+    gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), frame);
+    ret = GST_FLOW_FLUSHING;
+  } else {
+    ret = gst_omx_video_dec_feed_frame (GST_VIDEO_DECODER (self), frame);
+  }
+  GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+
+  return ret;
+}
+
+static void
+gst_omx_video_dec_release_queued_frame (GstVideoCodecFrame * frame,
+    gpointer user_data)
+{
+  gst_video_decoder_release_frame (GST_VIDEO_DECODER (user_data), frame);
+}
+
+static GstFlowReturn
+gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
+    GstVideoCodecFrame * frame)
+{
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (decoder);
+  GstFlowReturn ret;
+
+  if (self->input_queue_size == 0)
+    return gst_omx_video_dec_feed_frame (decoder, frame);
+
+  /* Waiting for space in the queue must not keep the feeding thread from
+   * taking the stream lock */
+  GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+  ret = gst_omx_video_frame_queue_push (self->input_queue, frame,
+      self->input_queue_size);
+  GST_VIDEO_DECODER_STREAM_LOCK (self);
+
+  return ret;
+}
+
 static GstFlowReturn
 gst_omx_video_dec_finish (GstVideoDecoder * decoder)
 {
@@ -2753,12 +4152,20 @@ gst_omx_video_dec_drain (GstOMXVideoDec * self)
 
   klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
 
+  /* Nothing to decode without a keyframe */
+  gst_omx_video_dec_drop_held_nals (self);
+
   if (!self->started) {
     GST_DEBUG_OBJECT (self, "Component not started yet");
     return GST_FLOW_OK;
   }
   self->started = FALSE;
 
+  /* The EOS buffer ends an access unit that is still open */
+  if (self->au_frame)
+    gst_video_codec_frame_unref (self->au_frame);
+  self->au_frame = NULL;
+
   if ((klass->cdata.hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER)) {
     GST_WARNING_OBJECT (self, "Component does not support empty EOS buffers");
     return GST_FLOW_OK;
@@ -2820,6 +4227,173 @@ gst_omx_video_dec_drain (GstOMXVideoDec * self)
   return GST_FLOW_OK;
 }
 
+static gboolean
+gst_omx_video_dec_propose_allocation (GstVideoDecoder * decoder,
+    GstQuery * query)
+{
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (decoder);
+  GstOMXPort *port = self->dec_in_port;
+  GstStructure *config;
+  GstCaps *caps;
+
+  if (!self->no_copy_input)
+    goto done;
+
+  GST_VIDEO_DECODER_STREAM_LOCK (self);
+
+  /* The input buffers only exist after set_format() configured the
+   * component */
+  gst_query_parse_allocation (query, &caps, NULL);
+  if (!caps || !port->buffers
+      || gst_omx_component_get_state (self->dec, 0) != OMX_StateExecuting) {
+    GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+    goto done;
+  }
+
+  if (!self->in_port_pool) {
+    self->in_port_pool = gst_omx_buffer_pool_new (GST_ELEMENT_CAST (self),
+        self->dec, port);
+
+    config = gst_buffer_pool_get_config (self->in_port_pool);
+    gst_buffer_pool_config_set_params (config, caps,
+        port->port_def.nBufferSize, port->buffers->len, port->buffers->len);
+    if (!gst_buffer_pool_set_config (self->in_port_pool, config)) {
+      GST_INFO_OBJECT (self, "Failed to set config on input pool");
+      gst_object_unref (self->in_port_pool);
+      self->in_port_pool = NULL;
+      GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+      goto done;
+    }
+
+    GST_OMX_BUFFER_POOL (self->in_port_pool)->allocating = TRUE;
+    /* This now wraps all the buffers */
+    if (!gst_buffer_pool_set_active (self->in_port_pool, TRUE)) {
+      GST_INFO_OBJECT (self, "Failed to activate input pool");
+      gst_object_unref (self->in_port_pool);
+      self->in_port_pool = NULL;
+      GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+      goto done;
+    }
+    GST_OMX_BUFFER_POOL (self->in_port_pool)->allocating = FALSE;
+  }
+
+  GST_DEBUG_OBJECT (self, "Proposing %u input buffers of %u bytes",
+      port->buffers->len, (guint) port->port_def.nBufferSize);
+  gst_query_add_allocation_pool (query, self->in_port_pool,
+      port->port_def.nBufferSize, port->buffers->len, port->buffers->len);
+
+  GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+
+done:
+  return
+      GST_VIDEO_DECODER_CLASS
+      (gst_omx_video_dec_parent_class)->propose_allocation (decoder, query);
+}
+
+static const gchar *
+gst_omx_video_dec_get_output_mode (GstOMXVideoDec * self)
+{
+  if (self->use_dmabuf)
+    return "dmabuf";
+  else if (self->no_copy)
+    return "no-copy";
+  return "copy";
+}
+
+#ifdef USE_OMX_TARGET_RCAR
+/* TRUE if the frames of the output port don't have the default layout for
+ * @caps, downstream not handling video meta would get them copied then */
+static gboolean
+gst_omx_video_dec_output_is_padded (GstOMXVideoDec * self, GstCaps * caps)
+{
+  OMX_VIDEO_PORTDEFINITIONTYPE *video =
+      &self->dec_out_port->port_def.format.video;
+  GstVideoInfo info;
+
+  if (!caps || !gst_video_info_from_caps (&info, caps))
+    return TRUE;
+
+  return video->nStride != GST_VIDEO_INFO_PLANE_STRIDE (&info, 0)
+      || (GST_VIDEO_INFO_N_PLANES (&info) > 1
+      && video->nSliceHeight != GST_VIDEO_INFO_HEIGHT (&info))
+      || self->crop.nLeft != 0 || self->crop.nTop != 0;
+}
+#endif
+
+/* Picks the fastest of copy, no-copy and dmabuf mode downstream can take,
+ * unless one was set by property or hacks. Only possible as long as
+ * out_port_pool hasn't created its buffers yet */
+static void
+gst_omx_video_dec_choose_output_mode (GstOMXVideoDec * self, GstQuery * query)
+{
+#ifdef USE_OMX_TARGET_RCAR
+  GstCaps *caps;
+  GstCapsFeatures *features = NULL;
+  gboolean can_dmabuf = FALSE;
+  gboolean zero_copy = TRUE;
+  gboolean no_copy, use_dmabuf;
+
+  if (!self->auto_output_mode)
+    goto done;
+
+  if (self->out_port_pool && gst_buffer_pool_is_active (self->out_port_pool)) {
+    self->output_mode_reason = "output buffers already in use";
+    goto done;
+  }
+#if defined (HAVE_MMNGRBUF) && defined (HAVE_VIDEODEC_EXT)
+  can_dmabuf = TRUE;
+#endif
+
+  gst_query_parse_allocation (query, &caps, NULL);
+  if (caps && gst_caps_get_size (caps) > 0)
+    features = gst_caps_get_features (caps, 0);
+
+  if (features && gst_caps_features_contains (features,
+          GST_OMX_VIDEO_DEC_CAPS_FEATURE_MEMORY_DMABUF)) {
+    self->output_mode_reason = can_dmabuf ?
+        "downstream negotiated dmabuf memory" :
+        "downstream negotiated dmabuf memory, built without dmabuf support";
+  } else if (self->downstream_videometa) {
+    self->output_mode_reason = "downstream handles video meta";
+  } else if (!gst_omx_video_dec_output_is_padded (self, caps)) {
+    self->output_mode_reason = "frames have the default layout";
+  } else {
+    /* Each frame would be copied out of the OMX buffer anyway, copying it
+     * into a downstream buffer frees the OMX buffer sooner */
+    zero_copy = FALSE;
+    self->output_mode_reason =
+        "downstream can't take padded frames without video meta";
+  }
+
+  use_dmabuf = zero_copy && can_dmabuf;
+  no_copy = zero_copy && !can_dmabuf;
+
+  if (self->no_copy != no_copy || self->use_dmabuf != use_dmabuf) {
+    self->no_copy = no_copy;
+    self->use_dmabuf = use_dmabuf;
+
+    if (!no_copy && !use_dmabuf) {
+      if (self->out_port_pool) {
+        gst_object_unref (self->out_port_pool);
+        self->out_port_pool = NULL;
+      }
+    } else if (!self->out_port_pool) {
+      self->out_port_pool =
+          gst_omx_buffer_pool_new (GST_ELEMENT_CAST (self), self->dec,
+          self->dec_out_port);
+    }
+  }
+
+done:
+#else
+  /* Only R-Car reconfigures the output port by mode, see the loop */
+  if (self->auto_output_mode)
+    self->output_mode_reason = "default";
+#endif
+  GST_INFO_OBJECT (self, "Using %s mode: %s",
+      gst_omx_video_dec_get_output_mode (self), self->output_mode_reason);
+}
+
 static gboolean
 gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec, GstQuery * query)
 {
@@ -2868,35 +4442,70 @@ gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec, GstQuery * query)
 #endif
   /* Set up buffer pool and notify it to parent class */
   self = GST_OMX_VIDEO_DEC (bdec);
+
+  /* Padded frames can be passed as they are if downstream understands
+   * the metas describing their layout, they are copied otherwise */
+  self->downstream_videometa =
+      gst_query_find_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
+  self->downstream_cropmeta = self->downstream_videometa
+      && gst_query_find_allocation_meta (query, GST_VIDEO_CROP_META_API_TYPE,
+      NULL);
+
+  gst_omx_video_dec_choose_output_mode (self, query);
+
   if (self->out_port_pool) {
     GstCaps *caps;
     gboolean update_pool = FALSE;
     if (gst_query_get_n_allocation_pools (query) > 0) {
       update_pool = TRUE;
+
+      /* Keep the downstream pool around as destination of the frames that
+       * have to be copied out of the OMX buffers. An already active pool
+       * is in use by someone else and can't be reconfigured for us */
+      gst_query_parse_nth_allocation_pool (query, 0, &pool, NULL, NULL, NULL);
+      if (pool && pool != self->out_port_pool
+          && !GST_IS_OMX_BUFFER_POOL (pool)
+          && !gst_buffer_pool_is_active (pool)) {
+        gst_omx_video_dec_free_copy_pool (self);
+        self->copy_pool = pool;
+      } else if (pool) {
+        gst_object_unref (pool);
+      }
     }
-    /* Set pool parameters to our own configuration */
-    config = gst_buffer_pool_get_config (self->out_port_pool);
-    gst_buffer_pool_config_add_option (config,
-        GST_BUFFER_POOL_OPTION_VIDEO_META);
     gst_query_parse_allocation (query, &caps, NULL);
-    gst_buffer_pool_config_set_params (config, caps,
-        self->dec_out_port->port_def.nBufferSize,
-        self->dec_out_port->port_def.nBufferCountActual,
-        self->dec_out_port->port_def.nBufferCountActual);
-    if (!gst_buffer_pool_set_config (self->out_port_pool, config)) {
-      GST_ERROR_OBJECT (self, "Failed to set config on internal pool");
-      gst_object_unref (self->out_port_pool);
-      self->out_port_pool = NULL;
-      return FALSE;
-    }
-    GST_OMX_BUFFER_POOL (self->out_port_pool)->allocating = TRUE;
-    /* This now allocates all the buffers */
-    if (!gst_buffer_pool_set_active (self->out_port_pool, TRUE)) {
-      GST_INFO_OBJECT (self, "Failed to activate internal pool");
-      gst_object_unref (self->out_port_pool);
-      self->out_port_pool = NULL;
+    if (gst_buffer_pool_is_active (self->out_port_pool)) {
+      /* The output port kept its buffers over a resolution switch, only
+       * the frames in them changed their size */
+      gst_omx_video_dec_set_pool_crop (self);
+      if (!gst_omx_buffer_pool_update_frame_size (GST_OMX_BUFFER_POOL
+              (self->out_port_pool), caps))
+        return FALSE;
     } else {
-      GST_OMX_BUFFER_POOL (self->out_port_pool)->allocating = FALSE;
+      /* Set pool parameters to our own configuration */
+      config = gst_buffer_pool_get_config (self->out_port_pool);
+      if (self->downstream_videometa)
+        gst_buffer_pool_config_add_option (config,
+            GST_BUFFER_POOL_OPTION_VIDEO_META);
+      gst_buffer_pool_config_set_params (config, caps,
+          self->dec_out_port->port_def.nBufferSize,
+          self->dec_out_port->port_def.nBufferCountActual,
+          self->dec_out_port->port_def.nBufferCountActual);
+      if (!gst_buffer_pool_set_config (self->out_port_pool, config)) {
+        GST_ERROR_OBJECT (self, "Failed to set config on internal pool");
+        gst_object_unref (self->out_port_pool);
+        self->out_port_pool = NULL;
+        return FALSE;
+      }
+      gst_omx_video_dec_set_pool_crop (self);
+      GST_OMX_BUFFER_POOL (self->out_port_pool)->allocating = TRUE;
+      /* This now allocates all the buffers */
+      if (!gst_buffer_pool_set_active (self->out_port_pool, TRUE)) {
+        GST_INFO_OBJECT (self, "Failed to activate internal pool");
+        gst_object_unref (self->out_port_pool);
+        self->out_port_pool = NULL;
+      } else {
+        GST_OMX_BUFFER_POOL (self->out_port_pool)->allocating = FALSE;
+      }
     }
     if (update_pool)
       gst_query_set_nth_allocation_pool (query, 0, self->out_port_pool,
@@ -2918,9 +4527,15 @@ gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec, GstQuery * query)
     g_assert (pool != NULL);
 
     config = gst_buffer_pool_get_config (pool);
-    if (gst_query_find_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL)) {
+    if (self->downstream_videometa) {
       gst_buffer_pool_config_add_option (config,
           GST_BUFFER_POOL_OPTION_VIDEO_META);
+
+      /* Copied frames keep the stride and padding the hardware
+       * produced them with */
+      if (gst_buffer_pool_has_option (pool,
+              GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT))
+        gst_omx_video_dec_set_pool_alignment (self, config);
     }
     gst_buffer_pool_set_config (pool, config);
     gst_object_unref (pool);
@@ -2929,6 +4544,48 @@ gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec, GstQuery * query)
   return TRUE;
 }
 
+static gboolean
+gst_omx_video_dec_sink_event (GstVideoDecoder * decoder, GstEvent * event)
+{
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (decoder);
+  GstEventType type = GST_EVENT_TYPE (event);
+  gboolean ret;
+
+  /* Serialized events have to stay in order with the queued frames */
+  if (type == GST_EVENT_FLUSH_START)
+    gst_omx_video_frame_queue_set_flushing (self->input_queue, TRUE);
+  else if (GST_EVENT_IS_SERIALIZED (event) && type != GST_EVENT_FLUSH_STOP)
+    gst_omx_video_frame_queue_wait_empty (self->input_queue);
+
+  if (type == GST_EVENT_SEGMENT) {
+    const GstSegment *segment;
+    gboolean key_units;
+
+    gst_event_parse_segment (event, &segment);
+    key_units =
+        (segment->flags & GST_OMX_VIDEO_DEC_SEGMENT_FLAG_KEY_UNITS) != 0;
+
+    GST_VIDEO_DECODER_STREAM_LOCK (self);
+    if (key_units != self->key_unit_trickmode) {
+      GST_DEBUG_OBJECT (self, "%s key unit trick mode",
+          key_units ? "Entering" : "Leaving");
+      self->key_unit_trickmode = key_units;
+      /* Otherwise applied when the component gets configured */
+      self->trickmode_changed = self->input_state != NULL;
+    }
+    GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+  }
+
+  ret =
+      GST_VIDEO_DECODER_CLASS (gst_omx_video_dec_parent_class)->sink_event
+      (decoder, event);
+
+  if (type == GST_EVENT_FLUSH_STOP)
+    gst_omx_video_frame_queue_set_flushing (self->input_queue, FALSE);
+
+  return ret;
+}
+
 static void
 gst_omx_video_dec_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec)
@@ -2955,6 +4612,39 @@ gst_omx_video_dec_set_property (GObject * object, guint prop_id,
     case PROP_LOSSY_COMPRESS:
       self->lossy_compress = g_value_get_boolean (value);
       break;
+    case PROP_COPY_THREADS:
+      g_atomic_int_set (&self->copy_threads, g_value_get_uint (value));
+      break;
+    case PROP_SKIP_FRAMES:
+      g_atomic_int_set (&self->skip_frames, g_value_get_boolean (value));
+      break;
+    case PROP_MAX_WIDTH:
+      self->max_width = g_value_get_uint (value);
+      break;
+    case PROP_MAX_HEIGHT:
+      self->max_height = g_value_get_uint (value);
+      break;
+    case PROP_LOW_LATENCY:
+      self->low_latency = g_value_get_boolean (value);
+      break;
+    case PROP_PUSH_QUEUE_SIZE:
+      self->push_queue_size = g_value_get_uint (value);
+      break;
+    case PROP_INPUT_QUEUE_SIZE:
+      self->input_queue_size = g_value_get_uint (value);
+      break;
+    case PROP_MAX_INPUT_SIZE:
+      self->max_input_size = g_value_get_uint (value);
+      break;
+    case PROP_NO_COPY_INPUT:
+      self->no_copy_input = g_value_get_boolean (value);
+      break;
+    case PROP_AUTO_OUTPUT_BUFFERS:
+      self->auto_output_buffers = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_OUTPUT_BUFFERS:
+      self->max_output_buffers = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -2980,6 +4670,49 @@ gst_omx_video_dec_get_property (GObject * object, guint prop_id,
     case PROP_LOSSY_COMPRESS:
       g_value_set_boolean (value, self->lossy_compress);
       break;
+    case PROP_COPY_THREADS:
+      g_value_set_uint (value, g_atomic_int_get (&self->copy_threads));
+      break;
+    case PROP_SKIP_FRAMES:
+      g_value_set_boolean (value, g_atomic_int_get (&self->skip_frames));
+      break;
+    case PROP_MAX_WIDTH:
+      g_value_set_uint (value, self->max_width);
+      break;
+    case PROP_MAX_HEIGHT:
+      g_value_set_uint (value, self->max_height);
+      break;
+    case PROP_LOW_LATENCY:
+      g_value_set_boolean (value, self->low_latency);
+      break;
+    case PROP_PUSH_QUEUE_SIZE:
+      g_value_set_uint (value, self->push_queue_size);
+      break;
+    case PROP_INPUT_QUEUE_SIZE:
+      g_value_set_uint (value, self->input_queue_size);
+      break;
+    case PROP_MAX_INPUT_SIZE:
+      g_value_set_uint (value, self->max_input_size);
+      break;
+    case PROP_NO_COPY_INPUT:
+      g_value_set_boolean (value, self->no_copy_input);
+      break;
+    case PROP_AUTO_OUTPUT_BUFFERS:
+      g_value_set_boolean (value, self->auto_output_buffers);
+      break;
+    case PROP_MAX_OUTPUT_BUFFERS:
+      g_value_set_uint (value, self->max_output_buffers);
+      break;
+    case PROP_PUSH_QUEUE_LEVEL:
+      g_value_set_uint (value,
+          gst_omx_video_frame_queue_get_level (self->push_queue));
+      break;
+    case PROP_OUTPUT_MODE:
+      g_value_set_string (value, gst_omx_video_dec_get_output_mode (self));
+      break;
+    case PROP_OUTPUT_MODE_REASON:
+      g_value_set_string (value, self->output_mode_reason);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -31,6 +31,8 @@
 #include <gst/video/gstvideodecoder.h>
 
 #include "gstomx.h"
+#include "gstomxvideo.h"
+#include "gstomxbitstream.h"
 
 G_BEGIN_DECLS
 
@@ -63,6 +65,21 @@ struct _GstOMXVideoDec
   /* < private > */
   GstVideoCodecState *input_state;
   GstBuffer *codec_data;
+  /* Conversion of the input while it is copied into the OMX buffers,
+   * set up from the caps in set_format */
+  GstOMXBitstream bitstream;
+  /* TRUE if the input has one NAL unit per buffer (alignment=nal), set by
+   * the subclass in set_format. They are passed to the component as
+   * they arrive and the first one of an access unit stands for all */
+  gboolean nal_input;
+  /* Frame of the access unit whose NAL units are being passed, NULL if
+   * it was ended with OMX_BUFFERFLAG_ENDOFFRAME */
+  GstVideoCodecFrame *au_frame;
+  /* NAL units of the access unit held back before the component is
+   * started, until one of them is a keyframe */
+  GQueue held_nals;
+  /* Set TRUE while the held NAL units are passed */
+  gboolean passing_held_nals;
   /* TRUE if the component is configured and saw
    * the first buffer */
   gboolean started;
@@ -87,12 +104,102 @@ struct _GstOMXVideoDec
   gboolean no_copy;
   /* Set TRUE to use dmabuf to transfer decoded data */
   gboolean use_dmabuf;
+  /* TRUE if neither properties nor hacks chose between copy, no-copy and
+   * dmabuf mode, which is then done on the allocation query */
+  gboolean auto_output_mode;
+  /* Why the current mode is used, a static string */
+  const gchar *output_mode_reason;
+  /* Visible area of the decoded frames as reported by the component, the
+   * output caps have its size */
+  OMX_CONFIG_RECTTYPE crop;
+  /* TRUE if downstream handles GstVideoMeta, and GstVideoCropMeta along
+   * with it, as found in the last allocation query */
+  gboolean downstream_videometa;
+  gboolean downstream_cropmeta;
+  /* Set TRUE to propose in_port_pool to upstream, so that the input is
+   * written into the OMX buffers directly */
+  gboolean no_copy_input;
+  /* Former in_port_pools of which upstream still holds buffers, the input
+   * port buffers can't be freed before they are released */
+  GList *old_in_port_pools;
   /* Set TRUE to not using frame reorder */
   gboolean no_reorder;
   /* Set TRUE to use lossy image compression  */
   gboolean lossy_compress;
+  /* Set TRUE to use as few buffers as possible and to not wait for
+   * reordering of streams that have none */
+  gboolean low_latency;
+  /* TRUE if the component holds back frames to output them in display
+   * order */
+  gboolean reorder;
+  /* Smoothed time frames spend in the component and latency reported
+   * last, GST_CLOCK_TIME_NONE if unknown */
+  GstClockTime decode_time;
+  GstClockTime latency;
+  /* Frames passed to the component, by OMX timestamp */
+  GstOMXVideoFrameIndex *frame_index;
+  /* Set TRUE to not decode late non-reference frames and to not output
+   * frames before the segment start */
+  gboolean skip_frames;
+  /* TRUE while the segment asks for key unit trick mode, only keyframes
+   * are decoded then */
+  gboolean key_unit_trickmode;
+  /* TRUE if the component has to be reconfigured for a change of
+   * key_unit_trickmode */
+  gboolean trickmode_changed;
+  /* Largest resolution of the stream, output buffers are laid out for it
+   * and resolution switches don't reconfigure the component. 0 if
+   * unknown */
+  guint max_width, max_height;
+  /* Expected size of the largest input frame, input buffers are allocated
+   * for it. 0 to use the component default */
+  guint max_input_size;
+  /* Size of the largest input frame seen so far */
+  gsize max_frame_size;
+  /* Set TRUE to adapt the number of output buffers to how many of them
+   * downstream holds, between the component minimum and
+   * max_output_buffers */
+  gboolean auto_output_buffers;
+  guint max_output_buffers;
+  /* Number of output buffers chosen by the tuning, 0 if none. Applied
+   * by draining the component at the next keyframe once
+   * output_buffers_changed is set, the output loop then reallocates the
+   * output port buffers if reallocate_output_buffers is set */
+  guint output_buffers;
+  gboolean output_buffers_changed;
+  gboolean reallocate_output_buffers;
+  /* Decoded frames, frames that left the component without a free
+   * buffer, and the most buffers held downstream in the current tuning
+   * period. Number of periods in a row with buffers to spare */
+  guint tune_frames;
+  guint tune_stalls;
+  guint tune_max_held;
+  guint tune_idle_periods;
+  /* Number of output buffers the last growth led to, fewer ran out of
+   * buffers already and are not used again */
+  guint tune_floor;
+  /* Number of threads copying frames in copy mode, 0 for one per core */
+  guint copy_threads;
   /* Set TRUE if set_property() runs */
   gboolean has_set_property;
+
+  /* Number of input frames queued for passing them to the component
+   * from a thread of their own, 0 to pass them from handle_frame() */
+  guint input_queue_size;
+  GstOMXVideoFrameQueue *input_queue;
+
+  /* Number of decoded frames queued for the push thread, 0 to push them
+   * from the output loop */
+  guint push_queue_size;
+  /* Frames waiting to be pushed downstream by a thread of their own, so
+   * that a blocking downstream doesn't keep the output loop from
+   * returning buffers to the component */
+  GstOMXVideoFrameQueue *push_queue;
+
+  /* Pool providing the destination buffers of copy_frame(). It is the
+   * pool proposed by downstream when there is one, so the copied frames
+   * are recycled instead of being allocated for every output buffer */
+  GstBufferPool *copy_pool;
 };
 
 struct _GstOMXVideoDecClass
@@ -103,7 +210,7 @@ struct _GstOMXVideoDecClass
 
   gboolean (*is_format_change) (GstOMXVideoDec * self, GstOMXPort * port, GstVideoCodecState * state);
   gboolean (*set_format)       (GstOMXVideoDec * self, GstOMXPort * port, GstVideoCodecState * state);
-  GstFlowReturn (*prepare_frame)   (GstOMXVideoDec * self, GstVideoCodecFrame *frame);
+  gboolean (*is_droppable)     (GstOMXVideoDec * self, GstVideoCodecFrame *frame);
 };
 
 GType gst_omx_video_dec_get_type (void);
@@ -128,6 +128,8 @@ static gboolean gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
 static gboolean gst_omx_video_enc_flush (GstVideoEncoder * encoder);
 static GstFlowReturn gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
     GstVideoCodecFrame * frame);
+static gboolean gst_omx_video_enc_sink_event (GstVideoEncoder * encoder,
+    GstEvent * event);
 static GstFlowReturn gst_omx_video_enc_finish (GstVideoEncoder * encoder);
 static gboolean gst_omx_video_enc_propose_allocation (GstVideoEncoder * encoder,
     GstQuery * query);
@@ -140,6 +142,11 @@ static GstFlowReturn gst_omx_video_enc_drain (GstOMXVideoEnc * self,
 static GstFlowReturn gst_omx_video_enc_handle_output_frame (GstOMXVideoEnc *
     self, GstOMXPort * port, GstOMXBuffer * buf, GstVideoCodecFrame * frame);
 
+static GstFlowReturn gst_omx_video_enc_feed_queued_frame (GstVideoCodecFrame *
+    frame, gpointer user_data);
+static void gst_omx_video_enc_release_queued_frame (GstVideoCodecFrame *
+    frame, gpointer user_data);
+
 enum
 {
   PROP_0,
@@ -150,7 +157,10 @@ enum
   PROP_QUANT_B_FRAMES,
   PROP_SCAN_TYPE,
   PROP_NO_COPY,
-  PROP_USE_DMABUF
+  PROP_USE_DMABUF,
+  PROP_NO_COPY_OUTPUT,
+  PROP_COPY_THREADS,
+  PROP_INPUT_QUEUE_SIZE
 };
 
 /* FIXME: Better defaults */
@@ -160,6 +170,13 @@ enum
 #define GST_OMX_VIDEO_ENC_QUANT_P_FRAMES_DEFAULT (0xffffffff)
 #define GST_OMX_VIDEO_ENC_QUANT_B_FRAMES_DEFAULT (0xffffffff)
 #define GST_OMX_VIDEO_ENC_SCAN_TYPE_DEFAULT (0xffffffff)
+#define GST_OMX_VIDEO_ENC_COPY_THREADS_DEFAULT (1)
+#define GST_OMX_VIDEO_ENC_INPUT_QUEUE_SIZE_DEFAULT (0)
+#define GST_OMX_VIDEO_ENC_INPUT_QUEUE_SIZE_MAX (64)
+
+/* Output buffers allocated on top of the minimum required by the component
+ * in no-copy-output mode, to be held by downstream */
+#define GST_OMX_VIDEO_ENC_OUTPUT_EXTRA_BUFFERS (4)
 
 /* class initialization */
 
@@ -235,6 +252,29 @@ gst_omx_video_enc_class_init (GstOMXVideoEncClass * klass)
           "Whether or not to use dmabuf method",
           FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
           GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_NO_COPY_OUTPUT,
+      g_param_spec_boolean ("no-copy-output",
+          "Push output buffers to downstream",
+          "Whether or not to push encoded data without copying it, falls "
+          "back to copy when downstream holds too many buffers",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_COPY_THREADS,
+      g_param_spec_uint ("copy-threads", "Copy threads",
+          "Number of threads copying input frames into the component buffers "
+          "(0=one per CPU core)",
+          0, GST_OMX_VIDEO_COPY_MAX_THREADS,
+          GST_OMX_VIDEO_ENC_COPY_THREADS_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property (gobject_class, PROP_INPUT_QUEUE_SIZE,
+      g_param_spec_uint ("input-queue-size", "Input queue size",
+          "Number of input frames queued for passing them to the component "
+          "from a separate thread (0=pass from the upstream thread)",
+          0, GST_OMX_VIDEO_ENC_INPUT_QUEUE_SIZE_MAX,
+          GST_OMX_VIDEO_ENC_INPUT_QUEUE_SIZE_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
 
   element_class->change_state =
       GST_DEBUG_FUNCPTR (gst_omx_video_enc_change_state);
@@ -249,6 +289,8 @@ gst_omx_video_enc_class_init (GstOMXVideoEncClass * klass)
   video_encoder_class->handle_frame =
       GST_DEBUG_FUNCPTR (gst_omx_video_enc_handle_frame);
   video_encoder_class->finish = GST_DEBUG_FUNCPTR (gst_omx_video_enc_finish);
+  video_encoder_class->sink_event =
+      GST_DEBUG_FUNCPTR (gst_omx_video_enc_sink_event);
   video_encoder_class->propose_allocation =
       GST_DEBUG_FUNCPTR (gst_omx_video_enc_propose_allocation);
   video_encoder_class->getcaps = GST_DEBUG_FUNCPTR (gst_omx_video_enc_getcaps);
@@ -273,6 +315,14 @@ gst_omx_video_enc_init (GstOMXVideoEnc * self)
   self->scan_type = GST_OMX_VIDEO_ENC_SCAN_TYPE_DEFAULT;
   self->no_copy = FALSE;
   self->use_dmabuf = FALSE;
+  self->no_copy_output = FALSE;
+  self->copy_threads = GST_OMX_VIDEO_ENC_COPY_THREADS_DEFAULT;
+  self->input_queue_size = GST_OMX_VIDEO_ENC_INPUT_QUEUE_SIZE_DEFAULT;
+  self->input_queue = gst_omx_video_frame_queue_new ("omxvideoenc-in",
+      gst_omx_video_enc_feed_queued_frame,
+      gst_omx_video_enc_release_queued_frame, self);
+  self->frame_index =
+      gst_omx_video_frame_index_new (GST_ELEMENT_CAST (self));
   self->priv =
       G_TYPE_INSTANCE_GET_PRIVATE (self, GST_TYPE_OMX_VIDEO_ENC,
       GstOMXVideoEncPrivate);
@@ -464,6 +514,132 @@ gst_omx_video_enc_open (GstVideoEncoder * encoder)
   return TRUE;
 }
 
+/* Allocate buffers of the output port. In no-copy-output mode some more
+ * buffers than the minimum are allocated, so that the component can go on
+ * while downstream holds some of them */
+static OMX_ERRORTYPE
+gst_omx_video_enc_allocate_out_buffers (GstOMXVideoEnc * self)
+{
+  if (self->no_copy_output) {
+    OMX_PARAM_PORTDEFINITIONTYPE port_def;
+    guint count;
+
+    gst_omx_port_get_port_definition (self->enc_out_port, &port_def);
+    count = port_def.nBufferCountMin + GST_OMX_VIDEO_ENC_OUTPUT_EXTRA_BUFFERS;
+    if (port_def.nBufferCountActual < count) {
+      port_def.nBufferCountActual = count;
+      if (gst_omx_port_update_port_definition (self->enc_out_port,
+              &port_def) != OMX_ErrorNone)
+        GST_WARNING_OBJECT (self, "Failed to set %u output buffers", count);
+    }
+  }
+
+  return gst_omx_port_allocate_buffers (self->enc_out_port);
+}
+
+static void
+gst_omx_video_enc_free_out_port_pool (GstOMXVideoEnc * self)
+{
+  if (self->out_port_pool) {
+    gst_buffer_pool_set_active (self->out_port_pool, FALSE);
+    GST_OMX_BUFFER_POOL (self->out_port_pool)->deactivated = TRUE;
+    gst_object_unref (self->out_port_pool);
+    self->out_port_pool = NULL;
+  }
+}
+
+/* Wrap the buffers of the output port to push them without copy. Must be
+ * called with the output caps set and the port buffers allocated */
+static void
+gst_omx_video_enc_create_out_port_pool (GstOMXVideoEnc * self)
+{
+  GstOMXPort *port = self->enc_out_port;
+  GstStructure *config;
+  GstCaps *caps;
+
+  caps = gst_pad_get_current_caps (GST_VIDEO_ENCODER_SRC_PAD (self));
+  if (!caps || !port->buffers)
+    goto done;
+
+  self->out_port_pool =
+      gst_omx_buffer_pool_new (GST_ELEMENT_CAST (self), self->enc, port);
+
+  config = gst_buffer_pool_get_config (self->out_port_pool);
+  gst_buffer_pool_config_set_params (config, caps,
+      port->port_def.nBufferSize, port->buffers->len, port->buffers->len);
+  if (!gst_buffer_pool_set_config (self->out_port_pool, config)) {
+    GST_INFO_OBJECT (self, "Failed to set config on output pool");
+    gst_object_unref (self->out_port_pool);
+    self->out_port_pool = NULL;
+    goto done;
+  }
+
+  GST_OMX_BUFFER_POOL (self->out_port_pool)->allocating = TRUE;
+  /* This now wraps all the buffers */
+  if (!gst_buffer_pool_set_active (self->out_port_pool, TRUE)) {
+    GST_INFO_OBJECT (self, "Failed to activate output pool");
+    gst_object_unref (self->out_port_pool);
+    self->out_port_pool = NULL;
+    goto done;
+  }
+  GST_OMX_BUFFER_POOL (self->out_port_pool)->allocating = FALSE;
+
+  GST_DEBUG_OBJECT (self, "Pushing up to %u of %u output buffers without copy",
+      port->buffers->len - port->port_def.nBufferCountMin, port->buffers->len);
+
+done:
+  if (!self->out_port_pool)
+    GST_DEBUG_OBJECT (self, "Copying output buffers for downstream");
+  if (caps)
+    gst_caps_unref (caps);
+}
+
+/* Returns the buffer of out_port_pool corresponding to @buf, or NULL if
+ * the data has to be copied. The OMX buffer goes back to the port when
+ * downstream releases the returned buffer */
+static GstBuffer *
+gst_omx_video_enc_wrap_output_buffer (GstOMXVideoEnc * self, GstOMXPort * port,
+    GstOMXBuffer * buf)
+{
+  GstOMXBufferPool *pool;
+  GstBufferPoolAcquireParams params = { 0, };
+  GstBuffer *outbuf = NULL;
+  gint available;
+  gint i, n;
+
+  if (!self->out_port_pool || port != self->enc_out_port)
+    return NULL;
+
+  pool = GST_OMX_BUFFER_POOL (self->out_port_pool);
+
+  /* Leave the component enough buffers to go on encoding while
+   * downstream holds the others, copy otherwise */
+  available = port->buffers->len - g_atomic_int_get (&pool->outstanding);
+  if (available <= (gint) port->port_def.nBufferCountMin) {
+    GST_LOG_OBJECT (self, "Downstream holds %d buffers, copying",
+        g_atomic_int_get (&pool->outstanding));
+    return NULL;
+  }
+
+  n = port->buffers->len;
+  for (i = 0; i < n; i++) {
+    GstOMXBuffer *tmp = g_ptr_array_index (port->buffers, i);
+
+    if (tmp == buf)
+      break;
+  }
+  g_assert (i != n);
+
+  pool->current_buffer_index = i;
+  if (gst_buffer_pool_acquire_buffer (self->out_port_pool, &outbuf,
+          &params) != GST_FLOW_OK)
+    return NULL;
+
+  self->out_buffer_pushed = TRUE;
+
+  return outbuf;
+}
+
 static gboolean
 gst_omx_video_enc_shutdown (GstOMXVideoEnc * self)
 {
@@ -476,6 +652,7 @@ gst_omx_video_enc_shutdown (GstOMXVideoEnc * self)
     gst_object_unref (self->in_port_pool);
     self->in_port_pool = NULL;
   }
+  gst_omx_video_enc_free_out_port_pool (self);
 
   state = gst_omx_component_get_state (self->enc, 0);
   if (state > OMX_StateLoaded || state == OMX_StateInvalid) {
@@ -519,6 +696,8 @@ gst_omx_video_enc_finalize (GObject * object)
 
   g_mutex_clear (&self->drain_lock);
   g_cond_clear (&self->drain_cond);
+  gst_omx_video_frame_queue_free (self->input_queue);
+  gst_omx_video_frame_index_free (self->frame_index);
 #ifdef HAVE_MMNGRBUF
   if (self->priv->id_array->len > 0) {
     gint i;
@@ -583,6 +762,15 @@ gst_omx_video_enc_set_property (GObject * object, guint prop_id,
     case PROP_USE_DMABUF:
       self->use_dmabuf = g_value_get_boolean (value);
       break;
+    case PROP_NO_COPY_OUTPUT:
+      self->no_copy_output = g_value_get_boolean (value);
+      break;
+    case PROP_COPY_THREADS:
+      g_atomic_int_set (&self->copy_threads, g_value_get_uint (value));
+      break;
+    case PROP_INPUT_QUEUE_SIZE:
+      self->input_queue_size = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -620,6 +808,15 @@ gst_omx_video_enc_get_property (GObject * object, guint prop_id, GValue * value,
     case PROP_USE_DMABUF:
       g_value_set_boolean (value, self->use_dmabuf);
       break;
+    case PROP_NO_COPY_OUTPUT:
+      g_value_set_boolean (value, self->no_copy_output);
+      break;
+    case PROP_COPY_THREADS:
+      g_value_set_uint (value, g_atomic_int_get (&self->copy_threads));
+      break;
+    case PROP_INPUT_QUEUE_SIZE:
+      g_value_set_uint (value, self->input_queue_size);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -644,10 +841,12 @@ gst_omx_video_enc_change_state (GstElement * element, GstStateChange transition)
 
       self->draining = FALSE;
       self->started = FALSE;
+      gst_omx_video_frame_queue_set_flushing (self->input_queue, FALSE);
       break;
     case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
       break;
     case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_omx_video_frame_queue_set_flushing (self->input_queue, TRUE);
       if (self->enc_in_port)
         gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, TRUE);
       if (self->enc_out_port)
@@ -678,6 +877,7 @@ gst_omx_video_enc_change_state (GstElement * element, GstStateChange transition)
     case GST_STATE_CHANGE_PAUSED_TO_READY:
       self->downstream_flow_ret = GST_FLOW_FLUSHING;
       self->started = FALSE;
+      gst_omx_video_frame_queue_stop (self->input_queue);
 
       if (!gst_omx_video_enc_shutdown (self))
         ret = GST_STATE_CHANGE_FAILURE;
@@ -732,7 +932,10 @@ gst_omx_video_enc_handle_output_frame (GstOMXVideoEnc * self, GstOMXPort * port,
 
     GST_DEBUG_OBJECT (self, "Handling output data");
 
-    if (buf->omx_buf->nFilledLen > 0) {
+    if (buf->omx_buf->nFilledLen > 0
+        && (outbuf = gst_omx_video_enc_wrap_output_buffer (self, port, buf))) {
+      GST_LOG_OBJECT (self, "Pushing output buffer without copy");
+    } else if (buf->omx_buf->nFilledLen > 0) {
       outbuf = gst_buffer_new_and_alloc (buf->omx_buf->nFilledLen);
 
       gst_buffer_map (outbuf, &map, GST_MAP_WRITE);
@@ -820,6 +1023,7 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
       if (err != OMX_ErrorNone)
         goto reconfigure_error;
 
+      gst_omx_video_enc_free_out_port_pool (self);
       err = gst_omx_port_deallocate_buffers (port);
       if (err != OMX_ErrorNone)
         goto reconfigure_error;
@@ -860,7 +1064,7 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
       if (err != OMX_ErrorNone)
         goto reconfigure_error;
 
-      err = gst_omx_port_allocate_buffers (port);
+      err = gst_omx_video_enc_allocate_out_buffers (self);
       if (err != OMX_ErrorNone)
         goto reconfigure_error;
 
@@ -899,9 +1103,25 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
       (guint) buf->omx_buf->nFlags, (guint64) buf->omx_buf->nTimeStamp);
 
   GST_VIDEO_ENCODER_STREAM_LOCK (self);
+  if (self->no_copy_output && !self->out_port_pool)
+    gst_omx_video_enc_create_out_port_pool (self);
+
+  self->out_buffer_pushed = FALSE;
   if (buf->omx_buf->nFilledLen > 0) {
-    frame = gst_omx_video_find_nearest_frame (buf,
-        gst_video_encoder_get_frames (GST_VIDEO_ENCODER (self)));
+    /* Codec data doesn't finish the frame it shares the timestamp with */
+    if (buf->omx_buf->nFlags & OMX_BUFFERFLAG_CODECCONFIG)
+      frame = gst_omx_video_frame_index_lookup (self->frame_index,
+          buf->omx_buf->nTimeStamp);
+    else
+      frame = gst_omx_video_frame_index_take (self->frame_index,
+          buf->omx_buf->nTimeStamp);
+    if (!frame) {
+      /* The component changed the timestamp, fall back to a search */
+      frame = gst_omx_video_find_nearest_frame (buf,
+          gst_video_encoder_get_frames (GST_VIDEO_ENCODER (self)));
+      if (frame && !(buf->omx_buf->nFlags & OMX_BUFFERFLAG_CODECCONFIG))
+        gst_omx_video_frame_index_remove (self->frame_index, frame);
+    }
 
     g_assert (klass->handle_output_frame);
     flow_ret =
@@ -910,9 +1130,12 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
     GST_DEBUG_OBJECT (self, "Finished frame: %s", gst_flow_get_name (flow_ret));
 
   }
-  err = gst_omx_port_release_buffer (port, buf);
-  if (err != OMX_ErrorNone)
-    goto release_error;
+  /* Otherwise released by out_port_pool once downstream is done with it */
+  if (!self->out_buffer_pushed) {
+    err = gst_omx_port_release_buffer (port, buf);
+    if (err != OMX_ErrorNone)
+      goto release_error;
+  }
 
   self->downstream_flow_ret = flow_ret;
 
@@ -963,6 +1186,8 @@ eos:
 
     GST_VIDEO_ENCODER_STREAM_LOCK (self);
     self->downstream_flow_ret = flow_ret;
+    /* All output is done, forget frames that were dropped on the way */
+    gst_omx_video_frame_index_sweep (self->frame_index);
 
     /* Here we fallback and pause the task for the EOS case */
     if (flow_ret != GST_FLOW_OK)
@@ -1057,6 +1282,7 @@ gst_omx_video_enc_stop (GstVideoEncoder * encoder)
   gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, TRUE);
 
   gst_pad_stop_task (GST_VIDEO_ENCODER_SRC_PAD (encoder));
+  gst_omx_video_frame_index_clear (self->frame_index);
 
   if (gst_omx_component_get_state (self->enc, 0) > OMX_StateIdle)
     gst_omx_component_set_state (self->enc, OMX_StateIdle);
@@ -1079,6 +1305,70 @@ gst_omx_video_enc_stop (GstVideoEncoder * encoder)
   return TRUE;
 }
 
+#if defined (USE_OMX_TARGET_RCAR) && defined (HAVE_VIDEOR_EXT)
+/* In dmabuf mode Media Component reads each plane from the physical
+ * address set in the extended address of the OMX buffer */
+static gboolean
+gst_omx_video_enc_set_multiplane_format (GstOMXVideoEnc * self,
+    OMX_PARAM_PORTDEFINITIONTYPE * port_def)
+{
+  switch (port_def->format.video.eColorFormat) {
+    case OMX_COLOR_FormatYUV420Planar:
+      port_def->format.video.eColorFormat =
+          OMX_COLOR_FormatYUV420PlanarMultiPlane;
+      break;
+    case OMX_COLOR_FormatYUV420SemiPlanar:
+      port_def->format.video.eColorFormat =
+          OMX_COLOR_FormatYUV420SemiPlanarMultiPlane;
+      break;
+    default:
+      GST_ERROR_OBJECT (self, "Unsupported dmabuf mode for this format");
+      return FALSE;
+  }
+
+  return TRUE;
+}
+#endif
+
+/* Allocate OMXBuffer of input port with OMX_UseBuffer, each one only
+ * contains the extended address which is updated per frame */
+static gboolean
+gst_omx_video_enc_use_extaddr_buffers (GstOMXVideoEnc * self)
+{
+#ifdef HAVE_VIDEOR_EXT
+  OMXR_MC_VIDEO_EXTEND_ADDRESSTYPE ext_addr;
+  const GList *addr = NULL;
+  gint i;
+
+  ext_addr.nSize = sizeof (OMXR_MC_VIDEO_EXTEND_ADDRESSTYPE);
+  memset (ext_addr.pvVirtAddr, 0, sizeof (ext_addr.pvVirtAddr));
+  memset (ext_addr.u32HwipAddr, 0, sizeof (ext_addr.u32HwipAddr));
+  memset (ext_addr.u32AllocateSize, 0, sizeof (ext_addr.u32AllocateSize));
+
+  for (i = 0; i < self->enc_in_port->port_def.nBufferCountActual; i++)
+    g_array_append_val (self->priv->extaddr_array, ext_addr);
+
+  for (i = 0; i < self->priv->extaddr_array->len; i++)
+    addr =
+        g_list_append ((GList *) addr,
+        (gpointer) & g_array_index (self->priv->extaddr_array,
+            OMXR_MC_VIDEO_EXTEND_ADDRESSTYPE, i));
+  if (gst_omx_port_use_buffers (self->enc_in_port, addr) != OMX_ErrorNone) {
+    GST_ERROR_OBJECT (self,
+        ("Fail to allocate OMXBuffer by using OMX_UseBuffer"));
+    g_list_free ((GList *) addr);
+    return FALSE;
+  }
+  g_list_free ((GList *) addr);
+
+  return TRUE;
+#else
+  GST_ERROR_OBJECT (self,
+      ("dmabuf mode is invalid now due to MC does not support extension address"));
+  return FALSE;
+#endif
+}
+
 static gboolean
 gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
     GstVideoCodecState * state)
@@ -1133,6 +1423,7 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
         return FALSE;
       if (gst_omx_port_deallocate_buffers (self->enc_in_port) != OMX_ErrorNone)
         return FALSE;
+      gst_omx_video_enc_free_out_port_pool (self);
       if (gst_omx_port_deallocate_buffers (self->enc_out_port) != OMX_ErrorNone)
         return FALSE;
       if (gst_omx_port_wait_enabled (self->enc_in_port,
@@ -1147,7 +1438,7 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
 
     negotiation_map =
         gst_omx_video_get_supported_colorformats (self->enc_in_port,
-        self->input_state);
+        self->input_state, klass->cdata.vendor_formats);
     if (!negotiation_map) {
       /* Fallback */
       switch (info->finfo->format) {
@@ -1223,22 +1514,9 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
     }
 
 #if defined (USE_OMX_TARGET_RCAR) && defined (HAVE_VIDEOR_EXT)
-    if (self->use_dmabuf) {
-      switch (port_def.format.video.eColorFormat) {
-        case OMX_COLOR_FormatYUV420Planar:
-          port_def.format.video.eColorFormat =
-              OMX_COLOR_FormatYUV420PlanarMultiPlane;
-          break;
-        case OMX_COLOR_FormatYUV420SemiPlanar:
-          port_def.format.video.eColorFormat =
-              OMX_COLOR_FormatYUV420SemiPlanarMultiPlane;
-          break;
-        default:
-          GST_ERROR_OBJECT (self, "Unsupported dmabuf mode for this format");
-          return FALSE;
-          break;
-      }
-    }
+    if (self->use_dmabuf
+        && !gst_omx_video_enc_set_multiplane_format (self, &port_def))
+      return FALSE;
 #endif
     if (info->fps_n == 0) {
       port_def.format.video.xFramerate = 0;
@@ -1302,7 +1580,7 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
     if ((klass->cdata.hacks & GST_OMX_HACK_NO_DISABLE_OUTPORT)) {
       if (gst_omx_port_set_enabled (self->enc_out_port, TRUE) != OMX_ErrorNone)
         return FALSE;
-      if (gst_omx_port_allocate_buffers (self->enc_out_port) != OMX_ErrorNone)
+      if (gst_omx_video_enc_allocate_out_buffers (self) != OMX_ErrorNone)
         return FALSE;
 
       if (gst_omx_port_wait_enabled (self->enc_out_port,
@@ -1339,45 +1617,15 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
           return FALSE;
 
         if (self->use_dmabuf) {
-#ifdef HAVE_VIDEOR_EXT
-          OMXR_MC_VIDEO_EXTEND_ADDRESSTYPE ext_addr;
-          const GList *addr = NULL;
-          gint i;
-
-          ext_addr.nSize = sizeof (OMXR_MC_VIDEO_EXTEND_ADDRESSTYPE);
-          memset (ext_addr.pvVirtAddr, 0, sizeof (ext_addr.pvVirtAddr));
-          memset (ext_addr.u32HwipAddr, 0, sizeof (ext_addr.u32HwipAddr));
-          memset (ext_addr.u32AllocateSize, 0,
-              sizeof (ext_addr.u32AllocateSize));
-
-          for (i = 0; i < port_def.nBufferCountActual; i++)
-            g_array_append_val (self->priv->extaddr_array, ext_addr);
-
-          for (i = 0; i < self->priv->extaddr_array->len; i++)
-            addr =
-                g_list_append ((GList *) addr,
-                (gpointer) & g_array_index (self->priv->extaddr_array,
-                    OMXR_MC_VIDEO_EXTEND_ADDRESSTYPE, i));
-          if (gst_omx_port_use_buffers (self->enc_in_port,
-                  addr) != OMX_ErrorNone) {
-            GST_ERROR_OBJECT (self,
-                ("Fail to allocate OMXBuffer by using OMX_UseBuffer"));
-            g_list_free ((GList *) addr);
+          if (!gst_omx_video_enc_use_extaddr_buffers (self))
             return FALSE;
-          }
-          g_list_free ((GList *) addr);
-#else
-          GST_ERROR_OBJECT (self,
-              ("dmabuf mode is invalid now due to MC does not support extension address"));
-          return FALSE;
-#endif
         } else {
           /* Need to allocate buffers to reach Idle state */
           if (gst_omx_port_allocate_buffers (self->enc_in_port) !=
               OMX_ErrorNone)
             return FALSE;
         }
-        if (gst_omx_port_allocate_buffers (self->enc_out_port) != OMX_ErrorNone)
+        if (gst_omx_video_enc_allocate_out_buffers (self) != OMX_ErrorNone)
           return FALSE;
       }
     }
@@ -1431,8 +1679,12 @@ gst_omx_video_enc_flush (GstVideoEncoder * encoder)
   if (gst_omx_component_get_state (self->enc, 0) == OMX_StateLoaded)
     return TRUE;
 
-  gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, TRUE);
-  gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, TRUE);
+  /* Flush all ports with a single command if possible */
+  if (gst_omx_error_is_unsupported (gst_omx_component_set_flushing (self->enc,
+              5 * GST_SECOND, TRUE))) {
+    gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, TRUE);
+    gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, TRUE);
+  }
 
   /* Wait until the srcpad loop is finished,
    * unlock GST_VIDEO_ENCODER_STREAM_LOCK to prevent deadlocks
@@ -1442,6 +1694,9 @@ gst_omx_video_enc_flush (GstVideoEncoder * encoder)
   GST_PAD_STREAM_UNLOCK (GST_VIDEO_ENCODER_SRC_PAD (self));
   GST_VIDEO_ENCODER_STREAM_LOCK (self);
 
+  /* The base class releases all pending frames */
+  gst_omx_video_frame_index_clear (self->frame_index);
+
   gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, FALSE);
   gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, FALSE);
   gst_omx_port_populate (self->enc_out_port);
@@ -1488,7 +1743,7 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
 
   switch (info->finfo->format) {
     case GST_VIDEO_FORMAT_I420:{
-      gint i, j, height, width;
+      gint i, height, width;
       guint8 *src, *dest;
       gint src_stride, dest_stride;
 
@@ -1539,19 +1794,17 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
           break;
         }
 
-        for (j = 0; j < height; j++) {
-          memcpy (dest, src, width);
-          outbuf->omx_buf->nFilledLen += dest_stride;
-          src += src_stride;
-          dest += dest_stride;
-        }
+        gst_omx_video_copy_plane_threaded (dest, dest_stride, src,
+            src_stride, width, height, TRUE,
+            g_atomic_int_get (&self->copy_threads));
+        outbuf->omx_buf->nFilledLen += dest_stride * height;
       }
       gst_video_frame_unmap (&frame);
       ret = TRUE;
       break;
     }
     case GST_VIDEO_FORMAT_NV12:{
-      gint i, j, height, width;
+      gint i, height, width;
       guint8 *src, *dest;
       gint src_stride, dest_stride;
 
@@ -1597,12 +1850,10 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
           break;
         }
 
-        for (j = 0; j < height; j++) {
-          memcpy (dest, src, width);
-          outbuf->omx_buf->nFilledLen += dest_stride;
-          src += src_stride;
-          dest += dest_stride;
-        }
+        gst_omx_video_copy_plane_threaded (dest, dest_stride, src,
+            src_stride, width, height, TRUE,
+            g_atomic_int_get (&self->copy_threads));
+        outbuf->omx_buf->nFilledLen += dest_stride * height;
 
       }
       gst_video_frame_unmap (&frame);
@@ -1622,8 +1873,11 @@ done:
   return ret;
 }
 
+/* Passes the frame to the component.
+ *
+ * NOTE: Must be called with the stream lock held once */
 static GstFlowReturn
-gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
+gst_omx_video_enc_feed_frame (GstVideoEncoder * encoder,
     GstVideoCodecFrame * frame)
 {
   GstOMXAcquireBufferReturn acq_ret = GST_OMX_ACQUIRE_BUFFER_ERROR;
@@ -1921,6 +2175,8 @@ gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
       buf->omx_buf->nTimeStamp =
           gst_util_uint64_scale (timestamp, OMX_TICKS_PER_SECOND, GST_SECOND);
       self->last_upstream_ts = timestamp;
+      gst_omx_video_frame_index_add (self->frame_index,
+          buf->omx_buf->nTimeStamp, frame);
     }
 
     duration = frame->duration;
@@ -1999,6 +2255,77 @@ release_error:
   }
 }
 
+static GstFlowReturn
+gst_omx_video_enc_feed_queued_frame (GstVideoCodecFrame * frame,
+    gpointer user_data)
+{
+  GstOMXVideoEnc *self = GST_OMX_VIDEO_ENC (user_data);
+  GstFlowReturn ret;
+
+  GST_VIDEO_ENCODER_STREAM_LOCK (self);
+  /* The frame might have been taken from the queue before a flush */
+  if (gst_omx_video_frame_queue_is_flushing (self->input_queue)) {
+    gst_video_codec_frame_unref (frame);
+    ret = GST_FLOW_FLUSHING;
+  } else {
+    ret = gst_omx_video_enc_feed_frame (GST_VIDEO_ENCODER (self), frame);
+  }
+  GST_VIDEO_ENCODER_STREAM_UNLOCK (self);
+
+  return ret;
+}
+
+static void
+gst_omx_video_enc_release_queued_frame (GstVideoCodecFrame * frame,
+    gpointer user_data)
+{
+  /* The base class keeps the frame until it is flushed */
+  gst_video_codec_frame_unref (frame);
+}
+
+static GstFlowReturn
+gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
+    GstVideoCodecFrame * frame)
+{
+  GstOMXVideoEnc *self = GST_OMX_VIDEO_ENC (encoder);
+  GstFlowReturn ret;
+
+  if (self->input_queue_size == 0)
+    return gst_omx_video_enc_feed_frame (encoder, frame);
+
+  /* Waiting for space in the queue must not keep the feeding thread from
+   * taking the stream lock */
+  GST_VIDEO_ENCODER_STREAM_UNLOCK (self);
+  ret = gst_omx_video_frame_queue_push (self->input_queue, frame,
+      self->input_queue_size);
+  GST_VIDEO_ENCODER_STREAM_LOCK (self);
+
+  return ret;
+}
+
+static gboolean
+gst_omx_video_enc_sink_event (GstVideoEncoder * encoder, GstEvent * event)
+{
+  GstOMXVideoEnc *self = GST_OMX_VIDEO_ENC (encoder);
+  GstEventType type = GST_EVENT_TYPE (event);
+  gboolean ret;
+
+  /* Serialized events have to stay in order with the queued frames */
+  if (type == GST_EVENT_FLUSH_START)
+    gst_omx_video_frame_queue_set_flushing (self->input_queue, TRUE);
+  else if (GST_EVENT_IS_SERIALIZED (event) && type != GST_EVENT_FLUSH_STOP)
+    gst_omx_video_frame_queue_wait_empty (self->input_queue);
+
+  ret =
+      GST_VIDEO_ENCODER_CLASS (gst_omx_video_enc_parent_class)->sink_event
+      (encoder, event);
+
+  if (type == GST_EVENT_FLUSH_STOP)
+    gst_omx_video_frame_queue_set_flushing (self->input_queue, FALSE);
+
+  return ret;
+}
+
 static GstFlowReturn
 gst_omx_video_enc_finish (GstVideoEncoder * encoder)
 {
@@ -2168,6 +2495,11 @@ gst_omx_video_enc_propose_allocation (GstVideoEncoder * encoder,
         default:
           g_assert_not_reached ();
       }
+#if defined (USE_OMX_TARGET_RCAR) && defined (HAVE_VIDEOR_EXT)
+      if (self->use_dmabuf
+          && !gst_omx_video_enc_set_multiplane_format (self, &port_def))
+        return FALSE;
+#endif
       if (info.fps_n == 0) {
         port_def.format.video.xFramerate = 0;
       } else {
@@ -2222,10 +2554,15 @@ gst_omx_video_enc_propose_allocation (GstVideoEncoder * encoder,
               OMX_StateIdle) != OMX_ErrorNone)
         return FALSE;
 
-      if (gst_omx_port_allocate_buffers (self->enc_in_port) != OMX_ErrorNone)
+      if (self->use_dmabuf) {
+        /* Frames are exported to upstream as dmabuf by in_port_pool */
+        if (!gst_omx_video_enc_use_extaddr_buffers (self))
+          return FALSE;
+      } else if (gst_omx_port_allocate_buffers (self->enc_in_port) !=
+          OMX_ErrorNone)
         return FALSE;
 
-      if (gst_omx_port_allocate_buffers (self->enc_out_port) != OMX_ErrorNone)
+      if (gst_omx_video_enc_allocate_out_buffers (self) != OMX_ErrorNone)
         return FALSE;
     } else {
       /* Handle for case set_format() is called before propose_allocation() *
@@ -2239,7 +2576,12 @@ gst_omx_video_enc_propose_allocation (GstVideoEncoder * encoder,
       GstAllocator *allocator = NULL;
       GstAllocationParams params = { 0, };
 
-      if (gst_query_get_n_allocation_params (query) > 0)
+      if (self->use_dmabuf) {
+        /* Advertise that the proposed buffers contain dmabuf memory so
+         * that producers doing dmabuf import can use them directly */
+        allocator = gst_dmabuf_allocator_new ();
+        gst_query_add_allocation_param (query, allocator, &params);
+      } else if (gst_query_get_n_allocation_params (query) > 0)
         gst_query_parse_nth_allocation_param (query, 0, &allocator, &params);
       else
         gst_query_add_allocation_param (query, allocator, &params);
@@ -2296,6 +2638,7 @@ static GstCaps *
 gst_omx_video_enc_getcaps (GstVideoEncoder * encoder, GstCaps * filter)
 {
   GstOMXVideoEnc *self = GST_OMX_VIDEO_ENC (encoder);
+  GstOMXVideoEncClass *klass = GST_OMX_VIDEO_ENC_GET_CLASS (encoder);
   GList *negotiation_map = NULL;
   GstCaps *comp_supported_caps;
 
@@ -2304,7 +2647,7 @@ gst_omx_video_enc_getcaps (GstVideoEncoder * encoder, GstCaps * filter)
 
   negotiation_map =
       gst_omx_video_get_supported_colorformats (self->enc_in_port,
-      self->input_state);
+      self->input_state, klass->cdata.vendor_formats);
   comp_supported_caps = gst_omx_video_get_caps_for_map (negotiation_map);
   g_list_free_full (negotiation_map,
       (GDestroyNotify) gst_omx_video_negotiation_map_free);
@@ -27,6 +27,7 @@
 #include <gst/video/gstvideoencoder.h>
 
 #include "gstomx.h"
+#include "gstomxvideo.h"
 
 G_BEGIN_DECLS
 
@@ -86,6 +87,19 @@ struct _GstOMXVideoEnc
   gboolean no_copy;
   /* TRUE to receive dmabuf fd from upstream */
   gboolean use_dmabuf;
+  /* TRUE to push output buffers to downstream without copy */
+  gboolean no_copy_output;
+  /* TRUE if the output buffer currently handled was passed to
+   * downstream through out_port_pool */
+  gboolean out_buffer_pushed;
+  /* Frames passed to the component, by OMX timestamp */
+  GstOMXVideoFrameIndex *frame_index;
+  /* Number of threads copying input frames, 0 for one per core */
+  guint copy_threads;
+  /* Number of input frames queued for passing them to the component
+   * from a thread of their own, 0 to pass them from handle_frame() */
+  guint input_queue_size;
+  GstOMXVideoFrameQueue *input_queue;
   GstOMXVideoEncPrivate *priv;
 
   GstFlowReturn downstream_flow_ret;
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2016, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Measures the plane copy of omx/gstomxvideocopy.c against a plain
+ * memcpy() per row, for NV12 frames copied from a tightly packed
+ * GStreamer buffer into a padded OMX buffer. Several streams copy
+ * their frames at the same time from threads of their own, like
+ * multiple decoders would:
+ *
+ *   1080p:    copybench --width 1920 --height 1080 --threads 4
+ *   4K:       copybench --width 3840 --height 2160 --threads 4
+ *   8x1080p:  copybench --width 1920 --height 1080 --threads 4 --streams 8
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <gst/gst.h>
+
+#include "gstomxvideocopy.h"
+
+GST_DEBUG_CATEGORY (gst_omx_video_debug_category);
+
+typedef enum
+{
+  COPY_MEMCPY,
+  COPY_CACHED,
+  COPY_UNCACHED,
+  COPY_THREADED
+} CopyMode;
+
+typedef struct
+{
+  CopyMode mode;
+  guint8 *src;
+  guint8 *dest;
+} Stream;
+
+static gint width = 1920;
+static gint height = 1080;
+static gint stride = 0;
+static gint iterations = 200;
+static gint threads = 0;
+static gint n_streams = 1;
+
+static GOptionEntry entries[] = {
+  {"width", 0, 0, G_OPTION_ARG_INT, &width, "Frame width", "PIXELS"},
+  {"height", 0, 0, G_OPTION_ARG_INT, &height, "Frame height", "PIXELS"},
+  {"stride", 0, 0, G_OPTION_ARG_INT, &stride,
+      "Stride of the destination (default: width rounded up to 128)",
+      "BYTES"},
+  {"iterations", 0, 0, G_OPTION_ARG_INT, &iterations,
+      "Number of frames copied per stream and run", "N"},
+  {"threads", 0, 0, G_OPTION_ARG_INT, &threads,
+      "Threads per plane of the threaded copy (0 = one per core)", "N"},
+  {"streams", 0, 0, G_OPTION_ARG_INT, &n_streams,
+      "Number of streams copying at the same time", "N"},
+  {NULL}
+};
+
+static void
+copy_rows_memcpy (guint8 * dest, gint dest_stride, const guint8 * src,
+    gint src_stride, gint w, gint h)
+{
+  gint y;
+
+  for (y = 0; y < h; y++)
+    memcpy (dest + (gsize) y * dest_stride, src + (gsize) y * src_stride, w);
+}
+
+static gpointer
+stream_func (gpointer data)
+{
+  Stream *stream = data;
+  gint rows = height * 3 / 2;
+  gint i;
+
+  for (i = 0; i < iterations; i++) {
+    switch (stream->mode) {
+      case COPY_MEMCPY:
+        copy_rows_memcpy (stream->dest, stride, stream->src, width, width,
+            rows);
+        break;
+      case COPY_CACHED:
+      case COPY_UNCACHED:
+        gst_omx_video_copy_plane (stream->dest, stride, stream->src, width,
+            width, rows, stream->mode == COPY_UNCACHED);
+        break;
+      case COPY_THREADED:
+        gst_omx_video_copy_plane_threaded (stream->dest, stride, stream->src,
+            width, width, rows, FALSE, threads);
+        break;
+    }
+  }
+
+  return NULL;
+}
+
+/* Copies the frames of all streams @iterations times and prints the
+ * throughput of all of them together */
+static gboolean
+run (const gchar * name, CopyMode mode, Stream * streams,
+    const guint8 * expected)
+{
+  GThread **workers;
+  gint rows = height * 3 / 2;
+  gint64 start, elapsed;
+  gint i, y;
+
+  for (i = 0; i < n_streams; i++) {
+    streams[i].mode = mode;
+    memset (streams[i].dest, 0, (gsize) stride * rows);
+  }
+
+  workers = g_new0 (GThread *, n_streams);
+  start = g_get_monotonic_time ();
+  for (i = 1; i < n_streams; i++)
+    workers[i] = g_thread_new ("copybench", stream_func, &streams[i]);
+  stream_func (&streams[0]);
+  for (i = 1; i < n_streams; i++)
+    g_thread_join (workers[i]);
+  elapsed = MAX (g_get_monotonic_time () - start, 1);
+  g_free (workers);
+
+  for (i = 0; i < n_streams; i++) {
+    for (y = 0; y < rows; y++) {
+      if (memcmp (streams[i].dest + (gsize) y * stride,
+              expected + (gsize) y * stride, width) != 0) {
+        g_printerr ("%s: row %d of stream %d differs\n", name, y, i);
+        return FALSE;
+      }
+    }
+  }
+
+  g_print ("%-10s %8.1f MB/s %8.1f frames/s\n", name,
+      (gdouble) width * rows * iterations * n_streams / elapsed,
+      (gdouble) iterations * n_streams * G_USEC_PER_SEC / elapsed);
+
+  return TRUE;
+}
+
+gint
+main (gint argc, gchar ** argv)
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  Stream *streams;
+  guint8 *src, *expected;
+  gsize src_size, size, j;
+  gboolean ok;
+  gint i;
+
+  ctx = g_option_context_new ("- benchmark the OMX plane copy");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("Error initializing: %s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  GST_DEBUG_CATEGORY_INIT (gst_omx_video_debug_category, "omxvideo", 0,
+      "gst-omx-video");
+
+  if (stride == 0)
+    stride = GST_ROUND_UP_128 (width);
+  if (width <= 0 || height <= 0 || stride < width || iterations <= 0
+      || threads < 0 || n_streams <= 0) {
+    g_printerr ("Invalid settings\n");
+    return 1;
+  }
+
+  src_size = (gsize) width * height * 3 / 2;
+  size = (gsize) stride * height * 3 / 2;
+  src = g_malloc (src_size);
+  expected = g_malloc0 (size);
+
+  for (j = 0; j < src_size; j++)
+    src[j] = g_random_int ();
+  copy_rows_memcpy (expected, stride, src, width, width, height * 3 / 2);
+
+  /* Every stream copies from and to buffers of its own */
+  streams = g_new0 (Stream, n_streams);
+  for (i = 0; i < n_streams; i++) {
+    streams[i].src = g_memdup (src, src_size);
+    streams[i].dest = g_malloc (size);
+  }
+
+  g_print ("%d x NV12 %dx%d, destination stride %d, %d frames, "
+      "%d copy threads\n", n_streams, width, height, stride, iterations,
+      threads ? threads : (gint) g_get_num_processors ());
+
+  ok = run ("memcpy", COPY_MEMCPY, streams, expected)
+      && run ("cached", COPY_CACHED, streams, expected)
+      && run ("uncached", COPY_UNCACHED, streams, expected)
+      && run ("threaded", COPY_THREADED, streams, expected);
+
+  for (i = 0; i < n_streams; i++) {
+    g_free (streams[i].src);
+    g_free (streams[i].dest);
+  }
+  g_free (streams);
+  g_free (expected);
+  g_free (src);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2016, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Measures the decoding throughput of a pipeline, from going to PLAYING
+ * until EOS, by counting the buffers that reach the element named
+ * "sink". Comparing a single decoder with omxparalleldec shows how the
+ * parallel decoding scales:
+ *
+ *   decbench --pipeline "filesrc location=clip.mp4 ! qtdemux !
+ *       h264parse ! omxh264dec ! fakesink name=sink sync=false"
+ *   decbench --pipeline "filesrc location=clip.mp4 ! qtdemux !
+ *       h264parse ! omxparalleldec decoder=omxh264dec instances=4 !
+ *       fakesink name=sink sync=false"
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+
+static gchar *description = NULL;
+static gint runs = 1;
+
+static GOptionEntry entries[] = {
+  {"pipeline", 0, 0, G_OPTION_ARG_STRING, &description,
+      "Pipeline to run, in gst-launch syntax, with an element named sink",
+      "DESCRIPTION"},
+  {"runs", 0, 0, G_OPTION_ARG_INT, &runs, "Number of runs", "N"},
+  {NULL}
+};
+
+static GstPadProbeReturn
+count_buffer (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  guint64 *frames = user_data;
+
+  (*frames)++;
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Runs @pipeline until EOS and prints its throughput, returns FALSE on
+ * errors */
+static gboolean
+run (GstElement * pipeline, gint index)
+{
+  GstElement *sink;
+  GstPad *pad;
+  GstBus *bus;
+  GstMessage *msg;
+  guint64 frames = 0;
+  gint64 start, elapsed;
+  gboolean ret;
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  if (!sink) {
+    g_printerr ("No element named sink\n");
+    return FALSE;
+  }
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, count_buffer, &frames,
+      NULL);
+
+  bus = gst_element_get_bus (pipeline);
+  start = g_get_monotonic_time ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  elapsed = MAX (g_get_monotonic_time () - start, 1);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (bus);
+
+  ret = GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS;
+  if (ret) {
+    g_print ("Run %d: %" G_GUINT64_FORMAT " frames in %.2f s, "
+        "%.1f frames/s\n", index, frames, (gdouble) elapsed / G_USEC_PER_SEC,
+        (gdouble) frames * G_USEC_PER_SEC / elapsed);
+  } else {
+    GError *err = NULL;
+
+    gst_message_parse_error (msg, &err, NULL);
+    g_printerr ("Error: %s\n", err->message);
+    g_clear_error (&err);
+  }
+  gst_message_unref (msg);
+
+  gst_object_unref (pad);
+  gst_object_unref (sink);
+
+  return ret;
+}
+
+gint
+main (gint argc, gchar ** argv)
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GstElement *pipeline;
+  gboolean ok = TRUE;
+  gint i;
+
+  ctx = g_option_context_new ("- benchmark decoding throughput");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("Error initializing: %s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (!description || runs <= 0) {
+    g_printerr ("Invalid settings\n");
+    return 1;
+  }
+
+  /* A new pipeline for every run, so that each one starts cold */
+  for (i = 0; i < runs && ok; i++) {
+    pipeline = gst_parse_launch (description, &err);
+    if (!pipeline) {
+      g_printerr ("Failed to create the pipeline: %s\n", err->message);
+      g_clear_error (&err);
+      ok = FALSE;
+      break;
+    }
+
+    ok = run (pipeline, i);
+    gst_object_unref (pipeline);
+  }
+  g_free (description);
+
+  return ok ? 0 : 1;
+}
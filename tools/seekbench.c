@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2016, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Measures how long flushing seeks take through a decoding pipeline, from
+ * sending the seek until the pipeline prerolled again at the new position.
+ * Most of that time is spent flushing and restarting the decoder:
+ *
+ *   seekbench --pipeline "filesrc location=clip.mp4 ! qtdemux !
+ *       h264parse ! omxh264dec ! fakesink"
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+
+static gchar *description = NULL;
+static gint n_seeks = 100;
+static gboolean accurate = FALSE;
+
+static GOptionEntry entries[] = {
+  {"pipeline", 0, 0, G_OPTION_ARG_STRING, &description,
+      "Pipeline to seek in, in gst-launch syntax", "DESCRIPTION"},
+  {"seeks", 0, 0, G_OPTION_ARG_INT, &n_seeks, "Number of seeks", "N"},
+  {"accurate", 0, 0, G_OPTION_ARG_NONE, &accurate,
+      "Seek accurately instead of to the previous key unit", NULL},
+  {NULL}
+};
+
+/* Waits until @pipeline prerolled after a state change or a flushing
+ * seek, returns FALSE on errors */
+static gboolean
+wait_async_done (GstElement * pipeline)
+{
+  GstBus *bus = gst_element_get_bus (pipeline);
+  GstMessage *msg;
+  gboolean ret;
+
+  msg = gst_bus_timed_pop_filtered (bus, 10 * GST_SECOND,
+      GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR);
+  gst_object_unref (bus);
+
+  if (!msg) {
+    g_printerr ("Timeout waiting for the pipeline to preroll\n");
+    return FALSE;
+  }
+
+  ret = GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ASYNC_DONE;
+  if (!ret) {
+    GError *err = NULL;
+
+    gst_message_parse_error (msg, &err, NULL);
+    g_printerr ("Error: %s\n", err->message);
+    g_clear_error (&err);
+  }
+  gst_message_unref (msg);
+
+  return ret;
+}
+
+gint
+main (gint argc, gchar ** argv)
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GstElement *pipeline;
+  GstSeekFlags flags;
+  gint64 duration, start, elapsed, total = 0, min = G_MAXINT64, max = 0;
+  gint i;
+  gboolean ok = TRUE;
+
+  ctx = g_option_context_new ("- benchmark flushing seeks");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("Error initializing: %s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (!description || n_seeks <= 0) {
+    g_printerr ("Invalid settings\n");
+    return 1;
+  }
+
+  pipeline = gst_parse_launch (description, &err);
+  if (!pipeline) {
+    g_printerr ("Failed to create the pipeline: %s\n", err->message);
+    g_clear_error (&err);
+    return 1;
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  if (!wait_async_done (pipeline)
+      || !gst_element_query_duration (pipeline, GST_FORMAT_TIME, &duration)
+      || duration <= 0) {
+    g_printerr ("Failed to preroll the pipeline or to get its duration\n");
+    ok = FALSE;
+    goto done;
+  }
+
+  flags = GST_SEEK_FLAG_FLUSH;
+  flags |= accurate ? GST_SEEK_FLAG_ACCURATE : GST_SEEK_FLAG_KEY_UNIT;
+
+  for (i = 0; i < n_seeks; i++) {
+    /* Jump back and forth over the whole stream */
+    gint64 position = g_random_int_range (0, 1000) * (duration / 1000);
+
+    start = g_get_monotonic_time ();
+    if (!gst_element_seek_simple (pipeline, GST_FORMAT_TIME, flags, position)
+        || !wait_async_done (pipeline)) {
+      g_printerr ("Seek %d to %" GST_TIME_FORMAT " failed\n", i,
+          GST_TIME_ARGS (position));
+      ok = FALSE;
+      goto done;
+    }
+    elapsed = g_get_monotonic_time () - start;
+
+    total += elapsed;
+    min = MIN (min, elapsed);
+    max = MAX (max, elapsed);
+  }
+
+  g_print ("%d %s seeks: %.2f ms average, %.2f ms min, %.2f ms max\n",
+      n_seeks, accurate ? "accurate" : "key unit",
+      (gdouble) total / n_seeks / 1000, (gdouble) min / 1000,
+      (gdouble) max / 1000);
+
+done:
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+  g_free (description);
+
+  return ok ? 0 : 1;
+}